@@ -0,0 +1,533 @@
+#include <chrono>
+#include <string>
+#ifdef __linux__
+ #include <linux/perf_event.h>
+ #include <sys/ioctl.h>
+ #include <sys/syscall.h>
+ #include <unistd.h>
+#endif
+#include "printf-c.cc"
+
+extern "C" {
+int _write(int,const unsigned char*,unsigned num,unsigned) { return num; }
+}
+
+template<typename Func>
+static double TimePerCall(unsigned iterations, Func&& func)
+{
+    auto begin = std::chrono::steady_clock::now();
+    for(unsigned n=0; n<iterations; ++n) func();
+    auto end   = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::nano>(end - begin).count() / iterations;
+}
+
+// Returns the number of branch mispredictions per call, or -1 if they cannot be counted
+template<typename Func>
+static double BranchMissesPerCall(unsigned iterations, Func&& func)
+{
+#ifdef __linux__
+    perf_event_attr attr{};
+    attr.size           = sizeof(attr);
+    attr.type           = PERF_TYPE_HARDWARE;
+    attr.config         = PERF_COUNT_HW_BRANCH_MISSES;
+    attr.disabled       = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv     = 1;
+    int fd = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+    if(fd >= 0)
+    {
+        ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+        ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+        for(unsigned n=0; n<iterations; ++n) func();
+        ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+        long long count = 0;
+        bool ok = read(fd, &count, sizeof(count)) == sizeof(count);
+        close(fd);
+        if(ok) return double(count) / iterations;
+    }
+#endif
+    (void)iterations; (void)func;
+    return -1;
+}
+
+template<typename... Params>
+static void Compare(unsigned iterations, const char* format, Params... params)
+{
+    static char buffer[8192];
+    double tiny = TimePerCall(iterations, [&]{ __wrap_snprintf(buffer, sizeof(buffer), format, params...); });
+    double std  = TimePerCall(iterations, [&]{ std::snprintf(  buffer, sizeof(buffer), format, params...); });
+    std::printf("%-14s %10.1f ns %10.1f ns %6.2fx\n", format, tiny, std, std/tiny);
+}
+
+struct BenchConfig: myprintf::default_config
+{
+    static constexpr bool SUPPORT_HEXDUMP_FORMAT     = true;
+    static constexpr bool SUPPORT_CUSTOM_CONVERSIONS = true;
+    static constexpr bool SUPPORT_W_LENGTH           = true;
+    static constexpr bool SUPPORT_ESCAPE_FORMATS     = true;
+};
+
+static void BufferPut(char* target, const char* source, std::size_t count)
+{
+    std::memcpy(target, source, count);
+}
+
+static int BenchPrintf(char* buffer, const char* format, ...)
+{
+    std::va_list ap;
+    va_start(ap, format);
+    int length = myprintf::myvprintf<BenchConfig>(format, ap, buffer, BufferPut);
+    va_end(ap);
+    return length;
+}
+
+struct TableConfig: myprintf::default_config
+{
+    static constexpr bool TABLE_DRIVEN_PARSER = true;
+};
+
+// The default config has the table in the speed profile, so the state machine is named explicitly
+struct StateConfig: myprintf::default_config
+{
+    static constexpr bool TABLE_DRIVEN_PARSER = false;
+};
+
+template<typename Config>
+static int ParserPrintf(char* buffer, const char* format, ...)
+{
+    std::va_list ap;
+    va_start(ap, format);
+    int length = myprintf::myvprintf<Config>(format, ap, buffer, BufferPut);
+    va_end(ap);
+    return length;
+}
+
+static void CompareParser()
+{
+    static char buffer[256];
+    // Several specifier shapes in random order, so that the branches cannot be learned per call
+    static const char* const formats[8] = { "%d %s", "%5d %s", "%-08lx %s", "%.*s", "%+3d %s", "%02hhx %s", "%zu %s", "%-12d %s" };
+    unsigned order[4096];
+    for(unsigned n = 0; n < 4096; ++n) order[n] = (n * 2654435761u) >> 29;
+    unsigned n = 0;
+    auto run = [&](auto printf)
+    {
+        return [&, printf]{
+            const char* format = formats[order[n++ % 4096]];
+            printf(buffer, format, 123456L, "text"); };
+    };
+    auto state = run(ParserPrintf<StateConfig>);
+    auto table = run(ParserPrintf<TableConfig>);
+    double time_state = TimePerCall(2000000, state), time_table = TimePerCall(2000000, table);
+    double miss_state = BranchMissesPerCall(2000000, state), miss_table = BranchMissesPerCall(2000000, table);
+    std::printf("spec parser  %10.1f ns %10.1f ns %6.2fx (table vs. state machine", time_table, time_state, time_state/time_table);
+    if(miss_state >= 0) std::printf("; %.2f vs. %.2f branch misses per call", miss_table, miss_state);
+    std::printf(")\n");
+}
+
+static void CompareHexdump(unsigned length)
+{
+    static unsigned char data[65536];
+    static char buffer[65536 * 3];
+    for(unsigned n=0; n<length; ++n) data[n] = (unsigned char)(n * 2654435761u >> 13);
+
+    double dump = TimePerCall(2000, [&]{ BenchPrintf(buffer, "%*.1H", length, data); }) / length;
+    double loop = TimePerCall(2000, [&]{
+        char* p = buffer;
+        for(unsigned n=0; n<length; ++n) p += __wrap_sprintf(p, "%02x ", data[n]); }) / length;
+    std::printf("hexdump %-6u %10.2f ns %10.2f ns %6.2fx (per byte, vs. %%02x loop)\n", length, dump, loop, loop/dump);
+}
+
+#ifdef __SIZEOF_INT128__
+static void CompareInt128()
+{
+    static char buffer[256];
+    unsigned __int128 value = (unsigned __int128)12345678901234567 * 98765432109876543;
+    double tiny = TimePerCall(200000, [&]{ BenchPrintf(buffer, "%w128u", value); });
+    double loop = TimePerCall(200000, [&]{
+        char digits[40], *p = digits + sizeof(digits);
+        *--p = '\0';
+        for(unsigned __int128 v = value; v; v /= 10) *--p = char('0' + unsigned(v % 10));
+        __wrap_sprintf(buffer, "%s", p); });
+    std::printf("%%w128u       %10.1f ns %10.1f ns %6.2fx (vs. 128-bit %%10 loop)\n", tiny, loop, loop/tiny);
+}
+#endif
+
+static void CompareEscape(unsigned length)
+{
+    static char text[4096], escaped[8192], buffer[8192];
+    for(unsigned n = 0; n < length; ++n) text[n] = n % 97 == 96 ? '"' : char('a' + n % 26);
+    text[length] = '\0';
+
+    double inline_ = TimePerCall(20000, [&]{ BenchPrintf(buffer, "{\"msg\":\"%Js\"}", text); });
+    double copy    = TimePerCall(20000, [&]{
+        char* p = escaped;
+        for(const char* s = text; *s; ++s)
+        {
+            if(*s == '"' || *s == '\\') *p++ = '\\';
+            *p++ = *s;
+        }
+        *p = '\0';
+        __wrap_sprintf(buffer, "{\"msg\":\"%s\"}", escaped); });
+    std::printf("%%Js %-8u %10.1f ns %10.1f ns %6.2fx (vs. escaping into a buffer first)\n", length, inline_, copy, copy/inline_);
+}
+
+#ifdef SUPPORT_PRINT_ARRAY
+static std::size_t ArrayPut(char* target, const char* source, std::size_t count)
+{
+    std::memcpy(target, source, count);
+    return count;
+}
+
+static void CompareArray(const char* format, const char* separator)
+{
+    static int data[4096];
+    static char buffer[4096 * 32];
+    for(unsigned n=0; n<4096; ++n) data[n] = int(n * 2654435761u) >> (n % 24);
+
+    double array = TimePerCall(200, [&]{
+        tinyprintf_sink sink{buffer, ArrayPut, nullptr};
+        tinyprintf_print_array(&sink, format, separator, data, 4096, sizeof(int)); }) / 4096;
+    std::string element = std::string(format) + "%s";
+    double loop  = TimePerCall(200, [&]{
+        char* p = buffer;
+        for(unsigned n=0; n<4096; ++n) p += __wrap_sprintf(p, element.c_str(), data[n], separator); }) / 4096;
+    std::printf("array %-8s %10.1f ns %10.1f ns %6.2fx (per element, vs. sprintf loop)\n", format, array, loop, loop/array);
+}
+#endif
+
+#ifdef SUPPORT_BATCH_FORMAT
+static void BenchRecord(tinyprintf_record* record, std::size_t index, void*)
+{
+    tinyprintf_rprintf(record, "%8zu %08x %-12s %d\n", index, unsigned(index * 2654435761u), "row", int(index % 1000) - 500);
+}
+
+static void CompareBatch(std::size_t count)
+{
+    std::size_t length = 0;
+    double one = TimePerCall(1, [&]{ std::free(tinyprintf_format_batch(&length, count, BenchRecord, nullptr, 1)); });
+    double all = TimePerCall(1, [&]{ std::free(tinyprintf_format_batch(&length, count, BenchRecord, nullptr, 0)); });
+    std::printf("batch %zu rows: %10.1f ms (1 thread) %10.1f ms (%u threads) %6.2fx\n",
+        count, one / 1e6, all / 1e6, std::thread::hardware_concurrency(), one/all);
+}
+#endif
+
+#if defined(SUPPORT_MMAP_SINK) || defined(SUPPORT_URING_SINK) || defined(SUPPORT_SHM_SINK)
+static std::size_t WritePut(char* param, const char* source, std::size_t count)
+{
+    return write(int(reinterpret_cast<std::intptr_t>(param)), source, count);
+}
+#endif
+
+#ifdef SUPPORT_MMAP_SINK
+static void CompareMmap(unsigned lines)
+{
+    const char* path = "/tmp/tinyprintf-bench.log";
+    auto print = [&]{ for(unsigned n=0; n<lines; ++n) __wrap_printf("%u %08x %s\n", n, n * 2654435761u, "message"); };
+
+    tinyprintf_sink sink;
+    tinyprintf_mmap_open(&sink, path, 1 << 24, 0);
+    tinyprintf_set_output(&sink);
+    double mapped = TimePerCall(1, print) / lines;
+    tinyprintf_mmap_close(&sink);
+
+    int fd = open(path, O_WRONLY | O_TRUNC);
+    sink = tinyprintf_sink{reinterpret_cast<char*>(std::intptr_t(fd)), WritePut, nullptr};
+    tinyprintf_set_output(&sink);
+    double written = TimePerCall(1, print) / lines;
+    tinyprintf_set_output(nullptr);
+    close(fd);
+    unlink(path);
+    std::printf("mmap log     %10.1f ns %10.1f ns %6.2fx (per printf, vs. write())\n", mapped, written, written/mapped);
+}
+#endif
+
+#ifdef SUPPORT_LZ_SINK
+static std::size_t CountPut(char* param, const char*, std::size_t count)
+{
+    *reinterpret_cast<std::size_t*>(param) += count;
+    return count;
+}
+
+// The time of compression, and how much less is written
+static void CompareLz(unsigned lines)
+{
+    auto print = [&]{ for(unsigned n=0; n<lines; ++n) __wrap_printf("%u request %08x served in %u us from cache node %u\n", n, n * 2654435761u, n % 97, n % 4); };
+    std::size_t plain_bytes = 0, lz_bytes = 0;
+    tinyprintf_sink counter{reinterpret_cast<char*>(&lz_bytes), CountPut, nullptr}, sink;
+
+    tinyprintf_lz_open(&sink, &counter, 65536);
+    tinyprintf_set_output(&sink);
+    double compressed = TimePerCall(1, print) / lines;
+    tinyprintf_set_output(nullptr);
+    tinyprintf_lz_close(&sink);
+
+    counter.param = reinterpret_cast<char*>(&plain_bytes);
+    tinyprintf_buffer_open(&sink, &counter, 65536, TINYPRINTF_SPIN, -1);
+    tinyprintf_set_output(&sink);
+    double plain = TimePerCall(1, print) / lines;
+    tinyprintf_set_output(nullptr);
+    tinyprintf_buffer_close(&sink);
+    std::printf("lz sink      %10.1f ns %10.1f ns %6.2fx (per printf, vs. buffered; %.2f times less output)\n",
+        compressed, plain, plain/compressed, double(plain_bytes)/lz_bytes);
+}
+#endif
+
+#ifdef SUPPORT_SHM_SINK
+static void ShmDiscard(unsigned, const char*, std::size_t, void*) {}
+
+// A collector in another thread, reading from shared memory or from a pipe
+static void CompareShm(unsigned lines)
+{
+    auto print = [&]{ for(unsigned n=0; n<lines; ++n) __wrap_printf("%u %08x %s\n", n, n * 2654435761u, "message"); };
+    std::atomic<bool> finished{false};
+
+    tinyprintf_sink sink;
+    tinyprintf_shm_reader reader;
+    tinyprintf_shm_open(&sink, nullptr, 1 << 16, 4, TINYPRINTF_SPIN);
+    tinyprintf_shm_attach(&reader, tinyprintf_shm_fd(&sink));
+    std::thread consumer([&]{ while(tinyprintf_shm_read(&reader, 10, ShmDiscard, nullptr) || !finished) {} });
+    tinyprintf_set_output(&sink);
+    double shared = TimePerCall(1, print) / lines;
+    __wrap_fflush(stdout);
+    finished = true;
+    consumer.join();
+    tinyprintf_shm_detach(&reader);
+    tinyprintf_shm_close(&sink);
+
+    int fds[2];
+    if(pipe(fds) != 0) return;
+    consumer = std::thread([&]{ char buffer[65536]; while(read(fds[0], buffer, sizeof(buffer)) > 0) {} });
+    sink = tinyprintf_sink{reinterpret_cast<char*>(std::intptr_t(fds[1])), WritePut, nullptr};
+    tinyprintf_set_output(&sink);
+    double piped = TimePerCall(1, print) / lines;
+    tinyprintf_set_output(nullptr);
+    close(fds[1]);
+    consumer.join();
+    close(fds[0]);
+    std::printf("shm ring     %10.1f ns %10.1f ns %6.2fx (per printf, vs. a pipe)\n", shared, piped, piped/shared);
+}
+#endif
+
+#ifdef SUPPORT_URING_SINK
+// Prints the latency distribution of single __wrap_printf calls into sink
+static void PrintLatencies(const char* name, const tinyprintf_sink& sink, unsigned lines)
+{
+    std::unique_ptr<double[]> latency(new double[lines]);
+    tinyprintf_set_output(&sink);
+    for(unsigned n=0; n<lines; ++n)
+        latency[n] = TimePerCall(1, [&]{ __wrap_printf("%u %08x %s\n", n, n * 2654435761u, "message"); });
+    __wrap_fflush(stdout);
+    tinyprintf_set_output(nullptr);
+    std::sort(&latency[0], &latency[lines]);
+    std::printf("%-14s p50 %8.0f ns  p99 %8.0f ns  p99.9 %8.0f ns  max %10.0f ns\n", name,
+        latency[lines/2], latency[lines/100*99], latency[lines/1000*999], latency[lines-1]);
+}
+
+static void CompareUring(unsigned lines)
+{
+    const char* path = "/tmp/tinyprintf-bench.log";
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    PrintLatencies("write()", tinyprintf_sink{reinterpret_cast<char*>(std::intptr_t(fd)), WritePut, nullptr}, lines);
+    for(unsigned flags: {0u, unsigned(TINYPRINTF_URING_THREAD)})
+    {
+        tinyprintf_sink sink;
+        tinyprintf_uring_open(&sink, fd, 65536, 8, flags);
+        PrintLatencies(flags ? "helper thread" : "io_uring", sink, lines);
+        tinyprintf_uring_close(&sink);
+    }
+    close(fd);
+    unlink(path);
+}
+#endif
+
+#ifdef SUPPORT_TIMESTAMP
+static void CompareTimestamp()
+{
+    static char buffer[256];
+    if(!myprintf::set_custom_conversion('T', tinyprintf_timestamp, TINYPRINTF_ARG_POINTER)) return; // BenchConfig has custom conversions
+    double cached = TimePerCall(1000000, [&]{ BenchPrintf(buffer, "%T [%s] ", nullptr, "INFO"); });
+    double fields = TimePerCall(1000000, [&]{
+        struct timespec now;
+        clock_gettime(CLOCK_REALTIME, &now);
+        std::tm tm;
+        localtime_r(&now.tv_sec, &tm);
+        __wrap_sprintf(buffer, "%04d-%02d-%02d %02d:%02d:%02d.%06ld [%s] ", tm.tm_year + 1900, tm.tm_mon + 1,
+                       tm.tm_mday, tm.tm_hour, tm.tm_min, tm.tm_sec, now.tv_nsec / 1000, "INFO"); });
+    std::printf("log prefix   %10.1f ns %10.1f ns %6.2fx (%%T vs. localtime_r and seven conversions)\n", cached, fields, fields/cached);
+}
+#endif
+
+#ifdef SUPPORT_STATUS_LINE
+static std::size_t DiscardPut(char*, const char*, std::size_t length)
+{
+    return length;
+}
+
+static void CompareStatusLine()
+{
+    static char buffer[256];
+    const char* format = "%-12s %3u%% %8lu/%-8lu items %6.1f s %c";
+    const tinyprintf_sink out{nullptr, DiscardPut, nullptr};
+    tinyprintf_status* status = tinyprintf_status_create(format, 80, &out, &tinyprintf_ansi_hooks);
+    std::size_t sent = 0, full = 0;
+    unsigned n = 0;
+    double update = TimePerCall(1000000, [&]{
+        ++n;
+        sent += tinyprintf_status_update(status, "downloading", n / 10000, (unsigned long)n / 3, 1000000ul, n / 1000 * 0.1, "|/-\\"[n % 4]); });
+    n = 0;
+    double redraw = TimePerCall(1000000, [&]{
+        ++n;
+        full += __wrap_snprintf(buffer, sizeof(buffer), format, "downloading", n / 10000, (unsigned long)n / 3, 1000000ul, n / 1000 * 0.1, "|/-\\"[n % 4]); });
+    tinyprintf_status_destroy(status);
+    std::printf("status line  %10.1f ns %10.1f ns %6.2fx (%.1f vs. %.1f bytes per update)\n",
+                update, redraw, redraw/update, sent / 1e6, full / 1e6);
+}
+#endif
+
+#ifdef SUPPORT_RATE_LIMIT
+static void CompareRateLimit()
+{
+    tinyprintf_rate_report_interval(0);
+    unsigned n = 0;
+    double limited = TimePerCall(10000000, [&]{ ++n; tinyprintf_ratelimit_printf(10, 10, "%s: request %u from %08x failed\n", "server", n, n * 2654435761u); });
+    double sampled = TimePerCall(10000000, [&]{ ++n; tinyprintf_sample_printf(1000, "%s: request %u from %08x failed\n", "server", n, n * 2654435761u); });
+    double printed = TimePerCall(1000000,  [&]{ ++n; __wrap_printf("%s: request %u from %08x failed\n", "server", n, n * 2654435761u); });
+    tinyprintf_rate_report([](const char*, unsigned long long, void*){}, nullptr);
+    std::printf("rate limit   %10.1f ns %10.1f ns %6.2fx (per suppressed printf, vs. printing it)\n", limited, printed, printed/limited);
+    std::printf("sample 1/1000 %9.1f ns %10.1f ns %6.2fx\n", sampled, printed, printed/sampled);
+}
+#endif
+
+#ifdef SUPPORT_TEE_SINK
+static void CompareTee()
+{
+    static char buffers[3][1 << 16];
+    std::size_t used[3] = {0, 0, 0};
+    auto put = [](char* param, const char* text, std::size_t length) -> std::size_t
+    {
+        auto& target = *reinterpret_cast<std::pair<char*, std::size_t*>*>(param);
+        if(*target.second + length > sizeof(buffers[0])) *target.second = 0;
+        std::memcpy(target.first + *target.second, text, length);
+        *target.second += length;
+        return length;
+    };
+    std::pair<char*, std::size_t*> params[3] = {{buffers[0], &used[0]}, {buffers[1], &used[1]}, {buffers[2], &used[2]}};
+    tinyprintf_tee_target targets[3];
+    for(unsigned n = 0; n < 3; ++n)
+        targets[n] = tinyprintf_tee_target{{reinterpret_cast<char*>(&params[n]), put, nullptr}, 0, nullptr, 0};
+    tinyprintf_sink tee;
+    tinyprintf_tee_open(&tee, targets, 3);
+    unsigned n = 0;
+    double once  = TimePerCall(1000000, [&]{ ++n; tinyprintf_tee_printf(&tee, 0, "%s: request %u from %08x failed\n", "server", n, n * 2654435761u); });
+    double three = TimePerCall(1000000, [&]{ ++n;
+        for(auto& target: targets)
+        {
+            tinyprintf_set_output(&target.sink);
+            __wrap_printf("%s: request %u from %08x failed\n", "server", n, n * 2654435761u);
+        } });
+    tinyprintf_set_output(nullptr);
+    tinyprintf_tee_close(&tee);
+    std::printf("tee 3 sinks  %10.1f ns %10.1f ns %6.2fx (vs. printing three times)\n", once, three, three/once);
+}
+#endif
+
+#ifdef SUPPORT_ARENA
+static void CompareArena()
+{
+    // A request of 100 messages, released together
+    static char* texts[100];
+    tinyprintf_arena arena{};
+    double arena_time = TimePerCall(20000, [&]{
+        for(unsigned n = 0; n < 100; ++n)
+            tinyprintf_arena_printf(&arena, "%s: request %u from %08x failed", "server", n, n * 2654435761u);
+        tinyprintf_arena_reset(&arena); }) / 100;
+    tinyprintf_arena_free(&arena);
+    double malloc_time = TimePerCall(20000, [&]{
+        for(unsigned n = 0; n < 100; ++n)
+        {
+            int length = __wrap_snprintf(nullptr, 0, "%s: request %u from %08x failed", "server", n, n * 2654435761u);
+            texts[n] = static_cast<char*>(std::malloc(length + 1));
+            __wrap_sprintf(texts[n], "%s: request %u from %08x failed", "server", n, n * 2654435761u);
+        }
+        for(char* text: texts) std::free(text); }) / 100;
+    std::printf("arena        %10.1f ns %10.1f ns %6.2fx (per text, vs. asprintf and free)\n", arena_time, malloc_time, malloc_time/arena_time);
+}
+#endif
+
+int main()
+{
+    std::printf("%-14s %13s %13s %7s\n", "format", "tiny", "glibc", "speedup");
+
+    static char text[65536];
+    std::memset(text, 'x', sizeof(text)-1);
+    Compare(200000, "%.16s", (const char*)text);
+    Compare(2000,   "%s",    (const char*)text);
+
+    if(SUPPORT_FLOAT_FORMATS)
+    {
+        Compare(200000, "%f",     3.14159265358979);
+        Compare(200000, "%e",     3.14159265358979);
+        Compare(200000, "%g",     3.14159265358979);
+        Compare(200000, "%.17g",  0.1);
+        Compare(200000, "%.30e",  0.1);
+        Compare(20000,  "%f",     1e300);
+        Compare(20000,  "%.60f",  1e-50);
+        Compare(2000,   "%.1100f",5e-324);
+        if(SUPPORT_A_FORMAT)
+        {
+            Compare(200000, "%a",     3.14159265358979);
+            Compare(200000, "%.3a",   3.14159265358979);
+            Compare(200000, "%a",     5e-324);
+        }
+        if(SUPPORT_LONG_DOUBLE)
+        {
+            Compare(20000,  "%Lf",    0.1L);
+            Compare(2000,   "%Le",    1e4000L);
+            Compare(200,    "%Lf",    1e4000L);
+        }
+    }
+    CompareParser();
+    CompareHexdump(64);
+    CompareHexdump(1500);
+#ifdef __SIZEOF_INT128__
+    CompareInt128();
+#endif
+    CompareEscape(64);
+    CompareEscape(2000);
+#ifdef SUPPORT_TIMESTAMP
+    CompareTimestamp();
+#endif
+#ifdef SUPPORT_STATUS_LINE
+    CompareStatusLine();
+#endif
+#ifdef SUPPORT_RATE_LIMIT
+    CompareRateLimit();
+#endif
+#ifdef SUPPORT_TEE_SINK
+    CompareTee();
+#endif
+#ifdef SUPPORT_ARENA
+    CompareArena();
+#endif
+#ifdef SUPPORT_PRINT_ARRAY
+    CompareArray("%d",   ",");
+    CompareArray("%+6d", " ");
+    CompareArray("%08x", " ");
+#endif
+#ifdef SUPPORT_BATCH_FORMAT
+    CompareBatch(1000000);
+#endif
+#ifdef SUPPORT_MMAP_SINK
+    CompareMmap(1000000);
+#endif
+#ifdef SUPPORT_URING_SINK
+    CompareUring(1000000);
+#endif
+#ifdef SUPPORT_SHM_SINK
+    CompareShm(1000000);
+#endif
+#ifdef SUPPORT_LZ_SINK
+    CompareLz(1000000);
+#endif
+}
@@ -7,11 +7,99 @@
 #include <utility>
 #include <memory>
 #include <cmath>
+#include <limits>
 
 #define SUPPORT_SNPRINTF
 //#define SUPPORT_ASPRINTF
 //#define SUPPORT_FIPRINTF
 #define SUPPORT_FILE_FUNCTIONS
+//#define SUPPORT_BATCH_FORMAT
+//#define SUPPORT_PRINT_ARRAY
+//#define SUPPORT_MMAP_SINK
+//#define SUPPORT_URING_SINK
+//#define SUPPORT_BUFFERED_OUTPUT
+//#define SUPPORT_TIMESTAMP
+//#define SUPPORT_STATUS_LINE
+//#define SUPPORT_RATE_LIMIT
+//#define SUPPORT_TEE_SINK
+//#define SUPPORT_ARENA
+//#define SUPPORT_SHM_SINK
+//#define SUPPORT_LZ_SINK // Requires SUPPORT_BUFFERED_OUTPUT
+//#define SUPPORT_USDT_PROBES // Static tracepoints for perf, bpftrace and SystemTap (ELF only)
+//#define OPTIMIZE_FOR_SPEED // Optimize for speed rather than code size
+
+#ifdef SUPPORT_BATCH_FORMAT
+ #include <cstdlib>
+ #include <atomic>
+ #include <thread>
+#endif
+#if defined(SUPPORT_MMAP_SINK) || defined(SUPPORT_URING_SINK) || defined(SUPPORT_BUFFERED_OUTPUT) || defined(SUPPORT_TEE_SINK) \
+ || defined(SUPPORT_SHM_SINK)
+ #include <mutex>
+ #include <fcntl.h>
+ #include <sys/mman.h>
+ #include <unistd.h>
+ #define SUPPORT_OUTPUT_REDIRECT
+#endif
+#ifdef SUPPORT_MMAP_SINK
+ #include <sys/stat.h>
+#endif
+#ifdef SUPPORT_TIMESTAMP
+ #include <ctime>
+#endif
+#if defined(SUPPORT_STATUS_LINE) && !defined(SUPPORT_SNPRINTF)
+ #error SUPPORT_STATUS_LINE requires SUPPORT_SNPRINTF
+#endif
+#if defined(SUPPORT_LZ_SINK) && !defined(SUPPORT_BUFFERED_OUTPUT)
+ #error SUPPORT_LZ_SINK requires SUPPORT_BUFFERED_OUTPUT
+#endif
+#if __cplusplus >= 202002L
+ #include <array>
+#endif
+#ifdef SUPPORT_RATE_LIMIT
+ #include <atomic>
+ #include <ctime>
+#endif
+#ifdef SUPPORT_TEE_SINK
+ #include <chrono>
+ #include <thread>
+#endif
+#ifdef SUPPORT_LZ_SINK
+ #include <chrono>
+#endif
+#ifdef SUPPORT_ARENA
+ #include <cstdlib>
+#endif
+#ifdef SUPPORT_SHM_SINK
+ #include <atomic>
+ #include <cerrno>
+ #include <climits>
+ #include <ctime>
+ #include <thread>
+ #include <sys/stat.h>
+ #include <string>
+ #include <utility>
+ #include <vector>
+ #include <sys/syscall.h>
+ #include <linux/futex.h>
+#endif
+#ifdef SUPPORT_BUFFERED_OUTPUT
+ #include <cerrno>
+ #include <thread>
+ #include <poll.h>
+#endif
+#ifdef SUPPORT_URING_SINK
+ #include <cerrno>
+ #include <thread>
+ #include <condition_variable>
+ #include <poll.h>
+ #include <sys/syscall.h>
+ #include <sys/uio.h>
+ #include <linux/io_uring.h>
+#endif
+#if defined(__SSE2__)
+ #include <immintrin.h>
+#endif
 
 static constexpr bool SUPPORT_BINARY_FORMAT = false;// Whether to support %b format type
 static constexpr bool STRICT_COMPLIANCE     = true;
@@ -19,22 +107,42 @@ static constexpr bool SUPPORT_N_FORMAT      = true; // Whether to support %n for
 static constexpr bool SUPPORT_H_LENGTHS     = true; // Whether to support h and hh length modifiers
 static constexpr bool SUPPORT_T_LENGTH      = true; // Whether to support t length modifier
 static constexpr bool SUPPORT_J_LENGTH      = true; // Whether to support j length modifier
+static constexpr bool SUPPORT_W_LENGTH      = false; // Whether to support wN length modifiers, including w128 (__int128)
 static constexpr bool SUPPORT_FLOAT_FORMATS = false; // Floating pointing formats
 static constexpr bool SUPPORT_A_FORMAT      = false; // Floating point hex format
 static constexpr bool SUPPORT_LONG_DOUBLE   = false;
 static constexpr bool SUPPORT_POSITIONAL_PARAMETERS = false;
+static constexpr bool SUPPORT_V_FORMAT      = false; // Whether to support %v format type (string with explicit length)
+static constexpr bool SUPPORT_Q_FORMAT      = false; // Whether to support %Q format type (fixed-point decimal of a scaled integer)
+static constexpr bool SUPPORT_CUSTOM_CONVERSIONS = false; // Whether to support tinyprintf_register_conversion()
+static constexpr bool SUPPORT_HEXDUMP_FORMAT = false; // Whether to support %H format type (hexdump of a byte range)
+static constexpr bool SUPPORT_ESCAPE_FORMATS = false; // Whether to support %Js and %Cs (JSON and CSV escaped strings)
+#ifdef OPTIMIZE_FOR_SPEED
+static constexpr bool SPEED_PROFILE         = true;
+#else
+static constexpr bool SPEED_PROFILE         = false;
+#endif
+static constexpr bool TABLE_DRIVEN_PARSER   = false; // Decode common conversion specifiers with a character class table (not faster in bench.cc)
 
 #ifdef __GNUC__
  #define NOINLINE   __attribute__((noinline))
  #define USED_FUNC  __attribute__((used,noinline))
  #define VERYINLINE __attribute__((optimize("inline-functions"),always_inline))
  #pragma GCC push_options
+ #pragma GCC diagnostic push
+ #pragma GCC diagnostic ignored "-Wunused-label" // Some labels are only used by some configurations
+ #ifdef OPTIMIZE_FOR_SPEED
+ #define SIZE_NOINLINE inline VERYINLINE // Functions that are kept out of line only to save space
+ #pragma GCC optimize ("O2")
+ #else
+ #define SIZE_NOINLINE NOINLINE
  #pragma GCC optimize ("Os")
  /**/
  #pragma GCC optimize ("no-align-functions")
  #pragma GCC optimize ("no-align-jumps")
  #pragma GCC optimize ("no-align-loops")
  #pragma GCC optimize ("no-align-labels")
+ #endif
  #pragma GCC optimize ("reorder-blocks")
  #pragma GCC optimize ("reorder-blocks-and-partition")
  #pragma GCC optimize ("prefetch-loop-arrays")
@@ -49,6 +157,7 @@ static constexpr bool SUPPORT_POSITIONAL_PARAMETERS = false;
  #define unlikely(x) __builtin_expect(!!(x), 0)
 #else
  #define NOINLINE
+ #define SIZE_NOINLINE
  #define USED_FUNC
  #define likely(x)   (x)
  #define unlikely(x) (x)
@@ -63,12 +172,169 @@ static constexpr bool SUPPORT_POSITIONAL_PARAMETERS = false;
 #else
  #define if_constexpr if
 #endif
+
+/* SystemTap-style static tracepoints, provider "tinyprintf". Each probe is
+ * a nop, and an ELF note that tells the tracer where the nop is and where
+ * its arguments are (8@%rdi etc.). The arguments are passed as uintptr_t.
+ * This is the note format of <sys/sdt.h>, which is not needed.
+ */
+#if defined(SUPPORT_USDT_PROBES) && defined(__GNUC__) && defined(__ELF__)
+ #if UINTPTR_MAX > 0xFFFFFFFFu
+  #define TINYPRINTF_SDT_WORD   ".8byte"
+  #define TINYPRINTF_SDT_ARG(n) "8@%" #n
+ #else
+  #define TINYPRINTF_SDT_WORD   ".4byte"
+  #define TINYPRINTF_SDT_ARG(n) "4@%" #n
+ #endif
+ #define TINYPRINTF_SDT(name, args, ...) \
+    __asm__ __volatile__("990: nop\n" \
+        ".pushsection .note.stapsdt,\"?\",\"note\"\n" \
+        ".balign 4\n" \
+        ".4byte 992f-991f, 994f-993f, 3\n" \
+        "991: .asciz \"stapsdt\"\n" \
+        "992: .balign 4\n" \
+        "993: " TINYPRINTF_SDT_WORD " 990b\n" \
+        TINYPRINTF_SDT_WORD " _.stapsdt.base\n" \
+        TINYPRINTF_SDT_WORD " 0\n" /* No semaphore */ \
+        ".asciz \"tinyprintf\"\n" \
+        ".asciz \"" #name "\"\n" \
+        ".asciz \"" args "\"\n" \
+        "994: .balign 4\n" \
+        ".popsection\n" \
+        ".ifndef _.stapsdt.base\n" \
+        ".pushsection .stapsdt.base,\"aG\",\"progbits\",.stapsdt.base,comdat\n" \
+        ".weak _.stapsdt.base\n" \
+        ".hidden _.stapsdt.base\n" \
+        "_.stapsdt.base: .space 1\n" \
+        ".size _.stapsdt.base, 1\n" \
+        ".popsection\n" \
+        ".endif\n" :: __VA_ARGS__)
+ #define TINYPRINTF_PROBE1(name, a) \
+    TINYPRINTF_SDT(name, TINYPRINTF_SDT_ARG(0), "nr"(std::uintptr_t(a)))
+ #define TINYPRINTF_PROBE2(name, a, b) \
+    TINYPRINTF_SDT(name, TINYPRINTF_SDT_ARG(0) " " TINYPRINTF_SDT_ARG(1), "nr"(std::uintptr_t(a)), "nr"(std::uintptr_t(b)))
+#else
+ #define TINYPRINTF_PROBE1(name, a)    do {} while(0)
+ #define TINYPRINTF_PROBE2(name, a, b) do {} while(0)
+#endif
+
+extern "C" {
+    /* An output target. put(param, text, length) is called for each run
+     * of text, like the put function of myvprintf(). It returns the number
+     * of bytes accepted: length, or less if the target cannot take more
+     * right now (e.g. a non-blocking pipe is full), or TINYPRINTF_SINK_ERROR.
+     * flush(param), if not null, is called by fflush(); it returns 0 or EOF.
+     */
+    struct tinyprintf_sink
+    {
+        char* param;
+        std::size_t (*put)(char* param, const char* text, std::size_t length);
+        int         (*flush)(char* param);
+    };
+    static constexpr std::size_t TINYPRINTF_SINK_ERROR = ~std::size_t(0);
+
+    enum
+    {
+        // What a buffered output does when the buffer is full and the target does not accept more
+        TINYPRINTF_SPIN = 0,          // Retry until it does
+        TINYPRINTF_POLL = 1,          // Wait for the file descriptor to become writable, and retry
+        TINYPRINTF_DROP = 2,          // Discard the text that does not fit, and count it
+        TINYPRINTF_LINE_BUFFERED = 4  // Pass the text on after every newline, not only when the buffer is full
+    };
+
+#ifdef SUPPORT_TEE_SINK
+    // A target of tinyprintf_tee_open()
+    struct tinyprintf_tee_target
+    {
+        tinyprintf_sink sink;
+        int             min_severity; // Only text printed with at least this severity is passed on
+        const char*     prefix;       // If not null, only lines that begin with this are passed on
+        unsigned        max_wait_us;  // How long to retry when the sink does not accept all text
+    };
+#endif
+
+#ifdef SUPPORT_ARENA
+    /* Memory for formatted text, owned by the caller. Texts are placed one
+     * after another in chunks, and all of them are released at once.
+     * A zero-initialized arena is ready for use. See tinyprintf_arena_printf().
+     */
+    struct tinyprintf_arena
+    {
+        char*       base;       // The chunk being filled
+        std::size_t used, size; // How much of it is in use, and its size
+        std::size_t chunk_size; // Size of the chunks to allocate, 0 for 4096; longer texts get larger ones
+        void*       chunks;     // The allocated chunks, newest first
+    };
+    // A text in an arena
+    struct tinyprintf_view
+    {
+        const char* data;       // Nul-terminated; null if memory could not be allocated
+        std::size_t length;
+    };
+#endif
+
+#ifdef SUPPORT_SHM_SINK
+    // The consumer's view of a tinyprintf_shm_open() area. See tinyprintf_shm_attach().
+    struct tinyprintf_shm_reader
+    {
+        char*       base;
+        std::size_t size;
+    };
+#endif
+
+#ifdef SUPPORT_STATUS_LINE
+    /* Cursor control for tinyprintf_status_update(). Each function writes
+     * a control sequence (at most 16 bytes) into target and returns its length.
+     */
+    struct tinyprintf_status_hooks
+    {
+        unsigned (*move)(char* target, unsigned from_column, unsigned to_column);
+        unsigned (*clear)(char* target); // Erase from the cursor to the end of the line
+    };
+#endif
+
+    /* A custom conversion, as seen by its handler.
+     * See tinyprintf_register_conversion().
+     */
+    struct tinyprintf_conversion
+    {
+        char        letter;
+        unsigned    flags;     // TINYPRINTF_* flags
+        unsigned    width;     // 0 if not given
+        unsigned    precision; // ~0u if not given
+        unsigned    size;      // Size of the type named by the length modifier, sizeof(int) if none
+        union { const void* pointer; long long integer; } arg;
+
+        // Used by tinyprintf_emit() and tinyprintf_emit_raw()
+        void* engine;
+        void (*emit)(tinyprintf_conversion* conv, const char* text, std::size_t length, bool field);
+    };
+    typedef void (*tinyprintf_handler)(tinyprintf_conversion* conv);
+
+    enum
+    {
+        TINYPRINTF_LEFTALIGN = 0x01, // '-'
+        TINYPRINTF_ZEROPAD   = 0x02, // '0'
+        TINYPRINTF_PLUSSIGN  = 0x04, // '+'
+        TINYPRINTF_SPACE     = 0x08, // ' '
+        TINYPRINTF_ALT       = 0x10, // '#'
+
+        TINYPRINTF_ARG_POINTER = 0,  // The argument is a pointer
+        TINYPRINTF_ARG_INTEGER = 1   // The argument is an int, or long/long long with l/ll
+    };
+}
+
 namespace
 {
 namespace myprintf
 {
     typedef std::int_fast64_t  intfmt_t;
     typedef std::uint_fast64_t uintfmt_t;
+#ifdef __SIZEOF_INT128__
+    typedef unsigned __int128  uint128fmt_t; // %w128d etc.
+#else
+    typedef uintfmt_t          uint128fmt_t; // No 128-bit integers; w128 is not accepted
+#endif
 
     static_assert(sizeof(intfmt_t) >= sizeof(long long), "We are unable to print longlong types");
     static_assert(sizeof(intfmt_t) >= sizeof(std::intmax_t), "We are unable to print intmax_t types");
@@ -79,6 +345,43 @@ namespace myprintf
     static_assert(sizeof(std::intmax_t) == sizeof(long long)
                || sizeof(std::intmax_t) == sizeof(long), "We may have problems with %jd format");
 
+    /* Feature configuration of a formatting engine.
+     * myvprintf() and the code it uses take the configuration as a template
+     * parameter, so one program can contain several engines, for example
+     * an integer-only one for logging and a full one for diagnostics:
+     *
+     *     struct full_config: myprintf::default_config
+     *     {
+     *         static constexpr bool SUPPORT_FLOAT_FORMATS         = true;
+     *         static constexpr bool SUPPORT_POSITIONAL_PARAMETERS = true;
+     *     };
+     *     myprintf::myvprintf<full_config>(fmt, ap, param, put);
+     *
+     * Code for disabled features is not compiled into that engine.
+     * default_config is made from the constants at the top of this file,
+     * and it is used by the __wrap_* functions.
+     */
+    struct default_config
+    {
+        static constexpr bool SUPPORT_BINARY_FORMAT         = ::SUPPORT_BINARY_FORMAT;
+        static constexpr bool STRICT_COMPLIANCE             = ::STRICT_COMPLIANCE;
+        static constexpr bool SUPPORT_N_FORMAT              = ::SUPPORT_N_FORMAT;
+        static constexpr bool SUPPORT_H_LENGTHS             = ::SUPPORT_H_LENGTHS;
+        static constexpr bool SUPPORT_T_LENGTH              = ::SUPPORT_T_LENGTH;
+        static constexpr bool SUPPORT_J_LENGTH              = ::SUPPORT_J_LENGTH;
+        static constexpr bool SUPPORT_W_LENGTH              = ::SUPPORT_W_LENGTH;
+        static constexpr bool SUPPORT_FLOAT_FORMATS         = ::SUPPORT_FLOAT_FORMATS;
+        static constexpr bool SUPPORT_A_FORMAT              = ::SUPPORT_A_FORMAT;
+        static constexpr bool SUPPORT_LONG_DOUBLE           = ::SUPPORT_LONG_DOUBLE;
+        static constexpr bool SUPPORT_POSITIONAL_PARAMETERS = ::SUPPORT_POSITIONAL_PARAMETERS;
+        static constexpr bool SUPPORT_V_FORMAT              = ::SUPPORT_V_FORMAT;
+        static constexpr bool SUPPORT_Q_FORMAT              = ::SUPPORT_Q_FORMAT;
+        static constexpr bool SUPPORT_CUSTOM_CONVERSIONS    = ::SUPPORT_CUSTOM_CONVERSIONS;
+        static constexpr bool SUPPORT_HEXDUMP_FORMAT        = ::SUPPORT_HEXDUMP_FORMAT;
+        static constexpr bool SUPPORT_ESCAPE_FORMATS        = ::SUPPORT_ESCAPE_FORMATS;
+        static constexpr bool TABLE_DRIVEN_PARSER           = ::TABLE_DRIVEN_PARSER;
+    };
+
     // base is one of these:
     static constexpr unsigned char base_decimal   = 10;
     static constexpr unsigned char base_hex       = 16;
@@ -159,9 +462,19 @@ namespace myprintf
     static constexpr unsigned char prefix_inf   = 4*6;
     static constexpr unsigned char prefix_NAN   = 4*7;
     static constexpr unsigned char prefix_INF   = 4*8;
-    static constexpr unsigned char prefix_data_length = SUPPORT_FLOAT_FORMATS ? (8+8+5+6) : (2+2+5+6);
 
-    static constexpr unsigned NUMBUFFER_SIZE = SUPPORT_BINARY_FORMAT ? 64 : 23;
+    template<typename Config>
+    constexpr unsigned char prefix_data_length() { return Config::SUPPORT_FLOAT_FORMATS ? (8+8+5+6) : (2+2+5+6); }
+
+    template<typename Config>
+    constexpr unsigned numbuffer_size()
+    {
+        return (Config::SUPPORT_W_LENGTH && sizeof(uint128fmt_t) > sizeof(uintfmt_t))
+             ? (Config::SUPPORT_BINARY_FORMAT ? 128 : Config::SUPPORT_Q_FORMAT ? 80 : 64)
+             : (Config::SUPPORT_BINARY_FORMAT || Config::SUPPORT_Q_FORMAT) ? 64 : 23;
+    }
+    template<typename Config>
+    constexpr bool supports_int128() { return Config::SUPPORT_W_LENGTH && sizeof(uint128fmt_t) > sizeof(uintfmt_t); }
 
     #define BASE_MUL 0x8u
     #define FLAG_MUL 0x10000u
@@ -180,17 +493,85 @@ namespace myprintf
     #define is_type(type) \
         (get_type() == sizeof(type))
 
-    inline unsigned clamp(unsigned value, unsigned minvalue, unsigned maxvalue) VERYINLINE;
-    inline unsigned clamp(unsigned value, unsigned minvalue, unsigned maxvalue)
+    constexpr unsigned clamp(unsigned value, unsigned minvalue, unsigned maxvalue) VERYINLINE;
+    constexpr unsigned clamp(unsigned value, unsigned minvalue, unsigned maxvalue)
     {
         if(value < minvalue) value = minvalue;
         if(value > maxvalue) value = maxvalue;
         return value;
     }
-    inline unsigned estimate_uinteger_width(uintfmt_t uvalue, unsigned base) VERYINLINE /*NOINLINE*/;
-    inline unsigned estimate_uinteger_width(uintfmt_t uvalue, unsigned base)
+
+    /* Where prefix, padding and body go, for prn::format_body() and static_emit().
+     * The order has three 2-bit steps, first in the low bits: 1 = padding,
+     * 2 = prefix, 0 = body. There are three possible combinations:
+     *
+     *    Leftalign      prefix, source, spaces
+     *    Zeropad        prefix, zeros,  source
+     *    neither        spaces, prefix, source
+     *
+     * Note that in case of zeropad+leftalign,
+     * zeropad is disregarded according to the standard.
+     */
+    struct body_layout
+    {
+        unsigned prefixlength, sourcelength, padding_width;
+        unsigned order;
+        bool     zeropad;
+    };
+    template<typename Config>
+    constexpr body_layout layout_body(unsigned prefixlength, unsigned sourcelength,
+                                      unsigned min_width, unsigned max_width, unsigned fmt_flags) VERYINLINE;
+    template<typename Config>
+    constexpr body_layout layout_body(unsigned prefixlength, unsigned sourcelength,
+                                      unsigned min_width, unsigned max_width, unsigned fmt_flags)
+    {
+        unsigned prefix_index = (fmt_flags / PFX_MUL) % (FLAG_MUL/PFX_MUL);
+
+        // Don't zeropad when there are textual prefixes, or if leftaligning is set
+        if(Config::STRICT_COMPLIANCE && (unlikely(prefix_index >= prefix_nil) || (fmt_flags & fmt_leftalign)))
+        {
+            fmt_flags &= ~fmt_zeropad;
+        }
+
+        // Calculate length of prefix + source
+        unsigned combined_length = sourcelength + prefixlength;
+        // Clamp it into maximum permitted width
+        if(combined_length > max_width)
+        {
+            combined_length = max_width;
+            // Figure out how to divide this between prefix and source
+            // By default, shorten the source, but print full prefix
+            sourcelength = combined_length - prefixlength;
+            // Only room to print some of the prefix, and nothing of the source?
+            if(unlikely(combined_length < prefixlength))
+            {
+                prefixlength = combined_length;
+                sourcelength = 0;
+            }
+        }
+        // Calculate the padding width
+        unsigned padding_width = min_width > combined_length ? min_width - combined_length : 0;
+
+        // other(0):     1,2,0 = 1*1+2*4+0*16 = 0x09 (6 bits)
+        // leftalign(1): 2,0,1 = 2*1+0*4+1*16 = 0x12 (6 bits)
+        // zeropad(2):   2,1,0 = 2*1+1*4+0*16 = 0x06 (6 bits)
+        // (invalid)(3): 0,1,2
+        unsigned m = (1*1 + 2*4 + 0*16) * (1)
+                   + (2*1 + 0*4 + 1*16) * ((1u << (8*fmt_leftalign)) + (1u << (8*(fmt_leftalign+fmt_zeropad))))
+                   + (2*1 + 1*4 + 0*16) * ((1u << (8*fmt_zeropad)));
+        m >>= ((fmt_flags&(fmt_leftalign+fmt_zeropad))*8);
+        return { prefixlength, sourcelength, padding_width, m, (fmt_flags & fmt_zeropad) != 0 };
+    }
+    constexpr unsigned estimate_uinteger_width(uintfmt_t uvalue, unsigned base) VERYINLINE /*NOINLINE*/;
+    constexpr unsigned estimate_uinteger_width(uintfmt_t uvalue, unsigned base)
     {
         unsigned width = 0;
+        if_constexpr(SPEED_PROFILE)
+        {
+            // Division by a constant is a multiplication, and powers of two are shifts
+            if(base == 10) { for(; uvalue >= 100; uvalue /= 100) width += 2; return width + (uvalue >= 10) + (uvalue != 0); }
+            if(base == 16) { for(; uvalue != 0; uvalue >>= 4) ++width; return width; }
+        }
         while(uvalue != 0)
         {
             ++width;
@@ -199,8 +580,44 @@ namespace myprintf
         return width;
     }
 
-    void put_uinteger(char* target, uintfmt_t uvalue, unsigned width, unsigned  base, int alphaoffset) /*NOINLINE*/
+    // "00", "01", ... "99"
+    struct digit_pair_table { char pairs[200]; };
+    constexpr digit_pair_table make_digit_pairs()
+    {
+        digit_pair_table table{};
+        for(unsigned n = 0; n < 100; ++n) { table.pairs[n*2] = char('0' + n/10); table.pairs[n*2+1] = char('0' + n%10); }
+        return table;
+    }
+    static constexpr digit_pair_table digit_pairs = make_digit_pairs();
+
+    // Two digits per division
+    constexpr void put_decimal_pairs(char* target, uintfmt_t uvalue, unsigned width) VERYINLINE;
+    constexpr void put_decimal_pairs(char* target, uintfmt_t uvalue, unsigned width)
+    {
+        for(; width >= 2; uvalue /= 100)
+        {
+            width -= 2;
+            target[width]   = digit_pairs.pairs[(uvalue % 100) * 2];
+            target[width+1] = digit_pairs.pairs[(uvalue % 100) * 2 + 1];
+        }
+        if(width) target[0] = char('0' + uvalue % 10);
+    }
+
+    constexpr void put_uinteger(char* target, uintfmt_t uvalue, unsigned width, unsigned  base, int alphaoffset) /*NOINLINE*/
     {
+        if_constexpr(SPEED_PROFILE)
+        {
+            if(base == 10) { put_decimal_pairs(target, uvalue, width); return; }
+            if(base == 16)
+            {
+                for(unsigned w=width; w-- > 0; uvalue >>= 4)
+                {
+                    unsigned digitvalue = uvalue & 15;
+                    target[w] = digitvalue + (digitvalue < 10 ? '0' : alphaoffset);
+                }
+                return;
+            }
+        }
         for(unsigned w=width; w-- > 0; )
         {
             // FIXME: gcc-arm-embedded calls __aeabi_uldivmod twice here for no reason
@@ -208,29 +625,32 @@ namespace myprintf
             target[w] = digitvalue + (likely(digitvalue < 10) ? '0' : alphaoffset);
         }
     }
-    void put_uint_decimal(char* target, uintfmt_t uvalue, unsigned width) NOINLINE;
-    void put_uint_decimal(char* target, uintfmt_t uvalue, unsigned width)
+    SIZE_NOINLINE void put_uint_decimal(char* target, uintfmt_t uvalue, unsigned width);
+    SIZE_NOINLINE void put_uint_decimal(char* target, uintfmt_t uvalue, unsigned width)
     {
         put_uinteger(target, uvalue, width, 10, '0');
     }
 
-    inline std::pair<unsigned,unsigned> format_integer
+    template<typename Config>
+    constexpr std::pair<unsigned,unsigned> format_integer
         (char* numbuffer, intfmt_t value, unsigned fmt_flags, unsigned min_digits) VERYINLINE;
-    inline std::pair<unsigned,unsigned> format_integer
+    template<typename Config>
+    constexpr std::pair<unsigned,unsigned> format_integer
         (char* numbuffer, intfmt_t value, unsigned fmt_flags, unsigned min_digits)
     {
         // Maximum length is ceil(log8(2^64)) = ceil(64/3+1) = 23 characters (+1 for octal leading zero)
-        static_assert(NUMBUFFER_SIZE >= (SUPPORT_BINARY_FORMAT ? 64 : 23), "Too small numbuffer");
+        static_assert(numbuffer_size<Config>() >= (Config::SUPPORT_BINARY_FORMAT ? 64 : 23), "Too small numbuffer");
 
         if(fmt_flags & fmt_pointer)
         {
             if(unlikely(!value)) { return {0u, fmt_flags + PFX_MUL*prefix_nil}; } // (nil) and %p, no other prefix
-            if_constexpr(STRICT_COMPLIANCE) goto signed_flags;
         }
-        if(fmt_flags & fmt_signed)
+        // Strictly, %p gets the '+' and ' ' prefixes like the signed formats
+        if((fmt_flags & fmt_signed) || (Config::STRICT_COMPLIANCE && (fmt_flags & fmt_pointer)))
         {
-            if(value < 0)                   { value = -value; fmt_flags += PFX_MUL*prefix_minus; }
-            else signed_flags: fmt_flags += ((((prefix_plus*((1u << fmt_plussign)
+            // Negated as unsigned, because -value overflows for the smallest value
+            if(value < 0 && (fmt_flags & fmt_signed)) { value = intfmt_t(0 - uintfmt_t(value)); fmt_flags += PFX_MUL*prefix_minus; }
+            else fmt_flags += ((((prefix_plus*((1u << fmt_plussign)
                                                            + (1u << (fmt_plussign+fmt_space)))
                                              + prefix_space*((1u << fmt_space)))*PFX_MUL) >> (fmt_flags & (fmt_plussign|fmt_space)))
                                                & (PFX_MUL*(prefix_plus|prefix_space)));
@@ -244,7 +664,7 @@ namespace myprintf
 
         unsigned b = get_base();
         unsigned width = estimate_uinteger_width(value, b);
-        if(STRICT_COMPLIANCE && unlikely(fmt_flags & (fmt_alt | fmt_pointer)))
+        if(Config::STRICT_COMPLIANCE && unlikely(fmt_flags & (fmt_alt | fmt_pointer)))
         {
             // Bases: 2   /2 = 1  -1 = 0
             //        8   /2 = 4  -1 = 3
@@ -268,7 +688,7 @@ namespace myprintf
                 case 10/2-4: break;
                 case 8/2-4: ++width; break;
                 case 16/2-4: if(width>0) fmt_flags += (PFX_MUL*prefix_0x + (fmt_flags&fmt_ucbase)*(PFX_MUL*prefix_0X-PFX_MUL*prefix_0x)/fmt_ucbase); break;
-                default: if_constexpr(!SUPPORT_BINARY_FORMAT) __builtin_unreachable(); break;
+                default: if_constexpr(!Config::SUPPORT_BINARY_FORMAT) __builtin_unreachable(); break;
             }*/
             if(!(b&7)) { // bases 8 or 16 only
                 if(b&8) // base 8
@@ -279,141 +699,392 @@ namespace myprintf
         }
 
         // Range check
-        width = clamp(width, min_digits, NUMBUFFER_SIZE);
+        width = clamp(width, min_digits, numbuffer_size<Config>());
         //put_uinteger(numbuffer, value, width, b, ((fmt_flags & fmt_ucbase) ? 'A' : 'a')-10);
         put_uinteger(numbuffer, value, width, b, ('a'-10  -  (('a'-'A')*((fmt_flags & fmt_ucbase)/fmt_ucbase))));
         return {width,fmt_flags};
     }
 
-    template<typename FloatType>
-    inline std::pair<unsigned,unsigned> format_float
-        (char* numbuffer, FloatType value, unsigned fmt_flags, unsigned precision)
+    /* Integers of 128 bits, for the w128 length modifier. The values that
+     * fit in 64 bits are left to format_integer(). Decimal numbers are
+     * divided by 10^19 into 64-bit chunks of 19 digits, which are converted
+     * two digits at a time; the other bases take bits from the bottom.
+     */
+    template<typename Config>
+    std::pair<unsigned,unsigned> format_integer128
+        (char* numbuffer, uint128fmt_t value, unsigned fmt_flags, unsigned min_digits)
     {
-        unsigned char prefix_index = 0;
-        if(value < 0)     { value = -value; prefix_index = prefix_minus; }
-        else if(fmt_flags & fmt_plussign) { prefix_index = prefix_plus;  }
-        else if(fmt_flags & fmt_space)    { prefix_index = prefix_space; }
+        static_assert(!supports_int128<Config>() || numbuffer_size<Config>() >= (Config::SUPPORT_BINARY_FORMAT ? 128 : 44), "Too small numbuffer");
 
-        if(!std::isfinite(value))
+        // The sign is decided here, so that format_integer() sees an unsigned number
+        if(fmt_flags & fmt_signed)
         {
-            return {0u, fmt_flags + PFX_MUL*(prefix_index + (
-                                std::isinf(value) ? ((fmt_flags & fmt_ucbase) ? prefix_INF : prefix_inf)
-                                                  : ((fmt_flags & fmt_ucbase) ? prefix_NAN : prefix_nan))) };
+            fmt_flags &= ~fmt_signed;
+            if(value >> (8*sizeof(value)-1))       { value = 0 - value; fmt_flags += PFX_MUL*prefix_minus; }
+            else if(fmt_flags & fmt_plussign)      { fmt_flags += PFX_MUL*prefix_plus; }
+            else if(fmt_flags & fmt_space)         { fmt_flags += PFX_MUL*prefix_space; }
         }
-
-        int e_exponent=0;
-
-        if(SUPPORT_A_FORMAT && get_base() == base_hex)
+        if(!(value >> 32 >> 32))
         {
-            value = std::frexp(value, &e_exponent);
-            while(value > 0 && value*2 < 0x10) { value *= 2; --e_exponent; }
+            return format_integer<Config>(numbuffer, intfmt_t(uintfmt_t(value)), fmt_flags, min_digits);
         }
-        else if(value != FloatType(0))
+
+        unsigned b = get_base(), width;
+        int alphaoffset = 'a'-10  -  (('a'-'A')*((fmt_flags & fmt_ucbase)/fmt_ucbase));
+        if(b == 10)
         {
-            e_exponent = std::floor(std::log10(value));
+            constexpr uintfmt_t chunk = 10000000000000000000u; // 10^19
+            uintfmt_t low = value % chunk;
+            uint128fmt_t high = value / chunk;
+            uintfmt_t middle = high % chunk, top = uintfmt_t(high / chunk);
+            width = clamp(top ? 38 + 1 : 19 + estimate_uinteger_width(middle, 10), min_digits, numbuffer_size<Config>());
+            put_decimal_pairs(numbuffer + width - 19, low, 19);
+            if(width - 19 <= 19)
+                put_decimal_pairs(numbuffer, middle, width - 19);
+            else
+            {
+                put_decimal_pairs(numbuffer + width - 38, middle, 19);
+                put_decimal_pairs(numbuffer, top, width - 38);
+            }
+            return {width, fmt_flags};
         }
 
-        if(precision == ~0u) precision = 6;
-        if(fmt_flags & fmt_autofloat)
+        unsigned shift = b == 16 ? 4 : b == 8 ? 3 : 1;
+        width = 0;
+        for(uint128fmt_t v = value; v != 0; v >>= shift) ++width;
+        if(Config::STRICT_COMPLIANCE && (fmt_flags & fmt_alt))
         {
-            // Mode: Let X = E-style exponent, P = chosen precision.
-            //       If P > X >= -4, choose 'f' and P = P-1-X.
-            //       Else,           choose 'e' and P = P-1.
-            if(!precision) precision = 1;
-            if(int(precision) > e_exponent && e_exponent >= -4) { precision -= e_exponent+1; }
-            else                                                { precision -= 1; fmt_flags |= fmt_exponent; }
+            if(b == 8)  ++width;
+            if(b == 16) fmt_flags += (PFX_MUL*prefix_0x + (fmt_flags&fmt_ucbase)*(PFX_MUL*prefix_0X-PFX_MUL*prefix_0x)/fmt_ucbase);
         }
+        width = clamp(width, min_digits, numbuffer_size<Config>());
+        for(unsigned w = width; w-- > 0; value >>= shift)
+        {
+            unsigned digitvalue = unsigned(value) & (b-1);
+            numbuffer[w] = digitvalue + (digitvalue < 10 ? '0' : alphaoffset);
+        }
+        return {width, fmt_flags};
+    }
+
+    /* Fixed-point decimal: value * 10^-scale, with precision decimals.
+     * value is the bit pattern of a signed integer of UInt's size. Extra
+     * digits of the value are rounded half away from zero, missing ones
+     * are zeros. The sign is kept on values that round to zero, as %f
+     * does. At most 19 decimals are printed, and scales below -19 are
+     * treated as -19; the longest text is 20+19 digits, '.' and 19
+     * decimals, or 39+19 digits with w128.
+     */
+    template<typename Config, typename UInt>
+    std::pair<unsigned,unsigned> format_fixed
+        (char* numbuffer, UInt value, int scale, unsigned precision, unsigned fmt_flags)
+    {
+        constexpr unsigned digits = sizeof(UInt) > sizeof(uintfmt_t) ? 39 : 20; // Of the largest magnitude
+        static_assert(!Config::SUPPORT_Q_FORMAT || (digits > 20 && !supports_int128<Config>())
+                   || numbuffer_size<Config>() >= digits+19+1+19, "Too small numbuffer");
 
-        int head_width = 1;
+        if(precision > 19) precision = 19;
+        if(scale < -19)    scale = -19;
 
-        /* Round the value into the specified precision */
-        uintfmt_t uvalue = 0;
-        if(value != FloatType(0))
+        // The sign is decided here, so that format_integer() sees an unsigned number
+        bool negative = value >> (8*sizeof(value)-1);
+        if(negative)                       fmt_flags += PFX_MUL*prefix_minus;
+        else if(fmt_flags & fmt_plussign)  fmt_flags += PFX_MUL*prefix_plus;
+        else if(fmt_flags & fmt_space)     fmt_flags += PFX_MUL*prefix_space;
+        UInt magnitude = negative ? 0 - value : value;
+
+        unsigned zeros = 0;
+        if(scale > int(precision))
         {
-            if(!(fmt_flags & fmt_exponent))
+            unsigned drop = scale - precision;
+            if(drop >= digits) { magnitude = 0; } // 10^digits/2 is more than any magnitude
+            else
             {
-                head_width = 1 + e_exponent;
+                UInt divisor = 1;
+                while(drop--) divisor *= 10;
+                UInt remainder = magnitude % divisor;
+                magnitude = magnitude / divisor + (remainder >= divisor - remainder);
             }
-            unsigned total_precision = precision;
-            /*if(head_width > 0)*/ total_precision += head_width;
+        }
+        else if(magnitude)
+        {
+            zeros = precision - scale;
+        }
 
-            // Create a scaling factor where all desired decimals are in the integer portion
-            FloatType factor = std::pow(FloatType(10), FloatType(total_precision - std::ceil(std::log10(value))));
-            //auto ovalue = value;
-            auto rvalue = std::round(value * factor);
-            uvalue = rvalue;
-            // Scale it back
-            value = rvalue / factor;
-            // Recalculate exponent from rounded value
-            e_exponent = std::floor(std::log10(value));
-            if(!(fmt_flags & fmt_exponent))
-            {
-                head_width = 1 + e_exponent;
-            }
+        // The digits before the point, and at least one
+        unsigned min_digits = precision + 1 > zeros ? precision + 1 - zeros : 1;
+        unsigned length;
+        if(sizeof(UInt) > sizeof(uintfmt_t))
+            std::tie(length, fmt_flags) = format_integer128<Config>(numbuffer, magnitude, fmt_flags & ~fmt_signed, min_digits);
+        else
+            std::tie(length, fmt_flags) = format_integer<Config>(numbuffer, intfmt_t(magnitude), fmt_flags & ~fmt_signed, min_digits);
+        std::memset(numbuffer + length, '0', zeros);
+        length += zeros;
+
+        if(precision || (fmt_flags & fmt_alt))
+        {
+            std::memmove(numbuffer + length - precision + 1, numbuffer + length - precision, precision);
+            numbuffer[length - precision] = '.';
+            ++length;
+        }
+        return {length, fmt_flags};
+    }
 
-            /*std::printf("Value %.12g rounded to %u decimals: %.12g, %lu  head_width=%d\n",
-                ovalue, total_precision, value, uvalue, head_width);*/
+    /* Raw fields of a floating point value, read from its bit pattern:
+     *     value = (head + frac / 16^frac_digits) * 2^exponent
+     * head is the hex digit that glibc prints before the point in %a.
+     */
+    struct float_fields
+    {
+        bool               negative;
+        bool               infinite, nan;
+        unsigned           head;
+        std::uint_fast64_t frac;
+        int                exponent;
+    };
+    template<typename FloatType, int Digits = std::numeric_limits<FloatType>::digits>
+    struct float_bits;
+    template<typename FloatType>
+    struct float_bits<FloatType, 53> // IEEE 754 binary64
+    {
+        static constexpr unsigned frac_digits = 13;
+        static float_fields get(FloatType value)
+        {
+            static_assert(sizeof(FloatType) == sizeof(std::uint64_t), "Unknown double format");
+            std::uint64_t bits;
+            std::memcpy(&bits, &value, sizeof(bits));
+            unsigned           exp  = (bits >> 52) & 0x7FF;
+            std::uint_fast64_t frac = bits & ((std::uint64_t(1) << 52) - 1);
+            return { bool(bits >> 63), exp == 0x7FF && !frac, exp == 0x7FF && frac,
+                     exp != 0, frac, exp ? int(exp) - 1023 : (frac ? -1022 : 0) };
         }
+    };
+    template<typename FloatType>
+    struct float_bits<FloatType, 64> // x87 extended precision, explicit integer bit
+    {
+        static constexpr unsigned frac_digits = 15;
+        static float_fields get(FloatType value)
+        {
+            std::uint64_t  mant;
+            std::uint16_t  sexp;
+            std::memcpy(&mant, &value, sizeof(mant));
+            std::memcpy(&sexp, reinterpret_cast<const char*>(&value) + sizeof(mant), sizeof(sexp));
+            unsigned           exp  = sexp & 0x7FFF;
+            std::uint_fast64_t frac = mant & ((std::uint64_t(1) << 60) - 1);
+            bool               fin  = exp != 0x7FFF;
+            return { bool(sexp >> 15), !fin && !(mant << 1), !fin && (mant << 1),
+                     unsigned(mant >> 60), frac, mant ? (exp ? int(exp) : 1) - 16383 - 3 : 0 };
+        }
+    };
+    template<typename FloatType, int Digits>
+    struct float_bits
+    {
+        // Unknown format (e.g. 128-bit long double)
+        static_assert(sizeof(FloatType) == 0, "%La is not supported for this long double format");
+    };
 
-        unsigned exponent_width = 0;
-        unsigned point_width    = (precision > 0 || (fmt_flags & fmt_alt)) ? 1 : 0;
-        unsigned decimals_width = clamp(precision, 0, sizeof(numbuffer)-exponent_width-point_width-head_width);
+    /* Exact decimal expansion of a binary floating point value.
+     *
+     * The value is converted into base-10^9 limbs using only integer arithmetic:
+     * mantissa * 2^e2 is produced by repeatedly multiplying the limbs by 2^29
+     * (for e2 > 0) or dividing them by 2^9 (for e2 < 0). The latter is exact,
+     * because every division appends at most one new limb to the fraction.
+     * Storage is a fixed-size array sized for the worst case of FloatType,
+     * so no heap is used. For double, it is about 500 bytes.
+     */
+    template<typename FloatType>
+    struct float_decimal
+    {
+        typedef std::uint_least32_t limb_t;
+        typedef std::numeric_limits<FloatType> limits;
+        static constexpr limb_t limb_base = 1000000000u;
+
+        static_assert(limits::radix == 2 && limits::digits <= 64,
+                      "Float mantissa does not fit in 64 bits");
 
-        // Count the number of digits
-        uintfmt_t digits = estimate_uinteger_width(uvalue, 10);
-        uintfmt_t scale    = std::pow(FloatType(10), FloatType(int(digits - head_width)));
-        if(!scale) scale=1;
-        uintfmt_t head     = uvalue / scale;
-        uintfmt_t fraction = uvalue % scale;
-        //uintfmt_t scale2   = uintfmt_t(std::pow(FloatType(10), FloatType(-head_width)));
-        //if(head_width < 0 && scale2 != 0) fraction /= scale2;
+        // Enough limbs for the integer part of the largest value, or for all
+        // fraction digits of the smallest denormal, plus room for a rounding carry.
+        static constexpr int frac_limbs = (limits::digits - limits::min_exponent + 8) / 9;
+        static constexpr int int_limbs  = (limits::max_exponent * 30103L / 100000 + 1 + 8) / 9;
+        static constexpr int num_limbs  = 5 + (frac_limbs > int_limbs ? frac_limbs : int_limbs);
 
-        /*std::printf("- digits in %lu=%lu, scale=%lu, head=%lu, fraction=%lu\n",
-            uvalue,digits, scale, head,fraction);*/
+        limb_t big[num_limbs];
+        int    a, r, z;   // Limbs [a,z) are stored, r is the first fraction limb.
+                          // Limbs outside [a,z) are zero. a > r is possible for small values.
+        bool   sticky;    // Nonzero digits were discarded beyond z
 
-        if(head_width < 1) head_width = 1;
+        static limb_t pow10(unsigned n) VERYINLINE
+        {
+            static const limb_t table[10] { 1u,10u,100u,1000u,10000u,100000u,1000000u,
+                                            10000000u,100000000u,1000000000u };
+            return table[n];
+        }
+        static int floor_div9(int n) VERYINLINE { return (n >= 0) ? n/9 : -((8-n)/9); }
 
-        if(fmt_flags & fmt_exponent)
+        limb_t at(int index) const { return (index >= a && index < z) ? big[index] : 0; }
+
+        /* Load value (finite and nonnegative).
+         * Digits that are not needed for the requested precision may be dropped
+         * while converting; sticky remembers whether they were nonzero.
+         */
+        void load(FloatType value, bool fixed, unsigned precision)
         {
-        /*
-            auto vv = value * std::pow(FloatType(10), FloatType(-e_exponent));
+            int e2;
+            value = std::frexp(value, &e2);
+            std::uint_fast64_t m = std::ldexp(value, limits::digits);
+            e2 = m ? e2 - limits::digits : 0;
+            while(m && !(m & 1) && e2 < 0) { m >>= 1; ++e2; }
+
+            a = (e2 < 0) ? 1 : num_limbs-3;
+            r = z = a+3;
+            sticky = false;
+            big[a+0] = m / (std::uint_fast64_t(limb_base)*limb_base);
+            big[a+1] = (m / limb_base) % limb_base;
+            big[a+2] = m % limb_base;
+            while(a < z && !big[a])   { ++a; }
+            while(z > a && !big[z-1]) { --z; }
+
+            // Number of fraction limbs (fixed) or significant limbs (exponent)
+            // that must be kept exact in order to round correctly.
+            const int need = int(std::min(precision, 0x7FFFFFF0u) / 9) + 3;
+            while(e2 > 0)
+            {
+                unsigned sh = std::min(29, e2);
+                limb_t carry = 0;
+                for(int d = z; d-- > a; )
+                {
+                    std::uint_fast64_t x = (std::uint_fast64_t(big[d]) << sh) + carry;
+                    big[d] = x % limb_base;
+                    carry  = x / limb_base;
+                }
+                if(carry) big[--a] = carry;
+                while(z > a && !big[z-1]) { --z; }
+                e2 -= sh;
+            }
+            while(e2 < 0)
+            {
+                unsigned sh = std::min(9, -e2);
+                limb_t carry = 0;
+                for(int d = a; d < z; ++d)
+                {
+                    limb_t rem = big[d] & ((1u << sh)-1);
+                    big[d] = (big[d] >> sh) + carry;
+                    carry  = (limb_base >> sh) * rem;
+                }
+                if(a < z && !big[a]) ++a;
+                if(carry) big[z++] = carry;
+                // Avoid computing digits far beyond the requested precision
+                int b = fixed ? r : a;
+                if(z - b > need)
+                {
+                    int end = std::max(b + need, a);
+                    for(int d = end; d < z; ++d) sticky |= big[d] != 0;
+                    z = end;
+                }
+                e2 += sh;
+            }
+        }
 
-            fraction = std::modf(vv, &head);
-            //if(value != FloatType(0) && head == FloatType(0)) { vv *= 10; fraction = std::modf(vv, &head); --e_exponent; }
+        // Decimal exponent of the leading digit (0 for value 0)
+        int exponent10() const
+        {
+            if(a >= z) return 0;
+            int e = 9*(r-a) - 9;
+            for(limb_t p = 10; p <= big[a]; p *= 10) ++e;
+            return e;
+        }
 
-            auto uf = fraction;
-            fraction = std::round(fraction * std::pow(FloatType(10), FloatType(int(precision))));
-            std::printf("%.20g -> %.20g split into head=%.20g, fraction=%.20g -> %.20g using exponents %d\n",
-                value,vv,head,uf,fraction,
-                e_exponent);
-        */
-            exponent_width =
-                clamp(estimate_uinteger_width(e_exponent<0 ? -e_exponent : e_exponent, 10),
-                      2,
-                      sizeof(numbuffer)-3-head_width) + 2;
+        // Decimal exponent of the lowest nonzero digit (0 for value 0)
+        int lowest_place() const
+        {
+            int t = z;
+            while(t > a && !big[t-1]) --t;
+            if(t == a) return 0;
+            int e = 9*(r-t);
+            for(limb_t v = big[t-1]; !(v % 10); v /= 10) ++e;
+            return e;
         }
-        else
+
+        // Round to nearest (ties to even) so that k digits remain after the decimal point.
+        // k may be negative.
+        void round_to(int k)
         {
+            int      ld       = r + floor_div9(k);          // Limb holding the first dropped digit
+            unsigned kept     = unsigned(k - 9*floor_div9(k)); // Number of kept digits in that limb
+            limb_t   dropunit = pow10(9 - kept);
+            limb_t   limb     = at(ld);
+            limb_t   rem      = limb % dropunit;
+
+            bool more = sticky;
+            for(int d = std::max(ld+1, a); !more && d < z; ++d) more = big[d] != 0;
+
+            bool odd = kept ? (limb / dropunit) % 2 : at(ld-1) % 2;
+            bool up  = rem > dropunit/2 || (rem == dropunit/2 && (more || odd));
+
+            // Discard the dropped digits
+            sticky = false;
+            if(ld < a)      { z = a; }
+            else if(ld < z) { big[ld] = limb - rem; z = ld+1; }
+            if(!up) return;
+
+            // Add one unit of the last kept digit
+            if(a >= z)      { a = z = ld; }
+            while(ld < a)   { big[--a] = 0; }
+            while(ld >= z)  { big[z++] = 0; }
+            big[ld] += dropunit;
+            for(int d = ld; big[d] >= limb_base; )
+            {
+                big[d] -= limb_base;
+                if(--d < a) { big[a = d] = 0; }
+                ++big[d];
+            }
         }
+    };
+
+    // Escaping modes of %s: %Js for the contents of a JSON string, %Cs for a CSV field
+    static constexpr unsigned char escape_json = 1, escape_csv = 2;
+
+    inline bool needs_escape(unsigned char c, unsigned char mode)
+    {
+        return c == '"' || (mode == escape_json ? (c == '\\' || c < 0x20) : (c == ',' || c == '\r' || c == '\n'));
+    }
 
-        put_uint_decimal(numbuffer + 0, head, head_width);
-        unsigned tgt = head_width;
-        if(point_width)
+    // Returns the number of characters at the beginning of text that need no escaping
+    inline std::size_t unescaped_run(const char* text, std::size_t length, unsigned char mode)
+    {
+        std::size_t pos = 0;
+    #ifdef __AVX2__
         {
-            numbuffer[tgt] = '.'; tgt += 1;
-            put_uint_decimal(numbuffer + tgt, fraction, decimals_width);
-            tgt += decimals_width;
+            const __m256i quote = _mm256_set1_epi8('"'), other = _mm256_set1_epi8(mode == escape_json ? '\\' : ',');
+            const __m256i cr = _mm256_set1_epi8('\r'), lf = _mm256_set1_epi8('\n'), control = _mm256_set1_epi8(0x1F);
+            for(; length - pos >= 32; pos += 32)
+            {
+                __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(text + pos));
+                __m256i m = _mm256_or_si256(_mm256_cmpeq_epi8(x, quote), _mm256_cmpeq_epi8(x, other));
+                m = _mm256_or_si256(m, mode == escape_json ? _mm256_cmpeq_epi8(_mm256_max_epu8(x, control), control)
+                                                           : _mm256_or_si256(_mm256_cmpeq_epi8(x, cr), _mm256_cmpeq_epi8(x, lf)));
+                if(unsigned bits = _mm256_movemask_epi8(m)) return pos + __builtin_ctz(bits);
+            }
         }
-        if(exponent_width)
+    #endif
+    #ifdef __SSE2__
         {
-            numbuffer[tgt++] = ((fmt_flags & fmt_ucbase) ? 'E' : 'e');
-            numbuffer[tgt++] = ((e_exponent < 0)         ? '-' : '+');
-            put_uint_decimal(numbuffer + tgt, e_exponent<0 ? -e_exponent : e_exponent, exponent_width-2);
-            tgt += exponent_width-2;
+            const __m128i quote = _mm_set1_epi8('"'), other = _mm_set1_epi8(mode == escape_json ? '\\' : ',');
+            const __m128i cr = _mm_set1_epi8('\r'), lf = _mm_set1_epi8('\n'), control = _mm_set1_epi8(0x1F);
+            for(; length - pos >= 16; pos += 16)
+            {
+                __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(text + pos));
+                __m128i m = _mm_or_si128(_mm_cmpeq_epi8(x, quote), _mm_cmpeq_epi8(x, other));
+                m = _mm_or_si128(m, mode == escape_json ? _mm_cmpeq_epi8(_mm_max_epu8(x, control), control)
+                                                        : _mm_or_si128(_mm_cmpeq_epi8(x, cr), _mm_cmpeq_epi8(x, lf)));
+                if(unsigned bits = _mm_movemask_epi8(m)) return pos + __builtin_ctz(bits);
+            }
         }
-        return {tgt, fmt_flags + PFX_MUL*prefix_index};
+    #endif
+        while(pos < length && !needs_escape(text[pos], mode)) ++pos;
+        return pos;
     }
 
+    template<typename Config>
     struct prn
     {
         char* param;
@@ -422,13 +1093,14 @@ namespace myprintf
         const char* putbegin = nullptr;
         const char* putend   = nullptr;
 
-        char prefixbuffer[SUPPORT_FLOAT_FORMATS ? 4 : 3]; // Longest: +inf or +0x
+        char prefixbuffer[Config::SUPPORT_FLOAT_FORMATS ? 4 : 3]; // Longest: +inf or +0x
 
-        void flush() NOINLINE
+        SIZE_NOINLINE void flush()
         {
             if(likely(putend != putbegin))
             {
                 unsigned n = putend-putbegin;
+                TINYPRINTF_PROBE1(flush, n);
                 //std::printf("Flushes %d from <%.*s> to %p\n", n,n,putbegin, param);
                 const char* start = putbegin;
                 char*      pparam = param;
@@ -439,7 +1111,7 @@ namespace myprintf
                 //std::printf("As a result, %p has <%.*s>\n", param, n, param);
             }
         }
-        void append(const char* source, unsigned length) NOINLINE
+        SIZE_NOINLINE void append(const char* source, unsigned length)
         {
             //std::printf("Append %d from <%.*s>\n", length, length, source);
             //if(likely(length != 0))
@@ -462,137 +1134,547 @@ namespace myprintf
             }
         }
 
-        inline void format_string(const char* source, unsigned sourcelength,
-                                  unsigned min_width, unsigned max_width, unsigned fmt_flags) VERYINLINE
+        /* Prints prefix, padding and a body of sourcelength characters.
+         * The body is produced by calling body(n), where n is the
+         * number of characters to print after the max_width clamp.
+         */
+        template<typename BodyFunc>
+        VERYINLINE inline void format_body(unsigned sourcelength, unsigned min_width, unsigned max_width,
+                                           unsigned fmt_flags, BodyFunc&& body)
         {
             unsigned char prefix_index = (fmt_flags / PFX_MUL) % (FLAG_MUL/PFX_MUL);
 
-            // Don't zeropad when there are textual prefixes, or if leftaligning is set
-            if(STRICT_COMPLIANCE && (unlikely(prefix_index >= prefix_nil) || (fmt_flags & fmt_leftalign)))
-            {
-                fmt_flags &= ~fmt_zeropad;
-            }
-
-            const char* stringconstants = GetStringConstants<SUPPORT_FLOAT_FORMATS>::GetTable();
-            unsigned char ctrl = stringconstants[PatternLength*2 + prefix_data_length-1+3 + prefix_index/4];
+            const char* stringconstants = GetStringConstants<Config::SUPPORT_FLOAT_FORMATS>::GetTable();
+            unsigned char ctrl = stringconstants[PatternLength*2 + prefix_data_length<Config>()-1+3 + prefix_index/4];
             unsigned prefixlength = ctrl/32;
             const char* prefixsource = &stringconstants[PatternLength*2-1 + (ctrl%32)];
             const char* prefix = prefixsource;
             if(prefix_index & 3)
             {
                 prefix = prefixbuffer;
-                prefixbuffer[0] = stringconstants[(prefix_index&3) + PatternLength*2 + prefix_data_length-1 -1];
+                prefixbuffer[0] = stringconstants[(prefix_index&3) + PatternLength*2 + prefix_data_length<Config>()-1 -1];
                 std::memcpy(&prefixbuffer[1], prefixsource, prefixlength++);
             }
 
-            //stringconstants += (fmt_flags & fmt_zeropad)?PatternLength:0;
-            //stringconstants = (fmt_flags&fmt_zeropad)? GetStringConstants<SUPPORT_FLOAT_FORMATS>::GetTable()+PatternLength
-            //                                         : GetStringConstants<SUPPORT_FLOAT_FORMATS>::GetTable();
-            stringconstants += PatternLength*(fmt_flags & fmt_zeropad)/fmt_zeropad;
+            body_layout layout = layout_body<Config>(prefixlength, sourcelength, min_width, max_width, fmt_flags);
+            stringconstants += PatternLength*layout.zeropad;
 
-            // Calculate length of prefix + source
-            unsigned combined_length = sourcelength + prefixlength;
-            // Clamp it into maximum permitted width
-            if(combined_length > max_width)
+            for(unsigned r=0, m=layout.order; r<3; ++r, m>>=2)
             {
-                combined_length = max_width;
-                // Figure out how to divide this between prefix and source
-                // By default, shorten the source, but print full prefix
-                sourcelength = combined_length - prefixlength;
-                // Only room to print some of the prefix, and nothing of the source?
-                if(unlikely(combined_length < prefixlength))
-                {
-                    prefixlength = combined_length;
-                    sourcelength = 0;
-                }
+                if(m&1)      append_spaces(stringconstants, layout.padding_width);
+                else if(m&2) append(prefix, layout.prefixlength);
+                else         body(layout.sourcelength);
             }
-            // Calculate the padding width
-            unsigned padding_width = min_width > combined_length ? min_width - combined_length : 0;
-
-            /* There are three possible combinations:
-             *
-             *    Leftalign      prefix, source, spaces
-             *    Zeropad        prefix, zeros,  source
-             *    neither        spaces, prefix, source
-             *
-             * Note that in case of zeropad+leftalign,
-             * zeropad is disregarded according to the standard.
-             */
-
-            // other(0):     1,2,0 = 1*1+2*4+0*16 = 0x09 (6 bits)
-            // leftalign(1): 2,0,1 = 2*1+0*4+1*16 = 0x12 (6 bits)
-            // zeropad(2):   2,1,0 = 2*1+1*4+0*16 = 0x06 (6 bits)
-            // (invalid)(3): 0,1,2
-            unsigned m = (1*1 + 2*4 + 0*16) * (1)
-                       + (2*1 + 0*4 + 1*16) * ((1u << (8*fmt_leftalign)) + (1u << (8*(fmt_leftalign+fmt_zeropad))))
-                       + (2*1 + 1*4 + 0*16) * ((1u << (8*fmt_zeropad)));
-            m >>= ((fmt_flags&(fmt_leftalign+fmt_zeropad))*8);
-            for(unsigned r=0; r<3; ++r, m>>=2)
-            {
-                if(m&1)      append_spaces(stringconstants,padding_width);
-                else if(m&2) append(prefix, prefixlength);
-                else         append(source, sourcelength);
-            }
-/*
-            if( (fmt_flags & (fmt_leftalign | fmt_zeropad))) append(prefix, prefixlength);
-            if( (fmt_flags & fmt_leftalign))                 append(source, sourcelength);
-            append_spaces(stringconstants, padding_width);
-            if(!(fmt_flags & (fmt_leftalign | fmt_zeropad))) append(prefix, prefixlength);
-            if(!(fmt_flags & fmt_leftalign))                 append(source, sourcelength);*/
         }
-    };
 
-    unsigned read_int(const char*& fmt, unsigned def)
-    {
-        if(*fmt >= '0' && *fmt <= '9')
+        inline void format_string(const char* source, unsigned sourcelength,
+                                  unsigned min_width, unsigned max_width, unsigned fmt_flags) VERYINLINE
         {
-            unsigned v = 0;
-            do { v = v*10 + (*fmt++ - '0'); } while(*fmt >= '0' && *fmt <= '9');
-            return v;
+            format_body(sourcelength, min_width, max_width, fmt_flags,
+                        [this,source](unsigned n) { append(source, n); });
         }
-        return def;
-    }
 
-    /*inline unsigned read_param_index(const char*& fmt) VERYINLINE;
-    inline unsigned read_param_index(const char*& fmt)
-    {
-        const char* bkup = fmt;
-        unsigned index = read_int(fmt, 0);
-        if(*fmt == '$') { ++fmt; return index; }
-        fmt = bkup;
-        return 0;
-    }*/
+        /* Prints text escaped for %Js or %Cs, and returns the length of the
+         * output; if print is false, only calculates it. Runs that need no
+         * escaping are appended from text itself. A CSV field is quoted only
+         * if it has quotes, commas or line breaks, and then its quotes are
+         * doubled.
+         */
+        std::size_t format_escaped(const char* text, std::size_t length, unsigned char mode, bool print)
+        {
+            // The two-character escapes, and where those of the control characters 8..13 are (+1; 0 for \u00XX)
+            static const char json_escapes[] = "\\\"\\\\\\b\\t\\n\\f\\r";
+            static const unsigned char json_controls[6] = { 5, 7, 9, 0, 11, 13 };
 
-    template<bool DoOperation> struct auto_dealloc_pointer {};
-    template<> struct auto_dealloc_pointer<false> { typedef unsigned char* type; };
-    template<> struct auto_dealloc_pointer<true>  { typedef std::unique_ptr<unsigned char[]> type; };
+            std::size_t total = length, pos = unescaped_run(text, length, mode);
+            if(mode == escape_csv)
+            {
+                if(pos == length) { if(print) append(text, length); return length; }
+                if(print) append(json_escapes+1, 1); // "
+                for(pos = 0; ; )
+                {
+                    const char* quote = static_cast<const char*>(std::memchr(text + pos, '"', length - pos));
+                    std::size_t end = quote ? std::size_t(quote - text + 1) : length;
+                    if(print) append(text + pos, end - pos);
+                    pos = end;
+                    if(!quote) break;
+                    if(print) append(json_escapes+1, 1);
+                    ++total;
+                }
+                if(print) append(json_escapes+1, 1);
+                return total + 2;
+            }
+            for(;;)
+            {
+                if(print) append(text, pos);
+                if(pos == length) return total;
+                unsigned char c = text[pos];
+                unsigned at = c == '"' ? 1 : c == '\\' ? 3 : (c >= 8 && c <= 13) ? json_controls[c - 8] : 0;
+                if(at)
+                {
+                    if(print) append(json_escapes + at - 1, 2);
+                    total += 1;
+                }
+                else
+                {
+                    char unicode[6] = { '\\', 'u', '0', '0', "0123456789abcdef"[c >> 4], "0123456789abcdef"[c & 15] };
+                    if(print) { append(unicode, 6); append(nullptr, 0); } // Flush now, because unicode goes out of scope
+                    total += 5;
+                }
+                text   += pos + 1;
+                length -= pos + 1;
+                pos = unescaped_run(text, length, mode);
+            }
+        }
 
-    template<unsigned tagv,typename T> struct typetag { typedef T type; static constexpr unsigned tag = tagv; };
+        /* Formats a value in %e, %f or %g style with exact decimal digits.
+         * Digits are generated into a local buffer in chunks and flushed
+         * as the buffer fills, so any precision can be printed.
+         */
+        template<typename FloatType>
+        void format_float(FloatType value, unsigned min_width, unsigned fmt_flags, unsigned precision)
+        {
+            unsigned char prefix_index = 0;
+            if(std::signbit(value))           { value = -value; prefix_index = prefix_minus; }
+            else if(fmt_flags & fmt_plussign) { prefix_index = prefix_plus;  }
+            else if(fmt_flags & fmt_space)    { prefix_index = prefix_space; }
 
-    /* Note: Compilation of this function depends on the compiler's ability to optimize away
-     * code that is never reached because of the state of the constexpr bools.
-     * E.g. if SUPPORT_POSITIONAL_PARAMETERS = false, much of the code in this function
-     * will end up dummied out and the binary size will be smaller.
-     */
-    int myvprintf(const char* fmt, std::va_list ap, char* param, void (*put)(char*,const char*,std::size_t)) NOINLINE;
-    int myvprintf(const char* fmt_begin, std::va_list ap, char* param, void (*put)(char*,const char*,std::size_t))
-    {
-        prn state;
-        state.param = param;
-        state.put   = put;
+            if(!std::isfinite(value))
+            {
+                format_string(nullptr, 0, min_width, ~0u, fmt_flags + PFX_MUL*(prefix_index + (
+                                std::isinf(value) ? ((fmt_flags & fmt_ucbase) ? prefix_INF : prefix_inf)
+                                                  : ((fmt_flags & fmt_ucbase) ? prefix_NAN : prefix_nan))));
+                return;
+            }
 
-        char numbuffer[NUMBUFFER_SIZE];
+            float_decimal<FloatType> dec;
+            dec.load(value, !(fmt_flags & (fmt_exponent | fmt_autofloat)), precision);
 
-        /* Positional parameters support:
-         * Pass 3: Calculate the number of parameters,
-                   then allocate array of sizes
-                   Or, if no positional parameters were found,
-                   jump straight to step 0
-         * Pass 2: Populate the array of sizes,
-         *         then convert it into array of offsets,
-         *         and allocate array of data,
-         *         and populate array of data
-         * Pass 1: Actually print,
+            if(fmt_flags & fmt_autofloat)
+            {
+                // Mode: Let X = E-style exponent, P = chosen precision.
+                //       If P > X >= -4, choose 'f' and P = P-1-X.
+                //       Else,           choose 'e' and P = P-1.
+                if(!precision) precision = 1;
+                int x0 = dec.exponent10();
+                dec.round_to(int(precision) - 1 - x0);
+                int x = dec.exponent10();
+                // GNU libc picks the precision before rounding; if rounding then carries
+                // from 'f' into the 'e' style (e.g. %#g of 999999.5), it prints "1.e+06".
+                if(x == int(precision) && x0 < x) { precision = 1; }
+                if(int(precision) > x && x >= -4) { precision -= x+1; }
+                else                              { precision -= 1; fmt_flags |= fmt_exponent; }
+                if(!(fmt_flags & fmt_alt))
+                {
+                    // Remove trailing zeros from the fraction
+                    int sig = ((fmt_flags & fmt_exponent) ? x : 0) - dec.lowest_place();
+                    precision = std::min(precision, unsigned(std::max(sig, 0)));
+                }
+            }
+            else if(fmt_flags & fmt_exponent)
+            {
+                dec.round_to(int(precision) - dec.exponent10());
+            }
+            else
+            {
+                dec.round_to(int(precision));
+            }
+
+            int      x              = dec.exponent10();
+            unsigned point_width    = (precision > 0 || (fmt_flags & fmt_alt)) ? 1 : 0;
+            unsigned exponent_width = 0;
+            int      head_place     = x;
+            unsigned head_width     = 1;
+            if(fmt_flags & fmt_exponent)
+            {
+                exponent_width = std::max(estimate_uinteger_width(x<0 ? -x : x, 10), 2u) + 2;
+            }
+            else if(x > 0)
+            {
+                head_width = x+1;
+            }
+            else
+            {
+                head_place = 0;
+            }
+
+            format_body(head_width + point_width + precision + exponent_width, min_width, ~0u,
+                        fmt_flags + PFX_MUL*prefix_index, [&](unsigned)
+            {
+                char buffer[72];
+                unsigned pos = 0;
+                auto reserve = [&](unsigned n)
+                {
+                    if(pos + n > sizeof(buffer))
+                    {
+                        append(buffer, pos);
+                        append(buffer, 0); // Flush before overwriting
+                        pos = 0;
+                    }
+                };
+                // Print count digits, starting from the digit at 10^place
+                auto put_digits = [&](int place, unsigned count)
+                {
+                    while(count > 0)
+                    {
+                        int      q     = float_decimal<FloatType>::floor_div9(place);
+                        int      index = dec.r - 1 - q;
+                        unsigned skip  = unsigned(place - 9*q);   // Digits below the wanted one in this limb
+                        unsigned n     = std::min(count, skip+1);
+                        if(index >= dec.z)
+                        {
+                            // All remaining digits are zeros
+                            append(buffer, pos);
+                            append_spaces(GetStringConstants<Config::SUPPORT_FLOAT_FORMATS>::GetTable() + PatternLength, count);
+                            pos = 0;
+                            return;
+                        }
+                        reserve(n);
+                        auto v = dec.at(index) / float_decimal<FloatType>::pow10(skip+1-n);
+                        for(unsigned w = n; w-- > 0; v /= 10) buffer[pos+w] = '0' + v % 10;
+                        pos   += n;
+                        place -= n;
+                        count -= n;
+                    }
+                };
+
+                put_digits(head_place, head_width);
+                if(point_width)
+                {
+                    reserve(1);
+                    buffer[pos++] = '.';
+                    put_digits(head_place - head_width, precision);
+                }
+                if(exponent_width)
+                {
+                    reserve(exponent_width);
+                    buffer[pos++] = ((fmt_flags & fmt_ucbase) ? 'E' : 'e');
+                    buffer[pos++] = ((x < 0)                  ? '-' : '+');
+                    put_uint_decimal(buffer + pos, x<0 ? -x : x, exponent_width-2);
+                    pos += exponent_width-2;
+                }
+                append(buffer, pos);
+                append(buffer, 0); // The buffer goes out of scope
+            });
+        }
+
+        /* Formats a value in %a style, straight from its bit pattern.
+         * Without precision, prints as many hex digits as needed for
+         * an exact representation. Rounding is to nearest, ties to even.
+         */
+        template<typename FloatType>
+        void format_float_hex(FloatType value, unsigned min_width, unsigned fmt_flags, unsigned precision)
+        {
+            typedef float_bits<FloatType> bits;
+            float_fields f = bits::get(value);
+
+            unsigned char prefix_index = 0;
+            if(f.negative)                    { prefix_index = prefix_minus; }
+            else if(fmt_flags & fmt_plussign) { prefix_index = prefix_plus;  }
+            else if(fmt_flags & fmt_space)    { prefix_index = prefix_space; }
+
+            if(f.infinite || f.nan)
+            {
+                format_string(nullptr, 0, min_width, ~0u, fmt_flags + PFX_MUL*(prefix_index + (
+                                f.infinite ? ((fmt_flags & fmt_ucbase) ? prefix_INF : prefix_inf)
+                                           : ((fmt_flags & fmt_ucbase) ? prefix_NAN : prefix_nan))));
+                return;
+            }
+
+            unsigned digits = bits::frac_digits;
+            if(precision == ~0u)
+            {
+                // Shortest exact representation
+                for(precision = digits; precision > 0 && !((f.frac >> (4*(digits-precision))) & 0xF); --precision) {}
+            }
+            else if(precision < digits)
+            {
+                unsigned           drop = 4*(digits-precision);
+                std::uint_fast64_t rem  = f.frac & ((std::uint_fast64_t(1) << drop) - 1);
+                std::uint_fast64_t half = std::uint_fast64_t(1) << (drop-1);
+                f.frac >>= drop;
+                bool odd = precision ? (f.frac & 1) : (f.head & 1);
+                if(rem > half || (rem == half && odd))
+                {
+                    if(!precision || ++f.frac >> (4*precision)) { f.frac = 0; ++f.head; }
+                    // A carry out of the leading digit is renormalized (x87 format only)
+                    if(f.head > 15) { f.head = 1; f.exponent += 4; }
+                }
+                digits = precision;
+            }
+
+            unsigned point_width = (precision > 0 || (fmt_flags & fmt_alt)) ? 1 : 0;
+            unsigned exp_abs     = f.exponent < 0 ? -f.exponent : f.exponent;
+            unsigned exp_width   = std::max(estimate_uinteger_width(exp_abs, 10), 1u);
+            int      alpha       = ('a'-10  -  (('a'-'A')*((fmt_flags & fmt_ucbase)/fmt_ucbase)));
+
+            format_body(1 + point_width + precision + 2 + exp_width, min_width, ~0u,
+                        fmt_flags + PFX_MUL*(prefix_index + ((fmt_flags & fmt_ucbase) ? prefix_0X : prefix_0x)),
+                        [&](unsigned)
+            {
+                char buffer[1+1+16+2+5];
+                unsigned pos = 0;
+                put_uinteger(buffer, f.head, 1, 16, alpha); ++pos;
+                if(point_width) { buffer[pos++] = '.'; }
+                unsigned n = std::min(precision, digits);
+                put_uinteger(buffer + pos, f.frac >> (4*(digits-n)), n, 16, alpha); pos += n;
+                if(precision > n)
+                {
+                    // Explicit precision beyond the exact digits: pad with zeros
+                    append(buffer, pos);
+                    append_spaces(GetStringConstants<Config::SUPPORT_FLOAT_FORMATS>::GetTable() + PatternLength, precision-n);
+                    pos = 0;
+                }
+                buffer[pos++] = ((fmt_flags & fmt_ucbase) ? 'P' : 'p');
+                buffer[pos++] = ((f.exponent < 0)         ? '-' : '+');
+                put_uint_decimal(buffer + pos, exp_abs, exp_width);
+                pos += exp_width;
+                append(buffer, pos);
+                append(buffer, 0); // The buffer goes out of scope
+            });
+        }
+    };
+
+    /* Custom conversions, indexed by letter - custom_first.
+     * Only characters from '@' to DEL can be registered.
+     */
+    struct custom_conversion
+    {
+        tinyprintf_handler handler;
+        unsigned char      argument; // TINYPRINTF_ARG_*
+    };
+    static constexpr unsigned char custom_first = 0x40, custom_count = 0x40;
+    static custom_conversion custom_conversions[custom_count];
+
+    /* Stores handler for %<letter>, for the engines whose Config has
+     * SUPPORT_CUSTOM_CONVERSIONS. Returns false if the letter cannot be used.
+     */
+    static bool set_custom_conversion(char letter, tinyprintf_handler handler, int argument)
+    {
+        unsigned index = (unsigned char)letter - custom_first;
+        if(index >= custom_count || std::strchr("ACEFGHJLQXabcdefghijlnopstuvwxz", letter)
+        || (argument != TINYPRINTF_ARG_POINTER && argument != TINYPRINTF_ARG_INTEGER))
+        {
+            return false;
+        }
+        custom_conversions[index] = { handler, (unsigned char)argument };
+        return true;
+    }
+
+    template<typename Config>
+    void custom_emit(tinyprintf_conversion* conv, const char* text, std::size_t length, bool field);
+
+    // strlen() that examines at most max_length characters (like POSIX strnlen)
+    inline unsigned bounded_strlen(const char* source, unsigned max_length) VERYINLINE;
+    inline unsigned bounded_strlen(const char* source, unsigned max_length)
+    {
+        if(max_length == ~0u) return std::strlen(source);
+        const void* end = std::memchr(source, '\0', max_length);
+        return end ? static_cast<const char*>(end) - source : max_length;
+    }
+
+    /* Prints length bytes as hex digits, with a separator after every group bytes
+     * (no separators if group is 0). The text is produced in a local buffer
+     * and sent to the sink in runs of several hundred characters.
+     */
+    template<typename Config>
+    void put_hexdump(prn<Config>& state, const unsigned char* data, std::size_t length,
+                     unsigned group, char separator, bool uppercase) NOINLINE;
+    template<typename Config>
+    void put_hexdump(prn<Config>& state, const unsigned char* data, std::size_t length,
+                     unsigned group, char separator, bool uppercase)
+    {
+        const char* digits = uppercase ? "0123456789ABCDEF" : "0123456789abcdef";
+        char stage[512];
+        unsigned n = 0;
+        std::size_t pos = 0;
+        auto put_stage = [&]
+        {
+            state.append(stage, n);
+            state.append(nullptr, 0); // Flush now, because stage will be overwritten
+            n = 0;
+        };
+    #ifdef __SSSE3__
+        // 16 bytes at a time. Groups must not straddle the blocks.
+        if(length >= 16 && (group == 0 || (group <= 16 && !(group & (group-1)))))
+        {
+            // Shuffle controls that place the high and low digit of each byte
+            // and the separators into the 32..48 characters of output.
+            const unsigned unit = group ? 2*group+1 : 32, block = 32 + (group ? 16/group : 0);
+            alignas(16) char high[48], low[48], sep[48];
+            for(unsigned j = 0; j < 48; ++j)
+            {
+                unsigned g = j / unit, r = j % unit, byte = g*(group ? group : 16) + r/2;
+                bool is_sep = j >= block || (group && r == 2*group);
+                high[j] = (is_sep || r % 2 == 1) ? char(0x80) : char(byte);
+                low[j]  = (is_sep || r % 2 == 0) ? char(0x80) : char(byte);
+                sep[j]  = (is_sep && j < block) ? separator : 0;
+            }
+            const __m128i table = _mm_loadu_si128(reinterpret_cast<const __m128i*>(digits));
+            const __m128i mask  = _mm_set1_epi8(0x0F);
+            for(; length - pos >= 16; pos += 16)
+            {
+                if(n + 48 > sizeof(stage)) put_stage();
+                __m128i v  = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + pos));
+                __m128i hi = _mm_shuffle_epi8(table, _mm_and_si128(_mm_srli_epi16(v, 4), mask));
+                __m128i lo = _mm_shuffle_epi8(table, _mm_and_si128(v, mask));
+                for(unsigned r = 0; r < block; r += 16)
+                {
+                    __m128i out = _mm_or_si128(
+                        _mm_or_si128(_mm_shuffle_epi8(hi, _mm_load_si128(reinterpret_cast<const __m128i*>(high + r))),
+                                     _mm_shuffle_epi8(lo, _mm_load_si128(reinterpret_cast<const __m128i*>(low + r)))),
+                        _mm_load_si128(reinterpret_cast<const __m128i*>(sep + r)));
+                    _mm_storeu_si128(reinterpret_cast<__m128i*>(stage + n + r), out);
+                }
+                n += block;
+            }
+            // The block wrote a separator after the last group
+            if(group && pos == length) --n;
+        }
+    #endif
+        for(; pos < length; ++pos)
+        {
+            if(n + 3 > sizeof(stage)) put_stage();
+            stage[n++] = digits[data[pos] >> 4];
+            stage[n++] = digits[data[pos] & 15];
+            if(group && (pos+1) % group == 0 && pos+1 < length) stage[n++] = separator;
+        }
+        put_stage();
+    }
+
+    /* Character classes for the table-driven specifier parser.
+     * Flag characters have spec_flag and their fmt_* bit, digits have
+     * spec_digit ('0' both), and the other characters that may continue
+     * a specifier have spec_syntax and one of the spec_* codes below
+     * (0 for those that only the state machine parses: $ t j L).
+     */
+    static constexpr unsigned char spec_flag = 0x20, spec_digit = 0x40, spec_syntax = 0x80;
+    static constexpr unsigned char spec_dot  = spec_syntax+1, spec_star = spec_syntax+2,
+                                   spec_h    = spec_syntax+3, spec_l    = spec_syntax+4, spec_z = spec_syntax+5;
+    struct spec_class_table { unsigned char classes[256]; };
+    constexpr spec_class_table make_spec_classes()
+    {
+        spec_class_table table{};
+        for(unsigned c = '1'; c <= '9'; ++c) table.classes[c] = spec_digit;
+        table.classes['0'] = spec_digit | spec_flag | fmt_zeropad;
+        table.classes['-'] = spec_flag | fmt_leftalign;
+        table.classes['+'] = spec_flag | fmt_plussign;
+        table.classes[' '] = spec_flag | fmt_space;
+        table.classes['#'] = spec_flag | fmt_alt;
+        table.classes['.'] = spec_dot;
+        table.classes['*'] = spec_star;
+        table.classes['h'] = spec_h;
+        table.classes['l'] = spec_l;
+        table.classes['z'] = spec_z;
+        for(unsigned char c: {'$', 't', 'j', 'L', 'w', 'J', 'C'}) table.classes[c] = spec_syntax;
+        return table;
+    }
+    static constexpr spec_class_table spec_classes = make_spec_classes();
+
+    // A conversion specifier decoded by decode_spec()
+    struct spec_shape
+    {
+        unsigned    flags;      // fmt_* flags
+        unsigned    width, precision;
+        unsigned    stars;      // 1: width is '*', 2: precision is '*'
+        unsigned    size_class; // 0, spec_h, spec_l or spec_z, +0x10 if doubled (hh, ll)
+        const char* end;        // The conversion letter
+        bool        simple;     // Whether the specifier has this shape; if not, the rest is not valid
+    };
+
+    /* Decodes flags, width, precision and length modifier of the specifier
+     * that begins at p (after the '%') with a few table lookups, if it has
+     * one of the common shapes.
+     */
+    template<typename Config>
+    constexpr spec_shape decode_spec(const char* p) VERYINLINE;
+    template<typename Config>
+    constexpr spec_shape decode_spec(const char* p)
+    {
+        spec_shape spec{0, 0, ~0u, 0, 0, nullptr, false};
+        unsigned c = spec_classes.classes[(unsigned char)*p];
+        while(c & spec_flag) { spec.flags |= c; c = spec_classes.classes[(unsigned char)*++p]; }
+        spec.flags &= 0x1F;
+        if(c & spec_digit)
+            do { spec.width = spec.width*10 + (*p - '0'); c = spec_classes.classes[(unsigned char)*++p]; } while(c & spec_digit);
+        else if(c == spec_star)
+            { spec.stars = 1; c = spec_classes.classes[(unsigned char)*++p]; }
+        if(c == spec_dot)
+        {
+            spec.precision = 0;
+            c = spec_classes.classes[(unsigned char)*++p];
+            if(c & spec_digit)
+                do { spec.precision = spec.precision*10 + (*p - '0'); c = spec_classes.classes[(unsigned char)*++p]; } while(c & spec_digit);
+            else if(c == spec_star)
+                { spec.stars |= 2; c = spec_classes.classes[(unsigned char)*++p]; }
+        }
+        if((c == spec_h && Config::SUPPORT_H_LENGTHS) || c == spec_l || c == spec_z)
+        {
+            spec.size_class = c;
+            if(p[1] == p[0] && c != spec_z) { spec.size_class += 0x10; ++p; }
+            c = spec_classes.classes[(unsigned char)*++p];
+        }
+        spec.end    = p;
+        spec.simple = !(c & (spec_flag | spec_digit | spec_syntax));
+        return spec;
+    }
+
+    unsigned read_int(const char*& fmt, unsigned def)
+    {
+        if(*fmt >= '0' && *fmt <= '9')
+        {
+            unsigned v = 0;
+            do { v = v*10 + (*fmt++ - '0'); } while(*fmt >= '0' && *fmt <= '9');
+            return v;
+        }
+        return def;
+    }
+
+    /*inline unsigned read_param_index(const char*& fmt) VERYINLINE;
+    inline unsigned read_param_index(const char*& fmt)
+    {
+        const char* bkup = fmt;
+        unsigned index = read_int(fmt, 0);
+        if(*fmt == '$') { ++fmt; return index; }
+        fmt = bkup;
+        return 0;
+    }*/
+
+    template<bool DoOperation> struct auto_dealloc_pointer {};
+    template<> struct auto_dealloc_pointer<false> { typedef unsigned char* type; };
+    template<> struct auto_dealloc_pointer<true>  { typedef std::unique_ptr<unsigned char[]> type; };
+
+    template<unsigned tagv,typename T> struct typetag { typedef T type; static constexpr unsigned tag = tagv; };
+
+    /* Note: Compilation of this function depends on the compiler's ability to optimize away
+     * code that is never reached because of the state of the constexpr bools.
+     * E.g. if Config::SUPPORT_POSITIONAL_PARAMETERS = false, much of the code in this function
+     * will end up dummied out and the binary size will be smaller.
+     */
+    template<typename Config>
+    int myvprintf(const char* fmt, std::va_list ap, char* param, void (*put)(char*,const char*,std::size_t)) NOINLINE;
+    template<typename Config>
+    int myvprintf(const char* fmt_begin, std::va_list ap, char* param, void (*put)(char*,const char*,std::size_t))
+    {
+        TINYPRINTF_PROBE1(printf_entry, fmt_begin);
+        prn<Config> state;
+        state.param = param;
+        state.put   = put;
+
+        char numbuffer[numbuffer_size<Config>()];
+        // Keeps long double code out of engines that do not support it
+        typedef typename std::conditional<Config::SUPPORT_LONG_DOUBLE, long double, double>::type long_double;
+
+        /* Positional parameters support:
+         * Pass 3: Calculate the number of parameters,
+                   then allocate array of sizes
+                   Or, if no positional parameters were found,
+                   jump straight to step 0
+         * Pass 2: Populate the array of sizes,
+         *         then convert it into array of offsets,
+         *         and allocate array of data,
+         *         and populate array of data
+         * Pass 1: Actually print,
          *         then free the two arrays, and exit
          * Pass 0: Actually print (no pos. params)
          */
@@ -600,18 +1682,18 @@ namespace myprintf
 
         constexpr unsigned MAX_AUTO_PARAMS = 0x10000, MAX_ROUNDS = 4, POS_PARAM_MUL = MAX_AUTO_PARAMS * MAX_ROUNDS;
         constexpr unsigned MAX_EXPLICIT_PARAMS = 0x400;
-        auto_dealloc_pointer<SUPPORT_POSITIONAL_PARAMETERS>::type param_data_table{};
+        typename auto_dealloc_pointer<Config::SUPPORT_POSITIONAL_PARAMETERS>::type param_data_table{};
 
         // Figure out the largest parameter size. This is a compile-time constant.
-        constexpr std::size_t largest = std::max(std::max(sizeof(long long), sizeof(void*)),
-                                                 SUPPORT_FLOAT_FORMATS ? std::max(sizeof(double),
-                                                   SUPPORT_LONG_DOUBLE ? sizeof(long double) : sizeof(long))
+        constexpr std::size_t largest = std::max(std::max(supports_int128<Config>() ? sizeof(uint128fmt_t) : sizeof(long long), sizeof(void*)),
+                                                 Config::SUPPORT_FLOAT_FORMATS ? std::max(sizeof(double),
+                                                   Config::SUPPORT_LONG_DOUBLE ? sizeof(long double) : sizeof(long))
                                                                        : sizeof(long));
         // "Round" variable encodes, starting from lsb:
         //     - log2(MAX_AUTO_PARAMS) bits: number of auto params counted so far
         //     - 2 bits:                     round number
         //     - The rest:                   maximum explicit param index found so far
-        for(unsigned round = SUPPORT_POSITIONAL_PARAMETERS ? (3*MAX_AUTO_PARAMS) : 0; ; )
+        for(unsigned round = Config::SUPPORT_POSITIONAL_PARAMETERS ? (3*MAX_AUTO_PARAMS) : 0; ; )
         {
             auto process_param = [&round,table=&param_data_table[0]](unsigned typetag, unsigned which_param_index) -> void*
             {
@@ -659,14 +1741,14 @@ namespace myprintf
                 {
                 literal:;
                     // Rounds 0 and 1 are action rounds. Rounds 2 and 3 are not (nothing is printed).
-                    if_constexpr(SUPPORT_POSITIONAL_PARAMETERS) { if(round & (MAX_AUTO_PARAMS*2)) continue; }
+                    if_constexpr(Config::SUPPORT_POSITIONAL_PARAMETERS) { if(round & (MAX_AUTO_PARAMS*2)) continue; }
                     state.append(fmt, 1);
                     continue;
                 }
 
                 #define GET_ARG(acquire_type, variable, type_index, which_param_index, ifnot) \
                     acquire_type variable; \
-                    if(SUPPORT_POSITIONAL_PARAMETERS && round != 0) \
+                    if(Config::SUPPORT_POSITIONAL_PARAMETERS && round != 0) \
                     { \
                         void* p = process_param(type_index, which_param_index); \
                         if(p) { variable = *(acquire_type const*)p; } \
@@ -677,6 +1759,7 @@ namespace myprintf
                 // Read format flags
                 constexpr unsigned got_minwidth  = 0x100u;
                 unsigned min_width = 0, precision = ~0u, fmt_flags = 0;
+                unsigned char escape = 0; // %Js, %Cs
                 // fmt_flags:
                 //    bits 0-7:   state.fmt_flags
                 //    bit 8:      flag: min_width has been read
@@ -694,13 +1777,48 @@ namespace myprintf
                 unsigned    length = 0;
 
                 unsigned param_index = 0;
-                /*if_constexpr(SUPPORT_POSITIONAL_PARAMETERS)
+                /*if_constexpr(Config::SUPPORT_POSITIONAL_PARAMETERS)
                 {
                     // Read possible position-index for the value (it comes before flags / widths)
                     ++fmt;
                     param_index = read_param_index(fmt);
                     goto moreflags;
                 }*/
+                if_constexpr(Config::TABLE_DRIVEN_PARSER)
+                {
+                    /* Nothing is committed (nor any '*' argument read) until the whole
+                     * specifier is known to be of a shape that decode_spec() handles;
+                     * otherwise the state machine below parses it from the beginning.
+                     */
+                    spec_shape spec = decode_spec<Config>(fmt + 1);
+                    if(likely(spec.simple))
+                    {
+                        if(spec.stars & 1)
+                        {
+                            GET_ARG(int,v,0, 0, v = 0);
+                            spec.width  = (v < 0) ? -v : v;
+                            spec.flags |= fmt_leftalign * (v < 0); // negative value sets left-aligning
+                        }
+                        if(spec.stars & 2)
+                        {
+                            GET_ARG(int,v,0, 0, v = -1);
+                            spec.precision = (v >= 0) ? unsigned(v) : ~0u; // negative value is treated as unset
+                        }
+                        min_width  = spec.width;
+                        precision  = spec.precision;
+                        fmt_flags |= spec.flags;
+                        switch(spec.size_class)
+                        {
+                            case spec_h:        set_sizebase(base_decimal,short);       break;
+                            case spec_h + 0x10: set_sizebase(base_decimal,char);        break;
+                            case spec_l:        set_sizebase(base_decimal,long);        break;
+                            case spec_l + 0x10: set_sizebase(base_decimal,long long);   break;
+                            case spec_z:        set_sizebase(base_decimal,std::size_t); break;
+                        }
+                        fmt = spec.end;
+                        goto moreflags;
+                    }
+                }
             moreflags1:
                 ++fmt;
             moreflags:;
@@ -718,7 +1836,7 @@ namespace myprintf
                     .
                     *
                     tzlLjh
-                    nsc
+                    nscvH
                     pxXobdiu
                     aAeEgGfF
                     % (((and other)))
@@ -726,7 +1844,35 @@ namespace myprintf
                 switch(*fmt)
                 {
                     case '\0': goto unexpected;
-                    case '%': got_unk: default: goto literal;
+                    case '%': goto literal;
+                    got_unk: default:
+                    if_constexpr(Config::SUPPORT_CUSTOM_CONVERSIONS)
+                    {
+                        unsigned index = (unsigned char)(*fmt) - custom_first;
+                        if(index >= custom_count || !custom_conversions[index].handler) goto literal;
+                        const custom_conversion& custom = custom_conversions[index];
+
+                        tinyprintf_conversion conv;
+                        if(custom.argument == TINYPRINTF_ARG_POINTER)
+                        {
+                            GET_ARG(const void*,pointer,3, param_index, continue);
+                            conv.arg.pointer = pointer;
+                        }
+                        else if(sizeof(long) != sizeof(long long) && is_type(long long)) { GET_ARG(long long,v,2, param_index, continue); conv.arg.integer = v; }
+                        else if(sizeof(int) != sizeof(long) && is_type(long))            { GET_ARG(long,v,1, param_index, continue);      conv.arg.integer = v; }
+                        else                                                             { GET_ARG(int,v,0, param_index, continue);       conv.arg.integer = v; }
+
+                        conv.letter    = *fmt;
+                        conv.flags     = fmt_flags & (fmt_leftalign|fmt_zeropad|fmt_plussign|fmt_space|fmt_alt);
+                        conv.width     = min_width;
+                        conv.precision = precision;
+                        conv.size      = get_type();
+                        conv.engine    = &state;
+                        conv.emit      = custom_emit<Config>;
+                        custom.handler(&conv);
+                        continue;
+                    }
+                    else goto literal;
 
                     case '-': fmt_flags |= fmt_leftalign; goto moreflags1;
                     case ' ': fmt_flags |= fmt_space;     goto moreflags1;
@@ -742,7 +1888,7 @@ namespace myprintf
                         unsigned value = read_int(fmt, 0);
                         if(!(fmt_flags & got_minwidth))
                         {
-                            if_constexpr(SUPPORT_POSITIONAL_PARAMETERS)
+                            if_constexpr(Config::SUPPORT_POSITIONAL_PARAMETERS)
                             {
                                 // If the value is followed by a '$', treat it
                                 // as param_index rather than as min_width.
@@ -763,14 +1909,14 @@ namespace myprintf
                         goto moreflags;
                     }
 
-                    case '.': fmt_flags |= got_minwidth; goto moreflags1;
+                    case '.': fmt_flags |= got_minwidth; precision = 0; goto moreflags1; // "." alone means 0
                     case '*':
                     {
                         // Read indirect min-width or precision
                         ++fmt;
 
                         unsigned opt_index = 0;
-                        if_constexpr(SUPPORT_POSITIONAL_PARAMETERS)
+                        if_constexpr(Config::SUPPORT_POSITIONAL_PARAMETERS)
                         {
                             //opt_index = read_param_index(fmt);
                             opt_index = read_int(fmt, 0);
@@ -784,31 +1930,53 @@ namespace myprintf
                         }
                         else
                         {
-                            if(v >= 0) { precision = v; } // negative value is treated as unset
+                            precision = (v >= 0) ? unsigned(v) : ~0u; // negative value is treated as unset
                         }
                         goto moreflags;
                     }
 
                     // Read possible length modifier.
-                    case 't': if_constexpr(!SUPPORT_T_LENGTH) goto got_unk; else {
+                    case 't': if_constexpr(!Config::SUPPORT_T_LENGTH) goto got_unk; else {
                               set_sizebase(base_decimal,std::ptrdiff_t);          goto moreflags1; }
                     case 'z': set_sizebase(base_decimal,std::size_t);             goto moreflags1;
                     case 'l': set_sizebase(base_decimal,long);  if(*++fmt != 'l') goto moreflags; PASSTHRU
                     case 'L': set_sizebase(base_decimal,long long);               goto moreflags1; // Or 'long double'
-                    case 'j': if_constexpr(!SUPPORT_J_LENGTH) goto got_unk; else {
+                    case 'j': if_constexpr(!Config::SUPPORT_J_LENGTH) goto got_unk; else {
                               set_sizebase(base_decimal,std::intmax_t);           goto moreflags1; }
-                    case 'h': if_constexpr(!SUPPORT_H_LENGTHS) goto got_unk; else {
+                    case 'h': if_constexpr(!Config::SUPPORT_H_LENGTHS) goto got_unk; else {
                               set_sizebase(base_decimal,short); if(*++fmt != 'h') goto moreflags; /*PASSTHRU*/
                               set_sizebase(base_decimal,char);                    goto moreflags1; }
+                    case 'w': if_constexpr(!Config::SUPPORT_W_LENGTH) goto got_unk; else {
+                              // C23 exact-width modifiers: w8, w16, w32, w64, w128
+                              ++fmt;
+                              switch(read_int(fmt, 0))
+                              {
+                                  case 8:   if(!Config::SUPPORT_H_LENGTHS) goto got_unk;
+                                            set_sizebase(base_decimal,std::int8_t);   goto moreflags;
+                                  case 16:  if(!Config::SUPPORT_H_LENGTHS) goto got_unk;
+                                            set_sizebase(base_decimal,std::int16_t);  goto moreflags;
+                                  case 32:  set_sizebase(base_decimal,std::int32_t);  goto moreflags;
+                                  case 64:  set_sizebase(base_decimal,std::int64_t);  goto moreflags;
+                                  case 128: if(!supports_int128<Config>()) goto got_unk;
+                                            set_sizebase(base_decimal,uint128fmt_t); goto moreflags;
+                              }
+                              goto got_unk; }
+
+                    // Escaping modifiers of %s and %v
+                    case 'J': if_constexpr(!Config::SUPPORT_ESCAPE_FORMATS) goto got_unk; else {
+                              escape = escape_json;                               goto moreflags1; }
+                    case 'C': if_constexpr(!Config::SUPPORT_ESCAPE_FORMATS) goto got_unk; else {
+                              escape = escape_csv;                                goto moreflags1; }
 
                     // Read the format type
 
                     // %n format
                     case 'n':
-                    if_constexpr(SUPPORT_N_FORMAT)
+                    if_constexpr(Config::SUPPORT_N_FORMAT)
                     {
                         GET_ARG(void*,pointer,3, param_index, continue);
 
+                        state.append(numbuffer,0); // Flush, so that state.param counts everything so far
                         auto value = state.param - param;
                     #if defined(__ARMEL__) || defined(__i386) || defined(__x86_64) || __BYTE_ORDER__==__ORDER_LITTLE_ENDIAN
                         // This loop is a great deal shorter code, but slower (does not matter
@@ -819,9 +1987,10 @@ namespace myprintf
                         if(!is_type(int))
                         {
                             if(sizeof(int) != sizeof(long) && is_type(long))  { *static_cast<long*>(pointer) = value; }
-                            else if(SUPPORT_H_LENGTHS && sizeof(int) != sizeof(short)
+                            else if(supports_int128<Config>() && is_type(uint128fmt_t)) { *static_cast<uint128fmt_t*>(pointer) = value; }
+                            else if(Config::SUPPORT_H_LENGTHS && sizeof(int) != sizeof(short)
                                  && is_type(short))                           { *static_cast<short*>(pointer) = value; }
-                            else if(SUPPORT_H_LENGTHS && sizeof(int) != sizeof(char)
+                            else if(Config::SUPPORT_H_LENGTHS && sizeof(int) != sizeof(char)
                                  && is_type(char))                            { *static_cast<signed char*>(pointer) = value; }
                             else /*if(sizeof(long) != sizeof(long long)
                                  && is_type(long long))*/                     { *static_cast<long long*>(pointer) = value; }
@@ -839,7 +2008,7 @@ namespace myprintf
                         source = static_cast<const char*>(pointer);
                         if(source)
                         {
-                            length = std::strlen(source);
+                            length = bounded_strlen(source, precision);
                             // Only calculate length on non-null pointers
                         }
                         else
@@ -851,6 +2020,79 @@ namespace myprintf
                         break;
                     }
 
+                    // String with explicit length: pointer, size_t
+                    case 'v': if_constexpr(!Config::SUPPORT_V_FORMAT) goto got_unk; else
+                    {
+                        // In the bookkeeping rounds, also register the length parameter before continuing
+                        GET_ARG(void*,pointer,3, param_index, pointer = nullptr);
+                        GET_ARG(std::size_t,n, sizeof(std::size_t) == sizeof(long) ? 1 : 2,
+                                param_index ? param_index+1 : 0, continue);
+
+                        source = static_cast<const char*>(pointer);
+                        if(source)
+                        {
+                            length = std::min(n, std::size_t(~0u));
+                        }
+                        else
+                        {
+                            fmt_flags |= (PFX_MUL*prefix_null);
+                        }
+
+                        // precision is treated as maximum width
+                        break;
+                    }
+
+                    // Fixed-point decimal: integer, int scale. The precision is the number of decimals
+                    case 'Q': if_constexpr(!Config::SUPPORT_Q_FORMAT) goto got_unk; else
+                    {
+                        // In the bookkeeping rounds, also register the scale parameter before continuing
+                        uintfmt_t uvalue = 0;
+                        uint128fmt_t wide = 0;
+                        bool is_wide = supports_int128<Config>() && is_type(uint128fmt_t);
+                        if(is_wide)                                                      { GET_ARG(uint128fmt_t,v,6, param_index, v = 0); wide = v; }
+                        else if(sizeof(long) != sizeof(long long) && is_type(long long)) { GET_ARG(long long,v,2, param_index, v = 0); uvalue = v; }
+                        else if(sizeof(int) != sizeof(long) && is_type(long))            { GET_ARG(long,v,1, param_index, v = 0); uvalue = v; }
+                        else                                                             { GET_ARG(int,v,0, param_index, v = 0); uvalue = v; }
+                        GET_ARG(int,scale,0, param_index ? param_index+1 : 0, continue);
+
+                        unsigned m = 8*get_type();
+                        if(m < 8*sizeof(uvalue))
+                        {
+                            // Truncate and sign-extend shorts and chars
+                            uintfmt_t mask = (uintfmt_t(1) << (m-1));
+                            uvalue = ((uvalue & (2*mask-1)) ^ mask) - mask;
+                        }
+                        if(precision == ~0u) precision = scale > 0 ? scale : 0;
+
+                        state.append(numbuffer,0); //state.flush();
+
+                        if(is_wide)
+                            std::tie(length,fmt_flags) = format_fixed<Config>(numbuffer, wide, scale, precision, fmt_flags);
+                        else
+                            std::tie(length,fmt_flags) = format_fixed<Config>(numbuffer, uvalue, scale, precision, fmt_flags);
+                        precision = ~0u; // No max-width
+                        break;
+                    }
+
+                    // Hexdump: the width is the number of bytes, the precision is the group size
+                    case 'H': if_constexpr(!Config::SUPPORT_HEXDUMP_FORMAT) goto got_unk; else
+                    {
+                        GET_ARG(void*,pointer,3, param_index, continue);
+
+                        if(pointer || !min_width)
+                        {
+                            put_hexdump(state, static_cast<const unsigned char*>(pointer), min_width,
+                                        precision == ~0u ? 0 : precision,
+                                        (fmt_flags & fmt_plussign) ? ':' : ' ', fmt_flags & fmt_alt);
+                            continue;
+                        }
+                        source = nullptr;
+                        fmt_flags |= (PFX_MUL*prefix_null);
+                        min_width = 0;
+                        precision = ~0u;
+                        break;
+                    }
+
                     // Character format
                     case 'c':
                     {
@@ -860,7 +2102,7 @@ namespace myprintf
 
                         numbuffer[0] = static_cast<char>(c);
                         length = 1;
-                        if_constexpr(STRICT_COMPLIANCE)
+                        if_constexpr(Config::STRICT_COMPLIANCE)
                         {
                             precision = ~0u; // No max-width
                         }
@@ -872,14 +2114,21 @@ namespace myprintf
                     case 'X': { fmt_flags |= fmt_ucbase; } PASSTHRU
                     case 'x': {                            set_base(base_hex);   goto got_int; }
                     case 'o': {                            set_base(base_octal); goto got_int; }
-                    case 'b': if_constexpr(!SUPPORT_BINARY_FORMAT) goto got_unk;
+                    case 'b': if_constexpr(!Config::SUPPORT_BINARY_FORMAT) goto got_unk;
                               else                       { set_base(base_binary); goto got_int; }
                     case 'd': case 'i': { fmt_flags |= fmt_signed; } PASSTHRU
                     case 'u': got_int:
                     {
                         intfmt_t value = 0;
+                        uint128fmt_t wide = 0;
+                        bool is_wide = supports_int128<Config>() && is_type(uint128fmt_t);
 
-                        if_constexpr(SUPPORT_H_LENGTHS)
+                        if(is_wide)
+                        {
+                            GET_ARG(uint128fmt_t,v,6, param_index, continue);
+                            wide = v;
+                        }
+                        else if_constexpr(Config::SUPPORT_H_LENGTHS)
                         {
                             uintfmt_t uvalue;
 
@@ -923,7 +2172,7 @@ namespace myprintf
                         unsigned min_digits = 1;
                         if(precision != ~0u)
                         {
-                            if_constexpr(STRICT_COMPLIANCE) { fmt_flags &= ~fmt_zeropad; }
+                            if_constexpr(Config::STRICT_COMPLIANCE) { fmt_flags &= ~fmt_zeropad; }
                             min_digits = precision;
                             precision = ~0u; // No max-width
                         }
@@ -932,29 +2181,31 @@ namespace myprintf
                         // because putbegin/putend can still refer to that data at this point
                         state.append(numbuffer,0); //state.flush();
 
-                        std::tie(length,fmt_flags) = format_integer(numbuffer, value, fmt_flags, min_digits);
+                        if(is_wide)
+                            std::tie(length,fmt_flags) = format_integer128<Config>(numbuffer, wide, fmt_flags, min_digits);
+                        else
+                            std::tie(length,fmt_flags) = format_integer<Config>(numbuffer, value, fmt_flags, min_digits);
                         break;
                     }
 
                     case 'A': PASSTHRU
-                    case 'a': if_constexpr(!SUPPORT_FLOAT_FORMATS || !SUPPORT_A_FORMAT) goto got_unk; else {
+                    case 'a': if_constexpr(!Config::SUPPORT_FLOAT_FORMATS || !Config::SUPPORT_A_FORMAT) goto got_unk; else {
                               set_base(base_hex);
-                              if(precision == ~0u) { } /* TODO: set enough precision for exact representation */
                               fmt_flags |= fmt_exponent;
                               goto got_flt; }
                     case 'E': PASSTHRU
-                    case 'e': if_constexpr(!SUPPORT_FLOAT_FORMATS) goto got_unk; else {
+                    case 'e': if_constexpr(!Config::SUPPORT_FLOAT_FORMATS) goto got_unk; else {
                               // Set up 'e' flags
                               fmt_flags |= fmt_exponent; // Mode: Always exponent
                               goto got_flt; }
                     case 'G': PASSTHRU
-                    case 'g': if_constexpr(!SUPPORT_FLOAT_FORMATS) goto got_unk; else {
+                    case 'g': if_constexpr(!Config::SUPPORT_FLOAT_FORMATS) goto got_unk; else {
                               // Set up 'g' flags
                               fmt_flags |= fmt_autofloat; // Mode: Autodetect
                               goto got_flt; }
                     case 'F': PASSTHRU
-                    case 'f': if_constexpr(!SUPPORT_FLOAT_FORMATS) goto got_unk; got_flt:;
-                    if_constexpr(SUPPORT_FLOAT_FORMATS)
+                    case 'f': if_constexpr(!Config::SUPPORT_FLOAT_FORMATS) goto got_unk; got_flt:;
+                    if_constexpr(Config::SUPPORT_FLOAT_FORMATS)
                     {
                         fmt_flags |= fmt_ucbase * (~*fmt & 0x20) / 0x20; // for capital letters
 
@@ -962,19 +2213,32 @@ namespace myprintf
                         // because putbegin/putend can still refer to that data at this point
                         state.append(numbuffer,0); //state.flush();
 
+                        if(Config::SUPPORT_A_FORMAT && get_base() == base_hex)
+                        {
+                            if(Config::SUPPORT_LONG_DOUBLE && is_type(long long))
+                            {
+                                GET_ARG(long_double,value,5, param_index, continue);
+                                state.format_float_hex(value, min_width, fmt_flags, precision);
+                            }
+                            else
+                            {
+                                GET_ARG(double,value,4, param_index, continue);
+                                state.format_float_hex(value, min_width, fmt_flags, precision);
+                            }
+                            continue;
+                        }
                         if(precision == ~0u) precision = 6;
-                        if(SUPPORT_LONG_DOUBLE && is_type(long long))
+                        if(Config::SUPPORT_LONG_DOUBLE && is_type(long long))
                         {
-                            GET_ARG(long double,value,5, param_index, continue);
-                            std::tie(length,fmt_flags) = format_float(numbuffer, value, fmt_flags, precision);
+                            GET_ARG(long_double,value,5, param_index, continue);
+                            state.format_float(value, min_width, fmt_flags, precision);
                         }
                         else
                         {
                             GET_ARG(double,value,4, param_index, continue);
-                            std::tie(length,fmt_flags) = format_float(numbuffer, value, fmt_flags, precision);
+                            state.format_float(value, min_width, fmt_flags, precision);
                         }
-                        precision = ~0u; // No max-width
-                        break;
+                        continue;
                     } else break;
                     /* f,F: [-]ddd.ddd
                      *                     Recognize [-]inf and nan (INF/NAN for 'F')
@@ -988,17 +2252,26 @@ namespace myprintf
                      *      Otherwise like f, but
                      *
                      * a,A: [-]0xh.hhhhp+d  Exactly one hex-digit before decimal point
-                     *                      Number of digits after it = precision.
+                     *                      Number of digits after it = precision,
+                     *                      or as many as needed for exact value.
                      */
 
                 }
+                if(Config::SUPPORT_ESCAPE_FORMATS && escape && source != numbuffer && source)
+                {
+                    // The precision limited the input, and the width applies to the escaped output
+                    std::size_t escaped = min_width ? state.format_escaped(source, length, escape, false) : 0;
+                    state.format_body(unsigned(std::min(escaped, std::size_t(~0u))), min_width, ~0u, fmt_flags & ~fmt_zeropad,
+                                      [&](unsigned) { state.format_escaped(source, length, escape, true); });
+                    continue;
+                }
                 state.format_string(source, length, min_width, precision, fmt_flags);
 
                 #undef GET_ARG
             }
         unexpected:;
             // Format string processing is complete.
-            if_constexpr(!SUPPORT_POSITIONAL_PARAMETERS)
+            if_constexpr(!Config::SUPPORT_POSITIONAL_PARAMETERS)
             {
                 goto exit_rounds;
             }
@@ -1021,7 +2294,7 @@ namespace myprintf
                         }
                         // Allocate room for offsets and parameters in one go.
                         //printf("%u params, sizesize=%u datasize=%u largest=%zu\n", n_params, paramsize_size, paramdata_size, largest);
-                        param_data_table = auto_dealloc_pointer<SUPPORT_POSITIONAL_PARAMETERS>::type(
+                        param_data_table = typename auto_dealloc_pointer<Config::SUPPORT_POSITIONAL_PARAMETERS>::type(
                             new unsigned char[largest * (paramsize_units + paramdata_units)]);
                         // It is likely we allocated too much (for example if all parameters are ints),
                         // but this way we only need one allocation for the entire duration of the printf.
@@ -1045,10 +2318,12 @@ namespace myprintf
                                 case 1: { *(long*)tgt      = va_arg(ap,long);      break; }
                                 case 2: { *(long long*)tgt = va_arg(ap,long long); break; }
                                 case 3: { *(void**)tgt     = va_arg(ap,void*);     break; }
-                                case 4: if_constexpr(!SUPPORT_FLOAT_FORMATS) { goto unreach; } else
+                                case 4: if_constexpr(!Config::SUPPORT_FLOAT_FORMATS) { goto unreach; } else
                                         { *(double*)tgt    = va_arg(ap,double);    break; }
-                                case 5: if_constexpr(!SUPPORT_FLOAT_FORMATS || !SUPPORT_LONG_DOUBLE) { goto unreach; } else
+                                case 5: if_constexpr(!Config::SUPPORT_FLOAT_FORMATS || !Config::SUPPORT_LONG_DOUBLE) { goto unreach; } else
                                         { *(long double*)tgt = va_arg(ap,long double); break; }
+                                case 6: if_constexpr(!supports_int128<Config>()) { goto unreach; } else
+                                        { *(uint128fmt_t*)tgt = va_arg(ap,uint128fmt_t); break; }
                                 #ifdef __GNUC__
                                 default: unreach: __builtin_unreachable(); goto type0;
                                 #else
@@ -1071,150 +2346,3450 @@ namespace myprintf
         }
     exit_rounds:;
         state.flush();
+        TINYPRINTF_PROBE2(printf_return, fmt_begin, state.param - param);
         return state.param - param;
     }
 
-    #undef set_sizebase
-    #undef set_base
-    #undef get_base
-    #undef get_type
-    #undef is_type
-    #undef BASE_MUL
-    #undef FLAG_MUL
-}
-}
-#ifdef __GNUC__
- #pragma GCC pop_options
-#endif
-
-extern "C" {
-    static void wfunc(char*, const char* src, std::size_t n)
+    // Prints text for a custom conversion handler, as a field like %s or as is
+    template<typename Config>
+    void custom_emit(tinyprintf_conversion* conv, const char* text, std::size_t length, bool field)
     {
-        /* PUT HERE YOUR CONSOLE-PRINTING FUNCTION */
-        extern int _write(int fd, const unsigned char* buffer, unsigned num, unsigned mode=0);
-        _write(1, (const unsigned char*) src, n);
+        prn<Config>& state = *static_cast<prn<Config>*>(conv->engine);
+        if(field)
+            state.format_string(text, std::min(length, std::size_t(~0u)), conv->width, conv->precision, conv->flags);
+        else
+            state.append(text, length);
+        state.append(nullptr, 0); // Flush now, because text may be a temporary of the handler
     }
 
-    int __wrap_printf(const char* fmt, ...) USED_FUNC;
-    int __wrap_printf(const char* fmt, ...)
+    // The engine used by the __wrap_* functions
+    inline int myvprintf(const char* fmt, std::va_list ap, char* param, void (*put)(char*,const char*,std::size_t)) VERYINLINE;
+    inline int myvprintf(const char* fmt, std::va_list ap, char* param, void (*put)(char*,const char*,std::size_t))
     {
-        std::va_list ap;
-        va_start(ap, fmt);
-        int ret = myprintf::myvprintf(fmt, ap, nullptr, wfunc);
-        va_end(ap);
-        return ret;
+        return myvprintf<default_config>(fmt, ap, param, put);
     }
 
-    int __wrap_vprintf(const char* fmt, std::va_list ap) USED_FUNC;
-    int __wrap_vprintf(const char* fmt, std::va_list ap)
-    {
-        return myprintf::myvprintf(fmt, ap, nullptr, wfunc);
-    }
+#ifdef SUPPORT_PRINT_ARRAY
+  #if defined(__AVX2__)
+    typedef __m256i simd_word;
+    #define SIMD(op)    _mm256_##op
+    #define SIMD_SI(op) _mm256_##op##_si256
+  #elif defined(__SSE4_1__)
+    typedef __m128i simd_word;
+    #define SIMD(op)    _mm_##op
+    #define SIMD_SI(op) _mm_##op##_si128
+  #endif
+  #ifdef SIMD
+    static constexpr unsigned simd_lanes = sizeof(simd_word) / 4;
 
-#ifdef SUPPORT_FILE_FUNCTIONS
-    int __wrap_vfprintf(std::FILE*, const char* fmt, std::va_list ap) USED_FUNC;
-    int __wrap_vfprintf(std::FILE*, const char* fmt, std::va_list ap)
+    // Divides each 32-bit lane by a constant through a 64-bit multiply: x * magic >> shift
+    template<unsigned magic, int shift>
+    inline simd_word simd_divide(simd_word x) VERYINLINE;
+    template<unsigned magic, int shift>
+    inline simd_word simd_divide(simd_word x)
     {
-        return myprintf::myvprintf(fmt, ap, nullptr, wfunc);
+        simd_word m    = SIMD(set1_epi32)(magic);
+        simd_word even = SIMD(srli_epi64)(SIMD(mul_epu32)(x, m), shift);
+        simd_word odd  = SIMD(srli_epi64)(SIMD(mul_epu32)(SIMD(srli_epi64)(x, 32), m), shift);
+        return SIMD_SI(or)(even, SIMD(slli_epi64)(odd, 32));
     }
 
-    int __wrap_fprintf(std::FILE*, const char* fmt, ...) USED_FUNC;
-    int __wrap_fprintf(std::FILE*, const char* fmt, ...)
+    /* Converts simd_lanes 32-bit values into ten decimal digits each,
+     * including leading zeros, into digits[n][0..9].
+     * Each value is split into 2+4+4 digits, then the 4-digit groups
+     * are split into pairs and single digits in 16-bit lanes.
+     */
+    void simd_decimal_digits(const std::uint32_t* values, char (*digits)[32])
     {
-        std::va_list ap;
-        va_start(ap, fmt);
-        int ret = myprintf::myvprintf(fmt, ap, nullptr, wfunc);
+        simd_word v = SIMD_SI(loadu)((const simd_word*)values);
+        simd_word a = simd_divide<1441151881u,57>(v); // v / 10^8
+        simd_word b = SIMD(sub_epi32)(v, SIMD(mullo_epi32)(a, SIMD(set1_epi32)(100000000)));
+        simd_word c = simd_divide<109951163u,40>(b);  // b / 10^4
+        simd_word d = SIMD(sub_epi32)(b, SIMD(mullo_epi32)(c, SIMD(set1_epi32)(10000)));
+
+        simd_word cd = SIMD_SI(or)(c, SIMD(slli_epi32)(d, 16));
+        simd_word hi = SIMD(srli_epi16)(SIMD(mulhi_epu16)(cd, SIMD(set1_epi16)(5243)), 3); // cd / 100
+        simd_word lo = SIMD(sub_epi16)(cd, SIMD(mullo_epi16)(hi, SIMD(set1_epi16)(100)));
+
+        // Each 128-bit half holds four values. unpacklo gets the pairs of the
+        // first two values, and unpackhi the pairs of the last two.
+        alignas(simd_word) char text[2][sizeof(simd_word)];
+        simd_word pairs[2] = { SIMD(unpacklo_epi16)(hi, lo), SIMD(unpackhi_epi16)(hi, lo) };
+        for(unsigned n=0; n<2; ++n)
+        {
+            simd_word tens  = SIMD(mulhi_epu16)(pairs[n], SIMD(set1_epi16)(6554)); // pair / 10
+            simd_word ones  = SIMD(sub_epi16)(pairs[n], SIMD(mullo_epi16)(tens, SIMD(set1_epi16)(10)));
+            simd_word chars = SIMD(add_epi8)(SIMD_SI(or)(tens, SIMD(slli_epi16)(ones, 8)), SIMD(set1_epi8)('0'));
+            SIMD_SI(store)((simd_word*)text[n], chars);
+        }
+
+        alignas(simd_word) std::uint32_t top[simd_lanes];
+        SIMD_SI(store)((simd_word*)top, a);
+        for(unsigned n=0; n<simd_lanes; ++n)
+        {
+            digits[n][0] = '0' + top[n] / 10;
+            digits[n][1] = '0' + top[n] % 10;
+            std::memcpy(&digits[n][2], &text[n%4/2][n/4*16 + n%2*8], 8);
+        }
+    }
+
+    // Number of decimal digits in value (0 for zero, like estimate_uinteger_width)
+    inline unsigned decimal_width(std::uint32_t value) VERYINLINE;
+    inline unsigned decimal_width(std::uint32_t value)
+    {
+        static const std::uint32_t powers[10] = { 1,10,100,1000,10000,100000,1000000,10000000,100000000,1000000000 };
+        unsigned w = (32 - __builtin_clz(value | 1)) * 1233 >> 12;
+        return w + (value >= powers[w]);
+    }
+  #else
+    static constexpr unsigned simd_lanes = 1;
+  #endif
+
+    /* Reads the element format of print_array(): a single integer conversion
+     * with optional flags, width, precision and length modifier.
+     * Without a length modifier, the size of the element is used.
+     */
+    template<typename Config>
+    bool read_array_format(const char* fmt, unsigned elemsize,
+                           unsigned& fmt_flags, unsigned& min_width, unsigned& min_digits)
+    {
+        fmt_flags  = 0;
+        min_digits = 1;
+        set_sizebase(base_decimal, int);
+        if(*fmt++ != '%') return false;
+        for(;; ++fmt)
+        {
+            switch(*fmt)
+            {
+                case '-': fmt_flags |= fmt_leftalign; continue;
+                case ' ': fmt_flags |= fmt_space;     continue;
+                case '+': fmt_flags |= fmt_plussign;  continue;
+                case '#': fmt_flags |= fmt_alt;       continue;
+                case '0': fmt_flags |= fmt_zeropad;   continue;
+            }
+            break;
+        }
+        min_width = read_int(fmt, 0);
+        if(*fmt == '.')
+        {
+            ++fmt;
+            min_digits = read_int(fmt, 0);
+            if_constexpr(Config::STRICT_COMPLIANCE) { fmt_flags &= ~fmt_zeropad; }
+        }
+
+        unsigned size = elemsize;
+        switch(*fmt)
+        {
+            case 't': if_constexpr(!Config::SUPPORT_T_LENGTH) return false; else {
+                      size = sizeof(std::ptrdiff_t); ++fmt; break; }
+            case 'z': size = sizeof(std::size_t); ++fmt; break;
+            case 'l': size = sizeof(long);      if(*++fmt != 'l') break; PASSTHRU
+            case 'L': size = sizeof(long long); ++fmt; break;
+            case 'j': if_constexpr(!Config::SUPPORT_J_LENGTH) return false; else {
+                      size = sizeof(std::intmax_t); ++fmt; break; }
+            case 'h': if_constexpr(!Config::SUPPORT_H_LENGTHS) return false; else {
+                      size = sizeof(short); if(*++fmt != 'h') break;
+                      size = sizeof(char);  ++fmt; break; }
+        }
+        switch(*fmt++)
+        {
+            case 'X': fmt_flags |= fmt_ucbase; PASSTHRU
+            case 'x': set_base(base_hex);   break;
+            case 'o': set_base(base_octal); break;
+            case 'b': if_constexpr(!Config::SUPPORT_BINARY_FORMAT) return false; else {
+                      set_base(base_binary); break; }
+            case 'd': case 'i': fmt_flags |= fmt_signed; break;
+            case 'u': break;
+            default: return false;
+        }
+        fmt_flags = (fmt_flags % (FLAG_MUL*BASE_MUL)) + FLAG_MUL*BASE_MUL * (std::min(size, elemsize)-1);
+        return *fmt == '\0';
+    }
+
+    // Loads an element and truncates/extends it like myvprintf() does for its type
+    inline intfmt_t read_array_element(const void* data, unsigned elemsize, unsigned fmt_flags) VERYINLINE;
+    inline intfmt_t read_array_element(const void* data, unsigned elemsize, unsigned fmt_flags)
+    {
+        uintfmt_t uvalue;
+        switch(elemsize)
+        {
+            case 1:  { std::uint8_t  v; std::memcpy(&v, data, 1); uvalue = v; break; }
+            case 2:  { std::uint16_t v; std::memcpy(&v, data, 2); uvalue = v; break; }
+            case 4:  { std::uint32_t v; std::memcpy(&v, data, 4); uvalue = v; break; }
+            default: { std::uint64_t v; std::memcpy(&v, data, 8); uvalue = v; break; }
+        }
+        unsigned m = 8*get_type();
+        if(m < 8*sizeof(uvalue))
+        {
+            uintfmt_t mask = (uintfmt_t(1) << m);
+            uvalue &= (mask-1);
+            if(fmt_flags & fmt_signed)
+            {
+                mask >>= 1;
+                uvalue = (uvalue ^ mask) - mask;
+            }
+        }
+        return uvalue;
+    }
+
+    static void put_to_buffer(char* target, const char* source, std::size_t count)
+    {
+        std::memcpy(target, source, count);
+    }
+
+    /* Prints count integers of elemsize bytes from data, each formatted with
+     * fmt_element and separated by separator. Short elements are assembled in
+     * a local buffer, so that put() receives long runs of text. Decimal
+     * conversions of values that fit in 32 bits are done simd_lanes at a time.
+     */
+    template<typename Config>
+    int print_array(char* param, void (*put)(char*,const char*,std::size_t),
+                    const char* fmt_element, const char* separator,
+                    const void* data, std::size_t count, std::size_t elemsize) NOINLINE;
+    template<typename Config>
+    int print_array(char* param, void (*put)(char*,const char*,std::size_t),
+                    const char* fmt_element, const char* separator,
+                    const void* data, std::size_t count, std::size_t elemsize)
+    {
+        unsigned fmt_flags, min_width, min_digits;
+        if(!elemsize || elemsize > sizeof(intfmt_t) || (elemsize & (elemsize-1))
+        || !read_array_format<Config>(fmt_element, elemsize, fmt_flags, min_width, min_digits))
+        {
+            return -1;
+        }
+
+        prn<Config> state;
+        state.param = param;
+        state.put   = put;
+
+        // Elements with wide padding or long separators are printed without the local buffer
+        constexpr unsigned max_staged = 64;
+        unsigned separator_length = std::strlen(separator);
+        const bool staged = min_width <= max_staged && separator_length <= max_staged;
+        char  stage[512];
+        char* out = stage;
+
+        char numbuffer[numbuffer_size<Config>()];
+    #ifdef SIMD
+        char digits[simd_lanes][32];
+    #endif
+        const unsigned char* elements = static_cast<const unsigned char*>(data);
+        for(std::size_t n = 0; n < count; n += simd_lanes)
+        {
+            unsigned group = std::min(count - n, std::size_t(simd_lanes));
+            intfmt_t values[simd_lanes];
+            for(unsigned k = 0; k < group; ++k)
+                values[k] = read_array_element(elements + (n+k) * elemsize, elemsize, fmt_flags);
+        #ifdef SIMD
+            std::uint32_t magnitudes[simd_lanes];
+            bool narrow = group == simd_lanes && get_base() == base_decimal && min_digits <= 10;
+            for(unsigned k = 0; k < group; ++k)
+            {
+                uintfmt_t magnitude = ((fmt_flags & fmt_signed) && values[k] < 0) ? -uintfmt_t(values[k]) : values[k];
+                narrow = narrow && magnitude <= 0xFFFFFFFFu;
+                magnitudes[k] = magnitude;
+            }
+            if(narrow) simd_decimal_digits(magnitudes, digits);
+        #endif
+
+            for(unsigned k = 0; k < group; ++k)
+            {
+                if(staged && out > stage + sizeof(stage) - (2*max_staged + numbuffer_size<Config>() + 16))
+                {
+                    state.append(stage, out - stage);
+                    state.append(stage, 0); // Flush before reusing the buffer
+                    out = stage;
+                }
+                prn<Config> local;
+                local.param = out;
+                local.put   = put_to_buffer;
+                prn<Config>& target = staged ? local : state;
+
+                const char* source;
+                unsigned    length, flags;
+            #ifdef SIMD
+                if(narrow)
+                {
+                    // Same prefix as format_integer() produces for decimal numbers
+                    char sign = 0;
+                    flags = fmt_flags;
+                    if(fmt_flags & fmt_signed)
+                    {
+                        if(values[k] < 0)                  { sign = '-'; flags += PFX_MUL*prefix_minus; }
+                        else if(fmt_flags & fmt_plussign)  { sign = '+'; flags += PFX_MUL*prefix_plus;  }
+                        else if(fmt_flags & fmt_space)     { sign = ' '; flags += PFX_MUL*prefix_space; }
+                    }
+                    length = clamp(decimal_width(magnitudes[k]), min_digits, 10);
+                    source = &digits[k][10 - length];
+                    if(staged && min_width <= length + (sign != 0))
+                    {
+                        // No padding: copy the sign and the digits directly
+                        *out = sign;
+                        out += (sign != 0);
+                        std::memcpy(out, source, 16);
+                        out += length;
+                        goto separate;
+                    }
+                }
+                else
+            #endif
+                {
+                    target.append(numbuffer, 0); // Flush before overwriting numbuffer
+                    std::tie(length,flags) = format_integer<Config>(numbuffer, values[k], fmt_flags, min_digits);
+                    source = numbuffer;
+                }
+                target.format_string(source, length, min_width, ~0u, flags);
+                if(staged)
+                {
+                    local.flush();
+                    out = local.param;
+                }
+            #ifdef SIMD
+            separate:
+            #endif
+                if(n + k + 1 < count)
+                {
+                    if(staged) { std::memcpy(out, separator, separator_length); out += separator_length; }
+                    else       { state.append(separator, separator_length); }
+                }
+            }
+            // digits[] is overwritten by the next group
+            if(!staged) state.append(numbuffer, 0);
+        }
+        state.append(stage, out - stage);
+        state.flush();
+        return state.param - param;
+    }
+  #ifdef SIMD
+    #undef SIMD
+    #undef SIMD_SI
+  #endif
+#endif
+
+#if __cplusplus >= 202002L
+    /* Formatting at compile time, for tinyprintf::static_format(). The
+     * specifiers are decoded with decode_spec() and the numbers converted
+     * with format_integer(), as in myvprintf(), and laid out with
+     * layout_body(), as in prn::format_body(). Supported are d i u x X o b c s and %%, without '*'
+     * and positional parameters.
+     */
+    inline void static_format_unsupported() {} // Not constexpr: reaching it makes the constant evaluation fail
+
+    // Copies the literal text up to the next conversion into out (if not null), and returns the conversion or the nul
+    constexpr const char* static_literal(const char* fmt, char* out, std::size_t& pos)
+    {
+        for(; *fmt; ++fmt)
+        {
+            if(*fmt == '%')
+            {
+                if(fmt[1] != '%') break;
+                ++fmt;
+            }
+            if(out) out[pos] = *fmt;
+            ++pos;
+        }
+        return fmt;
+    }
+
+    // What the length of an argument's text can be, from its type
+    struct static_arg { bool integer; std::size_t string_length; };
+    template<typename T>
+    constexpr static_arg describe_static_arg()
+    {
+        if constexpr(std::is_integral_v<T>)          return {true,  0};
+        else if constexpr(std::is_array_v<T>)        return {false, std::extent_v<T> - 1};
+        else if constexpr(std::is_null_pointer_v<T>) return {false, 6}; // (null)
+        else                                         return {false, ~std::size_t(0)};
+    }
+
+    // The longest text that fmt can produce with the arguments, or ~0 if fmt or an argument type is not supported
+    template<typename Config>
+    constexpr std::size_t static_format_bound(const char* fmt, const static_arg* args, std::size_t count)
+    {
+        std::size_t length = 0;
+        for(std::size_t n = 0; ; ++n)
+        {
+            fmt = static_literal(fmt, nullptr, length);
+            if(!*fmt) return length;
+            spec_shape spec = decode_spec<Config>(fmt + 1);
+            if(!spec.simple || spec.stars || n >= count) return ~std::size_t(0);
+            std::size_t body = 0;
+            switch(*spec.end)
+            {
+                case 'c':
+                    if(!args[n].integer) return ~std::size_t(0);
+                    body = 1;
+                    break;
+                case 's':
+                    if(args[n].integer || (args[n].string_length == ~std::size_t(0) && spec.precision == ~0u)) return ~std::size_t(0);
+                    body = std::min<std::size_t>(args[n].string_length, spec.precision);
+                    break;
+                case 'b':
+                    if(!Config::SUPPORT_BINARY_FORMAT) return ~std::size_t(0);
+                    PASSTHRU
+                case 'd': case 'i': case 'u': case 'x': case 'X': case 'o':
+                    if(!args[n].integer) return ~std::size_t(0);
+                    // Digits, and a sign or 0x
+                    body = std::max<std::size_t>(numbuffer_size<Config>(), spec.precision == ~0u ? 0 : spec.precision) + 3;
+                    break;
+                default: // %p, floating point and the other conversions
+                    return ~std::size_t(0);
+            }
+            length += std::max<std::size_t>(body, spec.width);
+            fmt = spec.end + 1;
+        }
+    }
+
+    // Puts prefix, padding and body as prn::format_body() does
+    template<typename Config>
+    constexpr std::size_t static_emit(char* out, std::size_t pos, const char* body, unsigned length,
+                                      unsigned min_width, unsigned max_width, unsigned fmt_flags)
+    {
+        unsigned prefix_index = (fmt_flags / PFX_MUL) % (FLAG_MUL/PFX_MUL);
+        char prefix[8] = {};
+        unsigned prefix_length = 0;
+        if(prefix_index & 3) prefix[prefix_length++] = " -+ "[prefix_index & 3];
+        constexpr const char* multichar[] = { "", "0x", "0X", "(nil)", "(null)" };
+        for(const char* p = multichar[prefix_index / 4]; *p; ++p) prefix[prefix_length++] = *p;
+
+        body_layout layout = layout_body<Config>(prefix_length, length, min_width, max_width, fmt_flags);
+        for(unsigned r=0, m=layout.order; r<3; ++r, m>>=2)
+        {
+            const char* text = (m&2) ? prefix : body;
+            unsigned n = (m&1) ? layout.padding_width : (m&2) ? layout.prefixlength : layout.sourcelength;
+            for(unsigned i = 0; i < n; ++i) out[pos++] = (m&1) ? (layout.zeropad ? '0' : ' ') : text[i];
+        }
+        return pos;
+    }
+
+    template<typename Config>
+    constexpr std::size_t static_format_to(char* out, std::size_t pos, const char* fmt)
+    {
+        fmt = static_literal(fmt, out, pos);
+        if(*fmt) static_format_unsupported(); // More conversions than arguments
+        return pos;
+    }
+
+    /* Formats into out like myvprintf<Config>() would with these arguments.
+     * out must have room for static_format_bound() characters.
+     */
+    template<typename Config, typename Arg, typename... Rest>
+    constexpr std::size_t static_format_to(char* out, std::size_t pos, const char* fmt, const Arg& arg, const Rest&... rest)
+    {
+        fmt = static_literal(fmt, out, pos);
+        if(!*fmt) return pos;
+        spec_shape spec = decode_spec<Config>(fmt + 1);
+        if(!spec.simple || spec.stars) static_format_unsupported();
+
+        unsigned fmt_flags = spec.flags;
+        set_sizebase(base_decimal, int);
+        switch(spec.size_class)
+        {
+            case spec_h:        set_sizebase(base_decimal,short);       break;
+            case spec_h + 0x10: set_sizebase(base_decimal,char);        break;
+            case spec_l:        set_sizebase(base_decimal,long);        break;
+            case spec_l + 0x10: set_sizebase(base_decimal,long long);   break;
+            case spec_z:        set_sizebase(base_decimal,std::size_t); break;
+        }
+
+        char numbuffer[numbuffer_size<Config>()] = {};
+        const char* body = numbuffer;
+        unsigned length = 0, max_width = ~0u;
+        if constexpr(std::is_integral_v<Arg>)
+        {
+            switch(*spec.end)
+            {
+                case 'c':
+                    numbuffer[0] = static_cast<char>(arg);
+                    length = 1;
+                    if(!Config::STRICT_COMPLIANCE) max_width = spec.precision;
+                    break;
+                case 'X': fmt_flags |= fmt_ucbase; PASSTHRU
+                case 'x': set_base(base_hex);   break;
+                case 'o': set_base(base_octal); break;
+                case 'b': if(Config::SUPPORT_BINARY_FORMAT) { set_base(base_binary); break; }
+                          static_format_unsupported(); break;
+                case 'd': case 'i': fmt_flags |= fmt_signed; break;
+                case 'u': break;
+                default: static_format_unsupported();
+            }
+            if(*spec.end != 'c')
+            {
+                // Truncate and extend the value to the type named by the length modifier, as va_arg() would read it
+                uintfmt_t uvalue = uintfmt_t(arg);
+                unsigned m = 8*get_type();
+                if(m < 8*sizeof(uintfmt_t))
+                {
+                    uintfmt_t mask = (uintfmt_t(1) << m);
+                    uvalue &= (mask-1);
+                    if(fmt_flags & fmt_signed)
+                    {
+                        mask >>= 1;
+                        uvalue = (uvalue ^ mask) - mask;
+                    }
+                }
+                unsigned min_digits = 1;
+                if(spec.precision != ~0u)
+                {
+                    if(Config::STRICT_COMPLIANCE) { fmt_flags &= ~fmt_zeropad; }
+                    min_digits = spec.precision;
+                }
+                auto result = format_integer<Config>(numbuffer, intfmt_t(uvalue), fmt_flags, min_digits);
+                length    = result.first;
+                fmt_flags = result.second;
+            }
+        }
+        else
+        {
+            if(*spec.end != 's') static_format_unsupported();
+            const char* source = nullptr;
+            if constexpr(!std::is_null_pointer_v<Arg>) source = arg;
+            if(source)
+                while(length < spec.precision && source[length]) ++length;
+            else
+                fmt_flags |= PFX_MUL*prefix_null;
+            body      = source;
+            max_width = spec.precision;
+        }
+        pos = static_emit<Config>(out, pos, body, length, spec.width, max_width, fmt_flags);
+        return static_format_to<Config>(out, pos, spec.end + 1, rest...);
+    }
+#endif
+
+    #undef set_sizebase
+    #undef set_base
+    #undef get_base
+    #undef get_type
+    #undef is_type
+    #undef BASE_MUL
+    #undef FLAG_MUL
+}
+}
+#ifdef __GNUC__
+ #pragma GCC diagnostic pop
+ #pragma GCC pop_options
+#endif
+
+#if __cplusplus >= 202002L
+namespace
+{
+namespace tinyprintf
+{
+    // A string literal as a template parameter
+    template<std::size_t N>
+    struct fixed_string
+    {
+        char text[N];
+        constexpr fixed_string(const char (&s)[N]) { for(std::size_t n = 0; n < N; ++n) text[n] = s[n]; }
+    };
+
+    /* Formats constant arguments at compile time:
+     *
+     *     constexpr auto banner = tinyprintf::static_format<"%s v%d.%02d">("app", 2, 7);
+     *
+     * The result is a nul-terminated std::array<char, N>, where N is
+     * enough for any values of the argument types; the text is the same
+     * as sprintf() would print.
+     */
+    template<fixed_string Format, typename... Args>
+    constexpr auto static_format(const Args&... args)
+    {
+        constexpr myprintf::static_arg described[] = { myprintf::describe_static_arg<Args>()..., {false, 0} };
+        constexpr std::size_t bound = myprintf::static_format_bound<myprintf::default_config>(Format.text, described, sizeof...(Args));
+        static_assert(bound != ~std::size_t(0), "static_format: unsupported conversion, '*', too few arguments, "
+                                                "an argument of the wrong type for its conversion, "
+                                                "or %s of a string of unknown length without a precision");
+        std::array<char, bound + 1> result{};
+        myprintf::static_format_to<myprintf::default_config>(result.data(), 0, Format.text, args...);
+        return result;
+    }
+}
+}
+#endif
+
+#ifdef SUPPORT_BATCH_FORMAT
+namespace
+{
+namespace myprintf
+{
+    /* Runs func(block) for every block in [0,num_blocks) using num_threads threads.
+     * Each thread starts with an equal share of the blocks and takes them
+     * from the front of its share. A thread that runs out steals the back
+     * half of another thread's share. A share is a single atomic word
+     * (begin in the high half, end in the low half), so both the owner
+     * and the thieves update it with compare-and-swap.
+     */
+    template<typename Func>
+    void parallel_for_blocks(std::uint32_t num_blocks, unsigned num_threads, Func&& func)
+    {
+        // Padded rather than alignas(64), which operator new ignores before C++17.
+        // The words are 64 bytes apart, so no two are on the same cache line.
+        struct share { std::atomic<std::uint64_t> range; char padding[64 - sizeof(std::atomic<std::uint64_t>)]; };
+        std::unique_ptr<share[]> shares(new share[num_threads]);
+        for(unsigned t=0; t<num_threads; ++t)
+        {
+            std::uint64_t begin = std::uint64_t(num_blocks) * t     / num_threads;
+            std::uint64_t end   = std::uint64_t(num_blocks) * (t+1) / num_threads;
+            shares[t].range.store((begin << 32) | end, std::memory_order_relaxed);
+        }
+
+        auto worker = [&](unsigned self)
+        {
+            std::atomic<std::uint64_t>& mine = shares[self].range;
+            for(;;)
+            {
+                // Take one block from the front of our own share
+                std::uint64_t r = mine.load(std::memory_order_acquire);
+                while(std::uint32_t(r >> 32) < std::uint32_t(r))
+                {
+                    if(mine.compare_exchange_weak(r, r + (std::uint64_t(1) << 32), std::memory_order_acq_rel))
+                    {
+                        func(std::uint32_t(r >> 32));
+                        r = mine.load(std::memory_order_acquire);
+                    }
+                }
+                // Ours is empty: steal the back half of someone else's
+                bool stole = false;
+                for(unsigned n=1; n<num_threads && !stole; ++n)
+                {
+                    std::atomic<std::uint64_t>& victim = shares[(self + n) % num_threads].range;
+                    std::uint64_t v = victim.load(std::memory_order_acquire);
+                    for(;;)
+                    {
+                        std::uint32_t begin = v >> 32, end = std::uint32_t(v);
+                        if(begin >= end || end - begin < 2) break;
+                        std::uint32_t mid = begin + (end - begin) / 2;
+                        if(victim.compare_exchange_weak(v, (std::uint64_t(begin) << 32) | mid, std::memory_order_acq_rel))
+                        {
+                            mine.store((std::uint64_t(mid) << 32) | end, std::memory_order_release);
+                            stole = true;
+                            break;
+                        }
+                    }
+                }
+                if(!stole) break;
+            }
+        };
+
+        std::unique_ptr<std::thread[]> threads(new std::thread[num_threads]);
+        for(unsigned t=1; t<num_threads; ++t) threads[t] = std::thread(worker, t);
+        worker(0);
+        for(unsigned t=1; t<num_threads; ++t) threads[t].join();
+    }
+}
+}
+#endif
+
+#ifdef SUPPORT_MMAP_SINK
+namespace
+{
+namespace myprintf
+{
+    /* A log file that is written through a shared mapping of the whole file.
+     * The file is extended in steps of extent bytes with posix_fallocate()
+     * and the mapping is grown with mremap(), so most writes are a memcpy
+     * into the page cache. While the log is open, the file ends with a
+     * trailer that records how much of it is text; the space before the
+     * trailer is zeros until it is written. After a crash, the next open
+     * finds the trailer and continues after the text. A clean close
+     * truncates the file after the text, removing the trailer.
+     */
+    struct mmap_trailer
+    {
+        char          magic[8];
+        std::uint64_t used, check; // check is ~used
+    };
+    static constexpr char mmap_magic[8] = {'t','p','l','o','g','e','n','d'};
+
+    struct mmap_log
+    {
+        std::mutex  lock;
+        int         fd;
+        char*       base   = nullptr;
+        std::size_t mapped = 0; // Size of the mapping and of the file
+        std::size_t used   = 0; // Bytes of text in the file
+        std::size_t synced = 0; // Bytes of text written back with msync()
+        std::size_t extent, sync_interval, page;
+        bool        failed = false;
+
+        bool map(std::size_t size)
+        {
+            void* p;
+            if(!base)
+                p = mmap(nullptr, size, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+            else
+            {
+            #ifdef MREMAP_MAYMOVE
+                p = mremap(base, mapped, size, MREMAP_MAYMOVE);
+            #else
+                munmap(base, mapped);
+                base = nullptr;
+                p = mmap(nullptr, size, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+            #endif
+            }
+            if(p == MAP_FAILED) return false;
+            base   = static_cast<char*>(p);
+            mapped = size;
+            return true;
+        }
+
+        mmap_trailer* trailer() const { return reinterpret_cast<mmap_trailer*>(base + mapped - sizeof(mmap_trailer)); }
+
+        void set_used(std::size_t n)
+        {
+            used = n;
+            trailer()->used  = n;
+            trailer()->check = ~std::uint64_t(n);
+        }
+
+        // Makes room for need bytes of text and the trailer
+        bool grow(std::size_t need)
+        {
+            std::size_t size = (need + sizeof(mmap_trailer) + extent - 1) / extent * extent;
+            if(posix_fallocate(fd, mapped, size - mapped) != 0 || !map(size)) return false;
+            std::memcpy(trailer()->magic, mmap_magic, sizeof(mmap_magic));
+            set_used(used);
+            return true;
+        }
+
+        // Returns the length of the text recorded in the trailer, or the whole file if it was closed cleanly
+        std::size_t recorded_used() const
+        {
+            if(mapped < sizeof(mmap_trailer)) return mapped;
+            mmap_trailer t;
+            std::memcpy(&t, trailer(), sizeof(t));
+            bool valid = std::memcmp(t.magic, mmap_magic, sizeof(mmap_magic)) == 0
+                      && t.check == ~t.used && t.used <= mapped - sizeof(mmap_trailer);
+            return valid ? std::size_t(t.used) : mapped;
+        }
+
+        int sync(int flags)
+        {
+            if(!base) return 0;
+            std::size_t begin = synced & ~(page-1), end = mapped - sizeof(mmap_trailer);
+            int ret = (used > begin) ? msync(base + begin, used - begin, flags) : 0;
+            // The trailer, so that the text can be found after a crash of the system too
+            if(ret == 0 && used < mapped) ret = msync(base + (end & ~(page-1)), mapped - (end & ~(page-1)), flags);
+            if(ret == 0) synced = used;
+            return ret;
+        }
+
+        bool write(const char* source, std::size_t count)
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            if(used + count + sizeof(mmap_trailer) > mapped && !grow(used + count)) { failed = true; return false; }
+            std::memcpy(base + used, source, count);
+            set_used(used + count);
+            if(sync_interval && used - synced >= sync_interval && sync(MS_SYNC) != 0) failed = true;
+            return true;
+        }
+    };
+}
+}
+#endif
+
+#ifdef SUPPORT_SHM_SINK
+namespace
+{
+namespace myprintf
+{
+    /* A shared memory area with one single-producer, single-consumer byte
+     * ring per printing thread. A printer copies each segment of text from
+     * prn into its ring, and publishes it by storing the new head when the
+     * segment ends a line, at fflush(), or when the ring is full. The
+     * consumer maps the same memory and reads the text where it is, then
+     * releases it by storing the new tail. Neither side makes a system call
+     * while the ring has room and the consumer is awake.
+     *
+     * A consumer that finds nothing to read sets waiting and sleeps on the
+     * futex word sequence. A printer looks for a sleeping consumer only after
+     * every wake_bytes bytes, at fflush(), and when its ring is full, so the
+     * wakeups are batched. The consumer's timeout bounds the delay of the
+     * text in between.
+     *
+     * A thread claims a free ring on its first print, or takes over the ring
+     * of a thread that has exited. The last ring is shared, under a mutex,
+     * by the threads that find no ring. It is given only whole lines, so
+     * that the lines of different threads are not mixed: the unfinished
+     * line of each thread is kept aside until its newline, also over
+     * fflush(), and put into the ring as it is when the log is closed.
+     */
+    static constexpr std::uint32_t shm_magic = 0x6D687374; // "tshm"
+
+    struct shm_header
+    {
+        std::atomic<std::uint32_t> magic;  // Stored last when the area is created
+        std::uint32_t ring_count;
+        std::uint64_t ring_size;           // A power of two
+        alignas(64) std::atomic<std::uint32_t> sequence; // Futex word, incremented by each wakeup
+        std::atomic<std::uint32_t> waiting;              // Nonzero while the consumer may sleep
+    };
+    struct shm_ring
+    {
+        alignas(64) std::atomic<std::uint64_t> head;     // End of the text that the printer has published
+        std::atomic<std::uint64_t> written;              // End of the text that the printer has written
+        std::atomic<std::uint64_t> dropped;              // Bytes discarded by TINYPRINTF_DROP
+        std::atomic<std::uint32_t> owner;                // Thread id of the printer, 0 if free
+        bool dropping;                                   // Printer only: the rest of the line is discarded
+        alignas(64) std::atomic<std::uint64_t> tail;     // Written by the consumer
+        // Followed by ring_size bytes of text
+    };
+    static_assert(ATOMIC_LLONG_LOCK_FREE == 2 && ATOMIC_INT_LOCK_FREE == 2, "The rings need address-free atomics");
+
+    struct shm_area
+    {
+        char*       base;
+        std::size_t size;
+
+        shm_header& header() const { return *reinterpret_cast<shm_header*>(base); }
+        static std::size_t area_size(unsigned count, std::uint64_t ring_size)
+        {
+            return sizeof(shm_header) + count * (sizeof(shm_ring) + ring_size);
+        }
+        shm_ring& ring(unsigned n) const
+        {
+            return *reinterpret_cast<shm_ring*>(base + sizeof(shm_header) + n * (sizeof(shm_ring) + header().ring_size));
+        }
+        char* text(unsigned n) const { return reinterpret_cast<char*>(&ring(n) + 1); }
+
+        static void futex(std::atomic<std::uint32_t>& word, int op, std::uint32_t value, const timespec* timeout)
+        {
+            syscall(SYS_futex, &word, op, value, timeout, nullptr, 0);
+        }
+    };
+
+    // The ring of the calling thread, for the log whose id matches
+    struct shm_binding { std::uint64_t id; unsigned ring; std::uint32_t tid; std::size_t unsignaled; };
+    static thread_local shm_binding shm_thread{};
+    static std::atomic<std::uint64_t> shm_last_id{0};
+
+    struct shm_log: shm_area
+    {
+        using shm_pending = std::pair<std::uint32_t, std::string>; // Thread id, unfinished line
+        std::mutex    shared_lock; // Of the last ring, and pending
+        std::vector<shm_pending> pending;
+        int           fd;
+        unsigned      policy;
+        std::size_t   wake_bytes;
+        std::uint64_t id;          // Tells apart the logs that were opened at the same address
+
+        unsigned claim(std::uint32_t self)
+        {
+            unsigned last = header().ring_count - 1;
+            // The ring that this thread already has, e.g. if it printed into another log in between
+            for(unsigned n = 0; n < last; ++n)
+                if(ring(n).owner.load(std::memory_order_relaxed) == self) return n;
+            for(unsigned n = 0; n < last; ++n)
+            {
+                std::uint32_t owner = 0;
+                if(ring(n).owner.compare_exchange_strong(owner, self)) return n;
+            }
+            // Take over the ring of a thread that has exited, without the line it did not finish
+            for(unsigned n = 0; n < last; ++n)
+            {
+                shm_ring& r = ring(n);
+                std::uint32_t owner = r.owner.load(std::memory_order_relaxed);
+                if(syscall(SYS_tgkill, getpid(), owner, 0) != 0 && errno == ESRCH
+                && r.owner.compare_exchange_strong(owner, self))
+                {
+                    std::uint64_t head = r.head.load(std::memory_order_relaxed);
+                    r.dropped.fetch_add(r.written.load(std::memory_order_relaxed) - head, std::memory_order_relaxed);
+                    r.written.store(head, std::memory_order_relaxed);
+                    r.dropping = false;
+                    return n;
+                }
+            }
+            return last;
+        }
+
+        // Binds the calling thread to its ring
+        shm_binding& bind()
+        {
+            shm_binding& self = shm_thread;
+            if(self.id != id)
+            {
+                std::uint32_t tid = syscall(SYS_gettid);
+                self = shm_binding{id, claim(tid), tid, 0};
+            }
+            return self;
+        }
+
+        void wake()
+        {
+            shm_header& h = header();
+            // Orders the published heads before the read of waiting; the consumer does the opposite
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if(h.waiting.load(std::memory_order_relaxed))
+            {
+                h.sequence.fetch_add(1, std::memory_order_release);
+                futex(h.sequence, FUTEX_WAKE, INT_MAX, nullptr);
+            }
+        }
+
+        // Copies text into the ring. Returns how much of it was not dropped.
+        std::size_t put(shm_binding& self, const char* source, std::size_t length)
+        {
+            shm_ring& r = ring(self.ring);
+            char* data = text(self.ring);
+            std::uint64_t size = header().ring_size, written = r.written.load(std::memory_order_acquire);
+            bool line_end = source[length-1] == '\n';
+
+            for(std::size_t left = length; left > 0; )
+            {
+                std::uint64_t room = size - (written - r.tail.load(std::memory_order_acquire));
+                if(policy == TINYPRINTF_DROP && (room < left || r.dropping))
+                {
+                    // Drop the whole line, so that the consumer only gets whole lines
+                    std::uint64_t head = r.head.load(std::memory_order_relaxed);
+                    r.dropping = !line_end;
+                    r.dropped.fetch_add(written - head + left, std::memory_order_relaxed);
+                    r.written.store(head, std::memory_order_relaxed);
+                    return length - left;
+                }
+                if(!room)
+                {
+                    r.head.store(written, std::memory_order_release);
+                    wake();
+                    std::this_thread::yield();
+                    continue;
+                }
+                std::size_t n = std::min<std::uint64_t>(left, room), offset = written & (size-1);
+                std::size_t first = std::min<std::uint64_t>(n, size - offset);
+                std::memcpy(data + offset, source, first);
+                std::memcpy(data, source + first, n - first);
+                written += n; source += n; left -= n;
+                r.written.store(written, std::memory_order_relaxed);
+            }
+            // Publish complete lines
+            if(line_end) r.head.store(written, std::memory_order_release);
+            if((self.unsignaled += length) >= wake_bytes) { self.unsignaled = 0; wake(); }
+            return length;
+        }
+
+        std::size_t write(const char* source, std::size_t length)
+        {
+            if(length == 0) return 0;
+            shm_binding& self = bind();
+            if(self.ring != header().ring_count - 1) return put(self, source, length);
+
+            // The shared ring gets only whole lines; the unfinished line of each thread waits in pending
+            std::lock_guard<std::mutex> guard(shared_lock);
+            auto line = std::find_if(pending.begin(), pending.end(), [&](const shm_pending& p) { return p.first == self.tid; });
+            std::size_t whole = length;
+            while(whole > 0 && source[whole-1] != '\n') --whole;
+            std::size_t accepted = length;
+            if(whole > 0)
+            {
+                if(line == pending.end())
+                {
+                    accepted = put(self, source, whole) + (length - whole);
+                }
+                else
+                {
+                    std::size_t waited = line->second.size();
+                    line->second.append(source, whole);
+                    std::size_t n = put(self, line->second.data(), line->second.size());
+                    accepted = n > waited ? n - waited + (length - whole) : 0;
+                    line->second.clear();
+                }
+            }
+            if(whole < length)
+            {
+                if(line == pending.end()) line = pending.emplace(pending.end(), self.tid, std::string());
+                line->second.append(source + whole, length - whole);
+            }
+            else if(line != pending.end())
+            {
+                pending.erase(line);
+            }
+            return accepted;
+        }
+
+        // Publishes the text of the calling thread; on the shared ring only whole lines are published
+        void publish()
+        {
+            if(shm_thread.id != id) return;
+            shm_binding& self = bind();
+            shm_ring& r = ring(self.ring);
+            if(self.ring != header().ring_count - 1) r.head.store(r.written.load(std::memory_order_relaxed), std::memory_order_release);
+            self.unsignaled = 0;
+        }
+
+        // Puts the unfinished lines of the shared ring into it as they are
+        void finish()
+        {
+            std::lock_guard<std::mutex> guard(shared_lock);
+            shm_ring& r = ring(header().ring_count - 1);
+            shm_binding self{id, header().ring_count - 1, 0, 0};
+            for(const shm_pending& line: pending) put(self, line.second.data(), line.second.size());
+            r.head.store(r.written.load(std::memory_order_relaxed), std::memory_order_release);
+            pending.clear();
+        }
+    };
+}
+}
+#endif
+
+#ifdef SUPPORT_URING_SINK
+namespace
+{
+namespace myprintf
+{
+    /* Asynchronous output into a file descriptor. The text is collected into
+     * one of several buffers. A full buffer is submitted to an io_uring as a
+     * write from a registered buffer into a registered file, and printing
+     * continues in the next free buffer. A printer only waits when all
+     * buffers are in flight. Completions are collected whenever a buffer
+     * is needed, and by flush().
+     *
+     * Writes into a seekable file are given explicit offsets, so they can
+     * complete in any order. Pipes, sockets and O_APPEND files have only
+     * one write in the ring at a time; the other full buffers wait in
+     * queue. The rest of a short write is submitted before the next buffer.
+     * A write that finds a non-blocking file full is retried when poll()
+     * says that it is writable.
+     *
+     * If io_uring cannot be used, a helper thread writes the full buffers
+     * in order with write(), and waits with poll() in the same way.
+     */
+    struct uring_log
+    {
+        struct buffer { std::size_t length, done; std::uint64_t offset; };
+
+        std::mutex  lock;
+        int         fd;
+        std::size_t size;           // Bytes per buffer
+        unsigned    count;          // Number of buffers
+        std::unique_ptr<char[]>     memory;
+        std::unique_ptr<buffer[]>   state;
+        std::unique_ptr<unsigned[]> free_list, queue, retry;
+        unsigned    num_free = 0, in_flight = 0;
+        unsigned    num_retry = 0;  // Buffers whose write got EAGAIN
+        unsigned    completed = 0;  // Count of finished buffers
+        unsigned    current  = ~0u; // Buffer being filled
+        std::size_t fill     = 0;
+        std::uint64_t offset = 0;   // File offset of the next buffer, if not stream
+        bool        stream   = true, failed = false;
+
+        // io_uring
+        int            ring = -1;
+        void*          sq_ring = MAP_FAILED;
+        void*          cq_ring = MAP_FAILED;
+        io_uring_sqe*  sqes    = static_cast<io_uring_sqe*>(MAP_FAILED);
+        std::size_t    sq_size = 0, cq_size = 0, sqes_size = 0;
+        unsigned      *sq_head, *sq_tail, *sq_mask, *sq_array, *cq_head, *cq_tail, *cq_mask;
+        io_uring_cqe*  cqes;
+        unsigned       active = 0;      // Writes in the ring
+        unsigned       unsubmitted = 0; // SQEs that the kernel has not taken yet
+
+        // Buffers to be written in order: by the helper thread, or by the ring if stream
+        unsigned                queue_head = 0, queue_length = 0;
+
+        // Helper thread, if io_uring is not used
+        std::thread             helper;
+        std::condition_variable changed;
+        bool                    stopping = false;
+
+        char* data(unsigned index) { return &memory[std::size_t(index) * size]; }
+
+        bool setup_ring()
+        {
+            io_uring_params params{};
+            ring = syscall(__NR_io_uring_setup, count, &params);
+            if(ring < 0) return false;
+
+            sq_size   = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+            cq_size   = params.cq_off.cqes  + params.cq_entries * sizeof(io_uring_cqe);
+            sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+            if(params.features & IORING_FEAT_SINGLE_MMAP) sq_size = cq_size = std::max(sq_size, cq_size);
+
+            sq_ring = mmap(nullptr, sq_size, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, ring, IORING_OFF_SQ_RING);
+            if(sq_ring == MAP_FAILED) return false;
+            cq_ring = (params.features & IORING_FEAT_SINGLE_MMAP) ? sq_ring
+                    : mmap(nullptr, cq_size, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, ring, IORING_OFF_CQ_RING);
+            if(cq_ring == MAP_FAILED) return false;
+            sqes = static_cast<io_uring_sqe*>(mmap(nullptr, sqes_size, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, ring, IORING_OFF_SQES));
+            if(sqes == MAP_FAILED) return false;
+
+            char* sq = static_cast<char*>(sq_ring), *cq = static_cast<char*>(cq_ring);
+            sq_head  = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+            sq_tail  = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+            sq_mask  = reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+            sq_array = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+            cq_head  = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+            cq_tail  = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+            cq_mask  = reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+            cqes     = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+
+            // Register the buffers and the file, so that the kernel does not
+            // need to map the pages and look up the file for every write.
+            std::unique_ptr<iovec[]> iov(new iovec[count]);
+            for(unsigned n = 0; n < count; ++n) iov[n] = iovec{data(n), size};
+            return syscall(__NR_io_uring_register, ring, IORING_REGISTER_BUFFERS, iov.get(), count) == 0
+                && syscall(__NR_io_uring_register, ring, IORING_REGISTER_FILES,   &fd, 1) == 0;
+        }
+
+        void close_ring()
+        {
+            if(sqes    != MAP_FAILED) munmap(sqes, sqes_size);
+            if(cq_ring != MAP_FAILED && cq_ring != sq_ring) munmap(cq_ring, cq_size);
+            if(sq_ring != MAP_FAILED) munmap(sq_ring, sq_size);
+            if(ring >= 0) close(ring);
+            ring = -1;
+        }
+
+        void finish(unsigned index)
+        {
+            free_list[num_free++] = index;
+            --in_flight;
+            ++completed;
+        }
+
+        /* Lets the kernel take the queued SQEs, and waits for a completion if wait is set.
+         * After an error that retrying does not help, takes the SQEs back and fails their buffers.
+         */
+        void enter(bool wait)
+        {
+            for(;;)
+            {
+                int r = syscall(__NR_io_uring_enter, ring, unsubmitted, wait ? 1 : 0, wait ? IORING_ENTER_GETEVENTS : 0, nullptr, 0);
+                if(r >= 0) { unsubmitted -= std::min<unsigned>(r, unsubmitted); return; }
+                if(errno == EINTR) continue;
+                // Out of resources for now: the SQEs stay queued for the next enter()
+                if((errno == EAGAIN || errno == EBUSY) && active > unsubmitted) return;
+                break;
+            }
+            unsigned head = __atomic_load_n(sq_head, __ATOMIC_ACQUIRE), tail = *sq_tail;
+            __atomic_store_n(sq_tail, head, __ATOMIC_RELEASE);
+            for(; head != tail; ++head)
+            {
+                unsigned index = sqes[sq_array[head & *sq_mask]].user_data;
+                --active;
+                failed = true;
+                finish(index);
+            }
+            unsubmitted = 0;
+        }
+
+        void submit(unsigned index)
+        {
+            const buffer& b = state[index];
+            unsigned tail = *sq_tail, slot = tail & *sq_mask;
+            io_uring_sqe& sqe = sqes[slot];
+            std::memset(&sqe, 0, sizeof(sqe));
+            sqe.opcode    = IORING_OP_WRITE_FIXED;
+            sqe.flags     = IOSQE_FIXED_FILE;
+            sqe.fd        = 0; // Index in the registered files
+            sqe.addr      = reinterpret_cast<std::uintptr_t>(data(index) + b.done);
+            sqe.len       = b.length - b.done;
+            sqe.off       = stream ? ~std::uint64_t() : b.offset + b.done;
+            sqe.buf_index = index;
+            sqe.user_data = index;
+            sq_array[slot] = slot;
+            __atomic_store_n(sq_tail, tail + 1, __ATOMIC_RELEASE);
+            ++active;
+            ++unsubmitted;
+            enter(false);
+        }
+
+        // Submits the next queued buffer of a stream, when the previous one is finished
+        void submit_next()
+        {
+            if(!active && !num_retry && queue_length)
+            {
+                unsigned index = queue[queue_head];
+                queue_head = (queue_head + 1) % count;
+                --queue_length;
+                submit(index);
+            }
+        }
+
+        // Collects the completions. Returns the number of buffers that were finished.
+        unsigned reap()
+        {
+            unsigned before = completed;
+            unsigned head = *cq_head, tail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+            for(; head != tail; ++head)
+            {
+                const io_uring_cqe& cqe = cqes[head & *cq_mask];
+                unsigned index = cqe.user_data;
+                int      res   = cqe.res;
+                __atomic_store_n(cq_head, head + 1, __ATOMIC_RELEASE);
+                --active;
+
+                buffer& b = state[index];
+                if(res > 0) b.done += res;
+                else if(res == -EAGAIN) { retry[num_retry++] = index; continue; } // See wait()
+                else if(res != -EINTR) { failed = true; b.done = b.length; }      // Also a write of 0 bytes
+
+                if(b.done < b.length) submit(index); // Short write: write the rest first
+                else finish(index);
+            }
+            if(stream) submit_next();
+            return completed - before;
+        }
+
+        // Waits until at least one buffer in flight is finished
+        void wait(std::unique_lock<std::mutex>& guard)
+        {
+            if(ring < 0) { changed.wait(guard); return; }
+            unsigned before = completed;
+            for(reap(); completed == before; reap())
+            {
+                if(num_retry && (!active || stream))
+                {
+                    // The file is non-blocking and was full: wait until it is writable
+                    pollfd p{fd, POLLOUT, 0};
+                    while(poll(&p, 1, -1) < 0 && errno == EINTR) {}
+                    while(num_retry) submit(retry[--num_retry]);
+                    continue;
+                }
+                if(!active) break;
+                enter(true);
+            }
+        }
+
+        void send()
+        {
+            state[current] = buffer{fill, 0, offset};
+            offset += fill;
+            ++in_flight;
+            if(ring >= 0 && !stream) submit(current);
+            else
+            {
+                queue[(queue_head + queue_length++) % count] = current;
+                if(ring < 0) changed.notify_all();
+                else submit_next();
+            }
+            current = ~0u;
+        }
+
+        void write(const char* source, std::size_t length)
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            while(length > 0)
+            {
+                if(current == ~0u)
+                {
+                    if(ring >= 0) reap();
+                    while(!num_free) wait(guard);
+                    current = free_list[--num_free];
+                    fill    = 0;
+                }
+                std::size_t n = std::min(length, size - fill);
+                std::memcpy(data(current) + fill, source, n);
+                fill += n; source += n; length -= n;
+                if(fill == size) send();
+            }
+        }
+
+        int flush()
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            if(current != ~0u && fill > 0) send();
+            while(in_flight) wait(guard);
+            return failed ? EOF : 0;
+        }
+
+        void run_helper()
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            for(;;)
+            {
+                if(!queue_length)
+                {
+                    if(stopping) break;
+                    changed.wait(guard);
+                    continue;
+                }
+                unsigned index = queue[queue_head];
+                const buffer& b = state[index];
+                guard.unlock();
+                bool ok = true;
+                for(std::size_t done = 0; ok && done < b.length; )
+                {
+                    ssize_t r = ::write(fd, data(index) + done, b.length - done);
+                    if(r > 0) done += r;
+                    else if(r < 0 && errno == EAGAIN)
+                    {
+                        pollfd p{fd, POLLOUT, 0};
+                        while(poll(&p, 1, -1) < 0 && errno == EINTR) {}
+                    }
+                    else ok = (r < 0 && errno == EINTR);
+                }
+                guard.lock();
+                if(!ok) failed = true;
+                queue_head = (queue_head + 1) % count;
+                --queue_length;
+                free_list[num_free++] = index;
+                --in_flight;
+                changed.notify_all();
+            }
+        }
+    };
+}
+}
+#endif
+
+#ifdef SUPPORT_BUFFERED_OUTPUT
+namespace
+{
+namespace myprintf
+{
+    /* Keeps the text that a sink did not accept, such as a non-blocking pipe
+     * that is full, and passes it on later. The buffer is emptied when it
+     * becomes full, at fflush(), and with TINYPRINTF_LINE_BUFFERED, after
+     * every newline. When the target does not accept more and the buffer
+     * is full, the policy decides: wait by spinning, wait with poll(), or
+     * drop the new text and count it.
+     */
+    struct buffered_output
+    {
+        std::mutex      lock;
+        tinyprintf_sink target;
+        std::unique_ptr<char[]> data;
+        std::size_t     capacity, begin = 0, end = 0; // The buffered text is data[begin..end)
+        std::size_t     dropped = 0;
+        unsigned        policy;
+        int             poll_fd;
+        bool            failed = false;
+
+        // Passes the buffered text to the target. Returns false if some of it is still buffered.
+        bool drain()
+        {
+            while(begin < end)
+            {
+                std::size_t n = target.put(target.param, &data[begin], end - begin);
+                if(n == TINYPRINTF_SINK_ERROR) { failed = true; break; }
+                if(n == 0) return false;
+                begin += n;
+            }
+            begin = end = 0;
+            return true;
+        }
+
+        // Waits until the target may accept more. Returns false if the policy is not to wait.
+        bool wait()
+        {
+            switch(policy & 3)
+            {
+                case TINYPRINTF_POLL:
+                    if(poll_fd >= 0)
+                    {
+                        pollfd p{poll_fd, POLLOUT, 0};
+                        while(poll(&p, 1, -1) < 0 && errno == EINTR) {}
+                        return true;
+                    }
+                    PASSTHRU
+                case TINYPRINTF_SPIN:
+                    std::this_thread::yield();
+                    return true;
+                default:
+                    return false;
+            }
+        }
+
+        std::size_t put(const char* text, std::size_t length)
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            if(failed) return TINYPRINTF_SINK_ERROR;
+            std::size_t accepted = 0;
+            while(accepted < length)
+            {
+                if(end == capacity)
+                {
+                    if(!drain() && begin == 0 && !wait()) break;
+                    if(failed) return TINYPRINTF_SINK_ERROR;
+                    if(begin > 0)
+                    {
+                        std::memmove(&data[0], &data[begin], end - begin);
+                        end  -= begin;
+                        begin = 0;
+                    }
+                    continue;
+                }
+                std::size_t n = std::min(length - accepted, capacity - end);
+                std::memcpy(&data[end], text + accepted, n);
+                end      += n;
+                accepted += n;
+            }
+            dropped += length - accepted;
+            if((policy & TINYPRINTF_LINE_BUFFERED) && std::memchr(text, '\n', accepted)) drain();
+            return failed ? TINYPRINTF_SINK_ERROR : accepted;
+        }
+
+        int flush()
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            while(!drain())
+                if(!wait()) { errno = EAGAIN; return EOF; }
+            if(target.flush && target.flush(target.param) != 0) failed = true;
+            return failed ? EOF : 0;
+        }
+    };
+}
+}
+#endif
+
+#ifdef SUPPORT_LZ_SINK
+namespace
+{
+namespace myprintf
+{
+    /* A compressing stage for buffered_output. Each block of text that it is
+     * given is compressed on its own with a small LZ77 coder and written into
+     * the target as a frame:
+     *
+     *     "tpz1", stored length, text length, checksum of the text
+     *
+     * each a 32-bit little-endian number, followed by the stored bytes. If
+     * the top bit of the stored length is set, the text is stored as is.
+     * Because no block refers to another, a file that ends in a partly written
+     * frame can be decoded up to that frame.
+     *
+     * The compressed form is a sequence of tokens. A token's high nibble is the
+     * number of literal bytes that follow it, and its low nibble is the length
+     * of a match minus 4, which follows as a 16-bit offset back into the text.
+     * A nibble of 15 is continued by bytes that are added to it, up to the first
+     * that is not 255. The last token has no match.
+     */
+    static constexpr unsigned lz_header = 16, lz_min_match = 4, lz_hash_bits = 12;
+    static constexpr std::uint32_t lz_stored = 0x80000000u;
+
+    inline std::uint32_t lz_load32(const unsigned char* p) { std::uint32_t v; std::memcpy(&v, p, 4); return v; }
+    inline unsigned char* lz_store32(unsigned char* p, std::uint32_t v)
+    {
+        for(unsigned n = 0; n < 4; ++n) p[n] = v >> (n*8);
+        return p + 4;
+    }
+    inline std::uint32_t lz_read32(const unsigned char* p) { return p[0] | p[1]<<8 | p[2]<<16 | std::uint32_t(p[3])<<24; }
+    inline unsigned char* lz_length(unsigned char* out, std::size_t length)
+    {
+        for(; length >= 255; length -= 255) *out++ = 255;
+        *out++ = length;
+        return out;
+    }
+    // The largest compressed size of length bytes; incompressible text is stored instead
+    inline std::size_t lz_bound(std::size_t length) { return lz_header + length; }
+
+    // FNV-1a over 32-bit words, so that it costs less than the compression
+    static std::uint32_t lz_checksum(const unsigned char* text, std::size_t length)
+    {
+        std::uint32_t hash = 2166136261u;
+        std::size_t n = 0;
+        for(; n + 4 <= length; n += 4) hash = (hash ^ lz_read32(text + n)) * 16777619u; // The same on any host
+        for(; n < length; ++n) hash = (hash ^ text[n]) * 16777619u;
+        return hash;
+    }
+
+    /* Compresses text into out, which has room for lz_bound(length) bytes.
+     * Returns the size of the frame.
+     */
+    static std::size_t lz_compress(const unsigned char* text, std::size_t length, unsigned char* out, std::uint32_t* table)
+    {
+        std::memset(table, 0, sizeof(std::uint32_t) << lz_hash_bits);
+        unsigned char* op = out + lz_header, *op_end = out + lz_header + length;
+        std::size_t ip = 0, anchor = 0;
+
+        // Each sequence needs at most 1 + (literals/255 + 1) + literals + 2 + (match/255 + 1) bytes
+        auto sequence = [&](std::size_t literals, std::size_t offset, std::size_t match) -> bool
+        {
+            if(op + literals + literals/255 + match/255 + 8 > op_end) return false;
+            unsigned char* token = op++;
+            *token = std::min<std::size_t>(literals, 15) << 4;
+            if(literals >= 15) op = lz_length(op, literals - 15);
+            std::memcpy(op, text + anchor, literals);
+            op += literals;
+            if(!offset) return true;
+            *op++ = offset; *op++ = offset >> 8;
+            match -= lz_min_match;
+            *token |= std::min<std::size_t>(match, 15);
+            if(match >= 15) op = lz_length(op, match - 15);
+            return true;
+        };
+
+        bool compressed = true;
+        while(compressed && ip + lz_min_match <= length)
+        {
+            std::uint32_t word = lz_load32(text + ip), hash = (word * 2654435761u) >> (32 - lz_hash_bits);
+            std::size_t ref = table[hash];
+            table[hash] = ip + 1;
+            if(!ref-- || ip - ref > 65535 || lz_load32(text + ref) != word)
+            {
+                ip += 1 + ((ip - anchor) >> 6); // Skip faster through text that does not repeat
+                continue;
+            }
+            std::size_t match = lz_min_match;
+            for(std::uint64_t a, b; ip + match + 8 <= length; match += 8)
+            {
+                std::memcpy(&a, text + ref + match, 8);
+                std::memcpy(&b, text + ip  + match, 8);
+                if(a != b) break;
+            }
+            while(ip + match < length && text[ref + match] == text[ip + match]) ++match;
+            compressed = sequence(ip - anchor, ip - ref, match);
+            ip = anchor = ip + match;
+        }
+        if(compressed) compressed = sequence(length - anchor, 0, 0);
+
+        std::size_t stored = op - out - lz_header;
+        if(!compressed)
+        {
+            std::memcpy(out + lz_header, text, length);
+            stored = length;
+        }
+        unsigned char* header = out;
+        for(char c: "tpz1") if(c) *header++ = c;
+        header = lz_store32(header, stored | (compressed ? 0 : lz_stored));
+        header = lz_store32(header, length);
+        lz_store32(header, lz_checksum(text, length));
+        return lz_header + stored;
+    }
+
+    /* Decodes the frame at data into out, which has room for the text length
+     * in its header. Returns false if it is damaged.
+     */
+    static bool lz_decompress(const unsigned char* ip, const unsigned char* end, unsigned char* out, std::size_t length)
+    {
+        unsigned char* op = out, *op_end = out + length;
+        auto count = [&](std::size_t n) -> std::size_t
+        {
+            if(n == 15)
+                for(unsigned char c = 255; c == 255 && ip < end; n += c) c = *ip++;
+            return n;
+        };
+        while(ip < end)
+        {
+            unsigned token = *ip++;
+            std::size_t literals = count(token >> 4);
+            if(literals > std::size_t(end - ip) || literals > std::size_t(op_end - op)) return false;
+            std::memcpy(op, ip, literals);
+            op += literals; ip += literals;
+            if(ip == end) break;
+
+            if(end - ip < 2) return false;
+            std::size_t offset = ip[0] | ip[1] << 8;
+            ip += 2;
+            std::size_t match = count(token & 15) + lz_min_match;
+            if(!offset || offset > std::size_t(op - out) || match > std::size_t(op_end - op)) return false;
+            const unsigned char* ref = op - offset;
+            if(offset >= match) std::memcpy(op, ref, match);
+            else for(std::size_t n = 0; n < match; ++n) op[n] = ref[n]; // Overlaps: repeats the last offset bytes
+            op += match;
+        }
+        return op == op_end;
+    }
+
+    // How long a target may accept nothing before the text is given up
+    static constexpr std::chrono::seconds lz_max_stall{1};
+
+    /* Gives size bytes to target, retrying while it accepts nothing for at
+     * most lz_max_stall. Returns the number of bytes that it accepted.
+     */
+    static std::size_t lz_deliver(const tinyprintf_sink& target, const char* data, std::size_t size)
+    {
+        std::chrono::steady_clock::time_point deadline;
+        bool waiting = false;
+        std::size_t written = 0;
+        while(written < size)
+        {
+            std::size_t r = target.put(target.param, data + written, size - written);
+            if(r == TINYPRINTF_SINK_ERROR) break;
+            if(r) { written += r; waiting = false; continue; }
+            auto now = std::chrono::steady_clock::now();
+            if(!waiting) { deadline = now + lz_max_stall; waiting = true; }
+            else if(now >= deadline) break;
+            std::this_thread::yield();
+        }
+        return written;
+    }
+
+    struct lz_stage
+    {
+        std::mutex      lock;
+        tinyprintf_sink target;
+        std::size_t     block_size;
+        std::unique_ptr<unsigned char[]> frame;
+        std::unique_ptr<std::uint32_t[]> table;
+        bool            failed = false;
+
+        std::size_t put(const char* text, std::size_t length)
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            for(std::size_t done = 0; done < length && !failed; )
+            {
+                std::size_t n = std::min(length - done, block_size);
+                std::size_t size = lz_compress(reinterpret_cast<const unsigned char*>(text + done), n, &frame[0], &table[0]);
+                // A frame must be written whole
+                if(lz_deliver(target, reinterpret_cast<char*>(&frame[0]), size) != size) failed = true;
+                done += n;
+            }
+            return failed ? TINYPRINTF_SINK_ERROR : length;
+        }
+    };
+}
+}
+#endif
+
+#ifdef SUPPORT_STATUS_LINE
+namespace
+{
+namespace myprintf
+{
+    /* A line that is printed again and again with the same format, such as
+     * a progress display. The format is split once into literal text and
+     * conversions. An update formats only the conversions whose arguments
+     * changed (and %s, since the text behind the pointer may have changed),
+     * and then prints only the columns that differ from what is already on
+     * the screen, moving the cursor over the others.
+     */
+    struct status_line
+    {
+        enum kind_t : unsigned char { arg_none, arg_int, arg_long, arg_longlong, arg_pointer, arg_string, arg_double, arg_longdouble };
+        struct field
+        {
+            const char*   spec;        // Literal text, or a nul-terminated conversion
+            unsigned      spec_length; // Length of literal text
+            bool          literal;
+            kind_t        kind;
+            unsigned char stars;       // Number of '*' in the width and precision
+            bool          valid;       // Whether star, value and the span are from a previous update
+            bool          truncated;   // Whether the text did not fit into the line
+            int           star[2];
+            union { long long i; const void* p; double d; long double ld; } value;
+            unsigned      begin, length;  // Span of the text in the line
+        };
+
+        std::unique_ptr<char[]>  specs;
+        std::unique_ptr<field[]> fields;
+        unsigned                 num_fields = 0;
+        std::unique_ptr<char[]>  line, next;   // What is on the screen, and the line being built
+        unsigned                 capacity, length = 0, cursor = 0;
+        bool                     shown = false;
+        bool                     lost  = false; // The output failed, so what the screen shows is not known
+        tinyprintf_sink          out;
+        tinyprintf_status_hooks  hooks;
+        int (*format)(char* target, std::size_t limit, const char* fmt, ...);
+        std::size_t              sent;
+
+        /* Splits fmt into fields. Returns false for positional parameters, %n, and
+         * conversions other than d i u x X o b c p s and floating point, such as
+         * %v, %H, %Q, the J, C and w modifiers and custom conversions.
+         */
+        bool parse(const char* fmt)
+        {
+            std::size_t fmt_length = std::strlen(fmt);
+            specs.reset(new char[fmt_length * 2 + 1]);
+            fields.reset(new field[fmt_length + 1]);
+            char* w = specs.get();
+            auto add_literal = [&](char c)
+            {
+                if(!num_fields || !fields[num_fields-1].literal)
+                    fields[num_fields++] = field{w, 0, true, arg_none, 0, false, false, {0,0}, {0}, 0, 0};
+                *w++ = c;
+                ++fields[num_fields-1].spec_length;
+            };
+            auto digits = [&]{ while(*fmt >= '0' && *fmt <= '9') ++fmt; };
+            while(*fmt)
+            {
+                if(*fmt != '%') { add_literal(*fmt++); continue; }
+                if(fmt[1] == '%') { add_literal('%'); fmt += 2; continue; }
+
+                const char* begin = fmt++;
+                field f{w, 0, false, arg_int, 0, false, false, {0,0}, {0}, 0, 0};
+                while(*fmt && std::strchr("-+ #0", *fmt)) ++fmt;
+                if(*fmt == '*') { ++f.stars; ++fmt; } else digits();
+                if(*fmt == '$' || (*fmt >= '0' && *fmt <= '9')) return false;
+                if(*fmt == '.')
+                {
+                    ++fmt;
+                    if(*fmt == '*') { ++f.stars; ++fmt; } else digits();
+                    if(*fmt == '$' || (*fmt >= '0' && *fmt <= '9')) return false;
+                }
+                bool big = false;
+                switch(*fmt)
+                {
+                    case 'h': ++fmt; if(*fmt == 'h') ++fmt; break;
+                    case 'z': case 't': ++fmt; f.kind = arg_long; break;
+                    case 'j': ++fmt; f.kind = arg_longlong; break;
+                    case 'L': ++fmt; f.kind = arg_longlong; big = true; break;
+                    case 'l': ++fmt; f.kind = arg_long; if(*fmt == 'l') { ++fmt; f.kind = arg_longlong; } break;
+                }
+                char c = *fmt;
+                if(!c) return false;
+                ++fmt;
+                if(c == 'n') return false;
+                else if(c == 'p') f.kind = arg_pointer;
+                else if(c == 's') f.kind = arg_string;
+                else if(std::strchr("aAeEfFgG", c)) f.kind = big ? arg_longdouble : arg_double;
+                else if(!std::strchr("diuxXobc", c)) return false; // Its argument could not be stored
+
+                std::memcpy(w, begin, fmt - begin);
+                w += fmt - begin;
+                *w++ = '\0';
+                fields[num_fields++] = f;
+            }
+            return true;
+        }
+
+        // Formats field f with its arguments into target, as snprintf would
+        template<typename T>
+        int format_field(char* target, std::size_t limit, const field& f, T value)
+        {
+            switch(f.stars)
+            {
+                case 0:  return format(target, limit, f.spec, value);
+                case 1:  return format(target, limit, f.spec, f.star[0], value);
+                default: return format(target, limit, f.spec, f.star[0], f.star[1], value);
+            }
+        }
+
+        // Prints text, as much as the output takes; after a failure, nothing more in this update
+        void emit(const char* text, unsigned count)
+        {
+            while(count > 0 && !lost)
+            {
+                std::size_t n = out.put(out.param, text, count);
+                if(n == TINYPRINTF_SINK_ERROR || n == 0) { lost = true; break; }
+                text  += n;
+                count -= n;
+                sent  += n;
+            }
+        }
+
+        void move_cursor(unsigned to)
+        {
+            char control[16];
+            if(to == cursor) return;
+            if(hooks.move)           emit(control, hooks.move(control, cursor, to));
+            else if(to > cursor)     emit(&next[cursor], to - cursor); // Print again what is already there
+            else if(to + 1 < cursor - to) { emit("\r", 1); emit(&next[0], to); }
+            else for(unsigned n = cursor - to; n > 0; )
+            {
+                static const char backspaces[8] = {'\b','\b','\b','\b','\b','\b','\b','\b'};
+                unsigned m = std::min(n, 8u);
+                emit(backspaces, m);
+                n -= m;
+            }
+            cursor = to;
+        }
+
+        /* Builds the new line from args and prints the difference. Returns the number
+         * of bytes printed, or TINYPRINTF_SINK_ERROR if the output failed; the next
+         * update then prints the whole line again from the start of the line.
+         */
+        std::size_t update(std::va_list ap)
+        {
+            sent = 0;
+            bool redraw = lost;
+            lost = false;
+            if(redraw) { emit("\r", 1); cursor = 0; }
+            unsigned pos = 0;
+            for(unsigned n = 0; n < num_fields; ++n)
+            {
+                field& f = fields[n];
+                unsigned room = capacity - pos;
+                if(f.literal)
+                {
+                    unsigned count = std::min(f.spec_length, room);
+                    std::memcpy(&next[pos], f.spec, count);
+                    pos += count;
+                    continue;
+                }
+                // The old text is kept only if it is whole and still fits
+                bool changed = !f.valid || f.truncated || f.length > room;
+                for(unsigned s = 0; s < f.stars; ++s)
+                {
+                    int v = va_arg(ap, int);
+                    changed = changed || v != f.star[s];
+                    f.star[s] = v;
+                }
+                int count = 0;
+                #define STATUS_FIELD(type, member, always) { \
+                    type v = va_arg(ap, type); \
+                    changed = changed || always || !(v == f.value.member); \
+                    f.value.member = v; \
+                    if(changed) count = format_field(&next[pos], room+1, f, v); }
+                switch(f.kind)
+                {
+                    case arg_none:       break; // Literal text
+                    case arg_int:        STATUS_FIELD(int,         i,  false) break;
+                    case arg_long:       STATUS_FIELD(long,        i,  false) break;
+                    case arg_longlong:   STATUS_FIELD(long long,   i,  false) break;
+                    case arg_pointer:    STATUS_FIELD(const void*, p,  false) break;
+                    case arg_string:     STATUS_FIELD(const char*, p,  true)  break;
+                    case arg_double:     STATUS_FIELD(double,      d,  false) break;
+                    case arg_longdouble: STATUS_FIELD(long double, ld, false) break;
+                }
+                #undef STATUS_FIELD
+                if(changed)
+                {
+                    f.length    = std::min(unsigned(std::max(count, 0)), room);
+                    f.truncated = unsigned(std::max(count, 0)) > room;
+                }
+                else
+                    std::memcpy(&next[pos], &line[f.begin], f.length = std::min(f.length, room));
+                f.begin = pos;
+                f.valid = true;
+                pos += f.length;
+            }
+
+            // Print the runs of columns that differ from the screen. Runs that are
+            // separated by only a few equal columns are printed as one.
+            unsigned common = shown && !redraw ? std::min(length, pos) : 0;
+            for(unsigned first = 0; first < common; )
+            {
+                if(line[first] == next[first]) { ++first; continue; }
+                unsigned last = first + 1;
+                for(unsigned gap = 0; last + gap < common && gap < 4; )
+                {
+                    if(line[last + gap] != next[last + gap]) { last += gap + 1; gap = 0; }
+                    else ++gap;
+                }
+                move_cursor(first);
+                emit(&next[first], last - first);
+                cursor = first = last;
+            }
+            if(pos > common)
+            {
+                move_cursor(common);
+                emit(&next[common], pos - common);
+                cursor = pos;
+            }
+            if(shown && pos < length)
+            {
+                char control[16];
+                if(hooks.clear) emit(control, hooks.clear(control));
+                else
+                {
+                    // Print spaces over the old text
+                    for(unsigned n = length - pos; n > 0; )
+                    {
+                        static const char spaces[8] = {' ',' ',' ',' ',' ',' ',' ',' '};
+                        unsigned m = std::min(n, 8u);
+                        emit(spaces, m);
+                        n -= m;
+                    }
+                    cursor = length;
+                }
+            }
+            line.swap(next);
+            length = lost ? std::max(length, pos) : pos; // After a failure, the old text may still be there
+            shown  = true;
+            return lost ? TINYPRINTF_SINK_ERROR : sent;
+        }
+    };
+}
+}
+#endif
+
+#ifdef SUPPORT_RATE_LIMIT
+namespace
+{
+namespace myprintf
+{
+    /* Call sites of the rate-limited and sampled printf functions, keyed by
+     * the address of the format string. The table is open-addressed and
+     * never shrinks; a slot is claimed with a compare-and-swap of its key.
+     * When the table is full, new call sites are not limited.
+     */
+    static constexpr unsigned RATE_LIMIT_SITES_LOG2 = 9;
+
+    struct rate_site
+    {
+        std::atomic<const char*>   format;
+        std::atomic<std::uint64_t> state;      // Token bucket: theoretical arrival time. Sampling: number of calls.
+        std::atomic<std::uint64_t> suppressed; // Not yet reported
+        std::atomic<std::uint64_t> reported;   // When the suppressed count was last reported
+    };
+    static rate_site rate_sites[1u << RATE_LIMIT_SITES_LOG2];
+    static std::atomic<std::uint64_t> rate_report_interval{10000000000ull}; // In nanoseconds
+
+    static std::uint64_t rate_clock()
+    {
+        struct timespec now;
+    #ifdef CLOCK_MONOTONIC_COARSE
+        clock_gettime(CLOCK_MONOTONIC_COARSE, &now);
+    #else
+        clock_gettime(CLOCK_MONOTONIC, &now);
+    #endif
+        return std::uint64_t(now.tv_sec) * 1000000000u + now.tv_nsec;
+    }
+
+    static rate_site* find_rate_site(const char* format)
+    {
+        constexpr unsigned mask = (1u << RATE_LIMIT_SITES_LOG2) - 1;
+        unsigned index = unsigned((std::uintptr_t(format) * 0x9E3779B97F4A7C15ull) >> (64 - RATE_LIMIT_SITES_LOG2));
+        for(unsigned probe = 0; probe <= mask; ++probe, index = (index + 1) & mask)
+        {
+            rate_site& site = rate_sites[index];
+            const char* key = site.format.load(std::memory_order_acquire);
+            if(likely(key == format)) return &site;
+            if(key == nullptr
+            && (site.format.compare_exchange_strong(key, format, std::memory_order_acq_rel) || key == format))
+                return &site;
+        }
+        return nullptr;
+    }
+
+    /* Token bucket, as a generic cell rate algorithm: a message is allowed
+     * if it would not arrive more than burst intervals ahead of its time.
+     */
+    static bool rate_allow(rate_site& site, unsigned per_second, unsigned burst, std::uint64_t now)
+    {
+        if(per_second == 0) return false;
+        std::uint64_t interval  = 1000000000u / per_second;
+        std::uint64_t tolerance = interval * std::max(burst, 1u);
+        std::uint64_t tat = site.state.load(std::memory_order_relaxed);
+        for(;;)
+        {
+            std::uint64_t next = std::max(tat, now) + interval;
+            if(next - now > tolerance) return false;
+            if(site.state.compare_exchange_weak(tat, next, std::memory_order_relaxed)) return true;
+        }
+    }
+
+    // Takes the suppressed count of site, if it is time to report it
+    static std::uint64_t rate_take_report(rate_site& site)
+    {
+        if(likely(site.suppressed.load(std::memory_order_relaxed) == 0)) return 0;
+        std::uint64_t now      = rate_clock();
+        std::uint64_t interval = rate_report_interval.load(std::memory_order_relaxed);
+        std::uint64_t last     = site.reported.load(std::memory_order_relaxed);
+        if(interval == 0 || now - last < interval
+        || !site.reported.compare_exchange_strong(last, now, std::memory_order_relaxed)) return 0;
+        return site.suppressed.exchange(0, std::memory_order_relaxed);
+    }
+}
+}
+#endif
+
+#ifdef SUPPORT_TEE_SINK
+namespace
+{
+namespace myprintf
+{
+    /* Passes the text to several sinks, each of which may select lines by
+     * severity and prefix. The text is formatted once; each segment that
+     * prn flushes is given to every target that wants it. A target that
+     * does not accept all text is retried for at most max_wait_us, after
+     * which the rest of its text is dropped and counted, without waiting,
+     * until it accepts everything it is given again.
+     *
+     * A target sees only whole lines: when a line that it was given part of
+     * continues with text below its severity, the part is ended with a
+     * newline, and when a line begins below its severity, the rest of
+     * that line is not passed on.
+     */
+    struct tee_output
+    {
+        struct target
+        {
+            tinyprintf_tee_target config;
+            std::size_t  prefix_length;
+            std::size_t  matched;           // How much of the prefix the current line matches
+            enum : unsigned char { matching, passing, skipping } state;
+            bool         stalled;
+            bool         partial;           // Part of the current line was passed on
+            std::size_t  dropped;
+        };
+        std::mutex               lock;
+        std::unique_ptr<target[]> targets;
+        unsigned                 count;
+        int                      severity = 0; // Severity of the text being printed
+
+        // Gives text to one target
+        void send(target& t, const char* text, std::size_t length)
+        {
+            std::chrono::steady_clock::time_point deadline;
+            bool waiting = false;
+            while(length > 0)
+            {
+                std::size_t n = t.config.sink.put(t.config.sink.param, text, length);
+                if(n == TINYPRINTF_SINK_ERROR) break;
+                text   += n;
+                length -= n;
+                if(length == 0) break;
+                if(t.stalled || t.config.max_wait_us == 0) break;
+                auto now = std::chrono::steady_clock::now();
+                if(!waiting) { deadline = now + std::chrono::microseconds(t.config.max_wait_us); waiting = true; }
+                else if(now >= deadline) break;
+                std::this_thread::yield();
+            }
+            t.stalled  = length > 0;
+            t.dropped += length;
+        }
+
+        // Gives text to one target, the lines that begin with its prefix
+        void filter(target& t, const char* text, std::size_t length)
+        {
+            while(length > 0)
+            {
+                if(t.state == target::matching)
+                {
+                    while(length > 0 && t.matched < t.prefix_length && *text == t.config.prefix[t.matched])
+                        { ++t.matched; ++text; --length; }
+                    if(t.matched < t.prefix_length)
+                    {
+                        if(length == 0) break;
+                        t.state = target::skipping;
+                    }
+                    else
+                    {
+                        // The prefix was not passed on while it was being matched
+                        send(t, t.config.prefix, t.prefix_length);
+                        t.state = target::passing;
+                    }
+                }
+                const char* newline = static_cast<const char*>(std::memchr(text, '\n', length));
+                std::size_t n = newline ? std::size_t(newline - text + 1) : length;
+                if(t.state == target::passing) send(t, text, n);
+                if(newline) { t.state = t.prefix_length ? target::matching : target::passing; t.matched = 0; }
+                text   += n;
+                length -= n;
+            }
+        }
+
+        void put(const char* text, std::size_t length)
+        {
+            if(length == 0) return;
+            bool line_end = text[length-1] == '\n';
+            for(unsigned n = 0; n < count; ++n)
+            {
+                target& t = targets[n];
+                if(severity < t.config.min_severity)
+                {
+                    // The line that was passed on in part ends here for this target
+                    if(t.partial) { send(t, "\n", 1); t.partial = false; }
+                    // The line continues after this text, but its beginning was not passed on
+                    if(!line_end) t.state = target::skipping;
+                    else { t.state = t.prefix_length ? target::matching : target::passing; t.matched = 0; }
+                    continue;
+                }
+                if(t.config.prefix || t.state == target::skipping) filter(t, text, length); else send(t, text, length);
+                t.partial = t.state == target::passing && !line_end;
+            }
+        }
+
+        int flush()
+        {
+            int ret = 0;
+            for(unsigned n = 0; n < count; ++n)
+            {
+                const tinyprintf_sink& sink = targets[n].config.sink;
+                if(sink.flush && sink.flush(sink.param) != 0) ret = EOF;
+            }
+            return ret;
+        }
+    };
+}
+}
+#endif
+
+#ifdef SUPPORT_ARENA
+namespace
+{
+namespace myprintf
+{
+    /* The text is written straight into the free space of the arena, and
+     * its length comes from the same pass. If it does not fit, a larger
+     * chunk is allocated, the part written so far is moved there, and the
+     * printing goes on; nothing is formatted twice. myvprintf() is given
+     * the address where the text began as param, so the put function
+     * finds the offset of each segment from it.
+     */
+    struct arena_chunk { arena_chunk* next; };
+
+    // The text being printed into an arena by this thread
+    struct arena_text
+    {
+        tinyprintf_arena* arena;
+        const char*       begin;
+        bool              failed;
+    };
+    static thread_local arena_text arena_printing{};
+
+    // Starts a new chunk with room for need bytes, and moves the first keep bytes of the text there
+    static bool arena_grow(tinyprintf_arena* arena, std::size_t keep, std::size_t need)
+    {
+        std::size_t size = std::max(arena->chunk_size ? arena->chunk_size : std::size_t(4096), 2*need);
+        arena_chunk* chunk = static_cast<arena_chunk*>(std::malloc(sizeof(arena_chunk) + size));
+        if(!chunk) return false;
+        char* base = reinterpret_cast<char*>(chunk + 1);
+        if(keep) std::memcpy(base, arena->base + arena->used, keep);
+        chunk->next   = static_cast<arena_chunk*>(arena->chunks);
+        arena->chunks = chunk;
+        arena->base   = base;
+        arena->used   = 0;
+        arena->size   = size;
+        return true;
+    }
+
+    static void arena_put(char* target, const char* source, std::size_t count)
+    {
+        arena_text& text = arena_printing;
+        tinyprintf_arena* arena = text.arena;
+        std::size_t offset = target - text.begin;
+        if(text.failed) return;
+        // One byte is kept for the nul terminator
+        if(arena->size - arena->used <= offset + count && !arena_grow(arena, offset, offset + count + 1))
+        {
+            text.failed = true;
+            return;
+        }
+        std::memcpy(arena->base + arena->used + offset, source, count);
+    }
+}
+}
+#endif
+
+extern "C" {
+#ifdef SUPPORT_OUTPUT_REDIRECT
+    // Where wfunc sends the text, if put is set. See tinyprintf_set_output().
+    static tinyprintf_sink output_sink{};
+#endif
+
+    // Set when the output did not accept all of the text; see output_result()
+    static thread_local bool output_failed = false;
+
+    static void wfunc(char*, const char* src, std::size_t n)
+    {
+    #ifdef SUPPORT_OUTPUT_REDIRECT
+        if(output_sink.put)
+        {
+            TINYPRINTF_PROBE2(sink_entry, output_sink.put, n);
+            std::size_t accepted = output_sink.put(output_sink.param, src, n);
+            TINYPRINTF_PROBE2(sink_return, output_sink.put, accepted);
+            if(accepted != n) output_failed = true;
+            return;
+        }
+    #endif
+        /* PUT HERE YOUR CONSOLE-PRINTING FUNCTION */
+        extern int _write(int fd, const unsigned char* buffer, unsigned num, unsigned mode=0);
+        TINYPRINTF_PROBE2(sink_entry, &_write, n);
+        int accepted = _write(1, (const unsigned char*) src, n);
+        TINYPRINTF_PROBE2(sink_return, &_write, accepted);
+        if(accepted != int(n)) output_failed = true;
+    }
+
+    // Returns ret, or EOF if some text printed since the previous call was not accepted by the output
+    static int output_result(int ret)
+    {
+        if(unlikely(output_failed)) { output_failed = false; return EOF; }
+        return ret;
+    }
+
+    int __wrap_printf(const char* fmt, ...) USED_FUNC;
+    int __wrap_printf(const char* fmt, ...)
+    {
+        std::va_list ap;
+        va_start(ap, fmt);
+        int ret = myprintf::myvprintf(fmt, ap, nullptr, wfunc);
+        va_end(ap);
+        return output_result(ret);
+    }
+
+    int __wrap_vprintf(const char* fmt, std::va_list ap) USED_FUNC;
+    int __wrap_vprintf(const char* fmt, std::va_list ap)
+    {
+        return output_result(myprintf::myvprintf(fmt, ap, nullptr, wfunc));
+    }
+
+#ifdef SUPPORT_FILE_FUNCTIONS
+    int __wrap_vfprintf(std::FILE*, const char* fmt, std::va_list ap) USED_FUNC;
+    int __wrap_vfprintf(std::FILE*, const char* fmt, std::va_list ap)
+    {
+        return output_result(myprintf::myvprintf(fmt, ap, nullptr, wfunc));
+    }
+
+    int __wrap_fprintf(std::FILE*, const char* fmt, ...) USED_FUNC;
+    int __wrap_fprintf(std::FILE*, const char* fmt, ...)
+    {
+        std::va_list ap;
+        va_start(ap, fmt);
+        int ret = myprintf::myvprintf(fmt, ap, nullptr, wfunc);
+        va_end(ap);
+        return output_result(ret);
+    }
+
+  #ifdef SUPPORT_FIPRINTF
+    //int __wrap_fiprintf(std::FILE*, const char* fmt, ...) USED_FUNC;
+    int __wrap_fiprintf(std::FILE*, const char* fmt, ...)
+    {
+        std::va_list ap;
+        va_start(ap, fmt);
+        int ret = myprintf::myvprintf(fmt, ap, nullptr, wfunc);
+        va_end(ap);
+        return output_result(ret);
+    }
+  #endif
+#endif
+
+    int __wrap_vsprintf(char* target, const char* fmt, std::va_list ap) USED_FUNC;
+    int __wrap_vsprintf(char* target, const char* fmt, std::va_list ap)
+    {
+        typedef void (*afunc)(char*,const char*,std::size_t);
+
+        int ret = myprintf::myvprintf(fmt, ap, target, (afunc)std::memcpy);
+        target[ret] = '\0';
+        return ret;
+    }
+
+    int __wrap_sprintf(char* target, const char* fmt, ...) USED_FUNC;
+    int __wrap_sprintf(char* target, const char* fmt, ...)
+    {
+        std::va_list ap;
+        va_start(ap, fmt);
+        int ret = __wrap_vsprintf(target, fmt, ap);
+        va_end(ap);
+        return ret;
+    }
+
+#ifdef SUPPORT_SNPRINTF
+    static thread_local char* snprintf_cap = nullptr;
+    static void memcpy_cap(char* target, const char* source, std::size_t count)
+    {
+        if(target < snprintf_cap)
+            std::memcpy(target, source, std::min(count, std::size_t(snprintf_cap-target)));
+    }
+
+    int __wrap_vsnprintf(char* target, std::size_t limit, const char* fmt, std::va_list ap) USED_FUNC;
+    int __wrap_vsnprintf(char* target, std::size_t limit, const char* fmt, std::va_list ap)
+    {
+        auto oldcap = snprintf_cap; // Backup the global variable to satisfy re-entrancy
+        snprintf_cap = target + limit;
+        int ret = myprintf::myvprintf(fmt, ap, target, memcpy_cap);
+        snprintf_cap = oldcap;      // Restore backup
+        if(limit) target[std::min(limit-1, std::size_t(ret))] = '\0';
+        return ret;
+    }
+
+    int __wrap_snprintf(char* target, std::size_t limit, const char* fmt, ...) USED_FUNC;
+    int __wrap_snprintf(char* target, std::size_t limit, const char* fmt, ...)
+    {
+        std::va_list ap;
+        va_start(ap, fmt);
+        int ret = __wrap_vsnprintf(target, limit, fmt, ap);
+        va_end(ap);
+        return ret;
+    }
+#endif
+
+#ifdef SUPPORT_ASPRINTF
+    static void donothing(char*,const char*,std::size_t){}
+
+    //int __wrap_vasprintf(char** target, const char* fmt, va_list ap1) USED_FUNC;
+    int __wrap_vasprintf(char** target, const char* fmt, va_list ap1)
+    {
+        std::va_list ap2;
+        va_copy(ap2, ap1);
+        int ret = myprintf::myvprintf(fmt, ap2, nullptr, donothing);
+        va_end(ap2);
+        *target = (char *) std::malloc(ret + 1);
+        ret = __wrap_vsprintf(*target, fmt, ap1);
+        return ret;
+    }
+
+    //int __wrap_asprintf(char** target, const char* fmt, ...) USED_FUNC;
+    int __wrap_asprintf(char** target, const char* fmt, ...)
+    {
+        std::va_list ap;
+        va_start(ap, fmt);
+        int ret = __wrap_vasprintf(target, fmt, ap);
+        va_end(ap);
+        return ret;
+    }
+#endif
+
+#ifdef SUPPORT_PRINT_ARRAY
+    static thread_local std::size_t (*array_put)(char*, const char*, std::size_t) = nullptr;
+    static void array_sink_put(char* param, const char* text, std::size_t length)
+    {
+        if(array_put(param, text, length) != length) output_failed = true;
+    }
+
+    /* Prints count integers of elemsize (1, 2, 4 or 8) bytes from data, separated
+     * by separator. fmt_element is a single integer conversion, e.g. "%5d" or "%#x".
+     * If it has no length modifier, the element size is used as the type.
+     * Returns the number of characters printed, or -1 if fmt_element is not supported.
+     * A null sink prints to the same place as printf.
+     * The param of the sink is advanced past the printed text.
+     * Returns EOF if the sink did not accept all of the text.
+     */
+    int tinyprintf_print_array(tinyprintf_sink* sink, const char* fmt_element, const char* separator,
+                               const void* data, std::size_t count, std::size_t elemsize) USED_FUNC;
+    int tinyprintf_print_array(tinyprintf_sink* sink, const char* fmt_element, const char* separator,
+                               const void* data, std::size_t count, std::size_t elemsize)
+    {
+        if(!sink)
+            return output_result(myprintf::print_array<myprintf::default_config>(nullptr, wfunc, fmt_element, separator, data, count, elemsize));
+        auto oldput = array_put; // Backup the global variable to satisfy re-entrancy
+        array_put = sink->put;
+        int ret = myprintf::print_array<myprintf::default_config>(sink->param, array_sink_put, fmt_element, separator, data, count, elemsize);
+        array_put = oldput;      // Restore backup
+        if(ret > 0) sink->param += ret;
+        return output_result(ret);
+    }
+#endif
+
+#ifdef SUPPORT_OUTPUT_REDIRECT
+    /* Makes printf, puts, putchar, fwrite etc. print into sink instead of
+     * _write(). The sink is copied. A null sink restores _write().
+     * Not synchronized with printing: call this while no other thread prints.
+     */
+    void tinyprintf_set_output(const tinyprintf_sink* sink) USED_FUNC;
+    void tinyprintf_set_output(const tinyprintf_sink* sink)
+    {
+        output_sink = sink ? *sink : tinyprintf_sink{};
+    }
+#endif
+
+#ifdef SUPPORT_MMAP_SINK
+    static std::size_t mmap_put(char* param, const char* source, std::size_t count)
+    {
+        return reinterpret_cast<myprintf::mmap_log*>(param)->write(source, count) ? count : TINYPRINTF_SINK_ERROR;
+    }
+
+    static int mmap_flush(char* param)
+    {
+        auto& log = *reinterpret_cast<myprintf::mmap_log*>(param);
+        std::lock_guard<std::mutex> guard(log.lock);
+        return (log.failed || log.sync(MS_ASYNC) != 0) ? EOF : 0;
+    }
+
+    /* Opens path for appending through a memory mapping, and sets sink to print into it.
+     * The file grows in steps of extent bytes. If sync_interval is not zero,
+     * the text is written back with msync(MS_SYNC) after every sync_interval bytes.
+     * fflush() starts writing back with msync(MS_ASYNC).
+     * Use with tinyprintf_set_output(). The sink does not work with
+     * tinyprintf_print_array(), which advances the param.
+     * Returns 0, or -1 with errno set.
+     */
+    int tinyprintf_mmap_open(tinyprintf_sink* sink, const char* path, std::size_t extent, std::size_t sync_interval) USED_FUNC;
+    int tinyprintf_mmap_open(tinyprintf_sink* sink, const char* path, std::size_t extent, std::size_t sync_interval)
+    {
+        int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+        if(fd < 0) return -1;
+        std::unique_ptr<myprintf::mmap_log> log(new myprintf::mmap_log);
+        log->fd   = fd;
+        log->page = sysconf(_SC_PAGESIZE);
+        log->extent = std::max((extent + log->page - 1) & ~(log->page - 1), log->page);
+        log->sync_interval = sync_interval;
+
+        // Continue after the last text in the file. If the program did not close the log,
+        // the trailer tells where the text ends and the preallocated space begins.
+        struct stat st;
+        if(fstat(fd, &st) != 0 || (st.st_size > 0 && !log->map(st.st_size)))
+        {
+            close(fd);
+            return -1;
+        }
+        log->used = log->synced = log->recorded_used();
+
+        *sink = tinyprintf_sink{reinterpret_cast<char*>(log.release()), mmap_put, mmap_flush};
+        return 0;
+    }
+
+    /* Writes back the text, truncates the preallocated space and the trailer, and
+     * closes the log. If the program stops during this, the next open still finds the trailer.
+     * Returns 0, or EOF if any text was lost or the file could not be finished.
+     */
+    int tinyprintf_mmap_close(tinyprintf_sink* sink) USED_FUNC;
+    int tinyprintf_mmap_close(tinyprintf_sink* sink)
+    {
+        std::unique_ptr<myprintf::mmap_log> log(reinterpret_cast<myprintf::mmap_log*>(sink->param));
+        *sink = tinyprintf_sink{};
+        bool ok = !log->failed;
+        if(log->base)
+        {
+            ok = log->sync(MS_SYNC) == 0 && ok;
+            munmap(log->base, log->mapped);
+        }
+        ok = ftruncate(log->fd, log->used) == 0 && ok;
+        ok = fsync(log->fd) == 0 && ok;
+        ok = close(log->fd) == 0 && ok;
+        return ok ? 0 : EOF;
+    }
+#endif
+
+#ifdef SUPPORT_SHM_SINK
+    static std::size_t shm_put(char* param, const char* source, std::size_t count)
+    {
+        return reinterpret_cast<myprintf::shm_log*>(param)->write(source, count);
+    }
+
+    // Publishes the text of the calling thread, and wakes up the consumer if it sleeps
+    static int shm_flush(char* param)
+    {
+        auto& log = *reinterpret_cast<myprintf::shm_log*>(param);
+        log.publish();
+        log.wake();
+        return 0;
+    }
+
+    /* Creates a shared memory area of rings rings of ring_size bytes each
+     * (rounded up to a power of two), and sets sink to print into it.
+     * Each printing thread gets a ring of its own; the last ring is shared
+     * by the threads that exceed rings-1. If name is null, the area is
+     * created with memfd_create(); otherwise with shm_open(), replacing
+     * an existing area of that name. Give tinyprintf_shm_fd() to the
+     * consumer, e.g. over a unix socket or across fork(). Only one
+     * process may print into an area.
+     * policy is TINYPRINTF_SPIN (wait for the consumer when a ring is full)
+     * or TINYPRINTF_DROP (discard the text that does not fit, and the rest
+     * of its line, and count it).
+     * Use with tinyprintf_set_output(). Returns 0, or -1 with errno set.
+     */
+    int tinyprintf_shm_open(tinyprintf_sink* sink, const char* name, std::size_t ring_size, unsigned rings, unsigned policy) USED_FUNC;
+    int tinyprintf_shm_open(tinyprintf_sink* sink, const char* name, std::size_t ring_size, unsigned rings, unsigned policy)
+    {
+        if(!ring_size || !rings || (policy != TINYPRINTF_SPIN && policy != TINYPRINTF_DROP)) { errno = EINVAL; return -1; }
+        std::uint64_t size = sysconf(_SC_PAGESIZE);
+        while(size < ring_size) size *= 2;
+
+        int fd = name ? shm_open(name, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600)
+                      : memfd_create("tinyprintf", MFD_CLOEXEC);
+        if(fd < 0) return -1;
+        std::size_t length = myprintf::shm_area::area_size(rings, size);
+        void* p = MAP_FAILED;
+        if(ftruncate(fd, length) != 0
+        || (p = mmap(nullptr, length, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED)
+        {
+            int e = errno;
+            close(fd);
+            errno = e;
+            return -1;
+        }
+
+        std::unique_ptr<myprintf::shm_log> log(new myprintf::shm_log);
+        log->base   = static_cast<char*>(p);
+        log->size   = length;
+        log->fd     = fd;
+        log->policy = policy;
+        log->wake_bytes = size / 8;
+        log->id     = ++myprintf::shm_last_id;
+
+        // The new file is all zeros, which is the initial state of the atomics
+        auto& h = log->header();
+        h.ring_count = rings;
+        h.ring_size  = size;
+        h.magic.store(myprintf::shm_magic, std::memory_order_release);
+
+        *sink = tinyprintf_sink{reinterpret_cast<char*>(log.release()), shm_put, shm_flush};
+        return 0;
+    }
+
+    // Returns the file descriptor of the area, for passing to the consumer
+    int tinyprintf_shm_fd(const tinyprintf_sink* sink) USED_FUNC;
+    int tinyprintf_shm_fd(const tinyprintf_sink* sink)
+    {
+        return reinterpret_cast<const myprintf::shm_log*>(sink->param)->fd;
+    }
+
+    // Returns the number of bytes that were discarded by TINYPRINTF_DROP
+    std::size_t tinyprintf_shm_dropped(const tinyprintf_sink* sink) USED_FUNC;
+    std::size_t tinyprintf_shm_dropped(const tinyprintf_sink* sink)
+    {
+        auto& log = *reinterpret_cast<const myprintf::shm_log*>(sink->param);
+        std::size_t dropped = 0;
+        for(unsigned n = 0; n < log.header().ring_count; ++n)
+            dropped += log.ring(n).dropped.load(std::memory_order_relaxed);
+        return dropped;
+    }
+
+    /* Wakes up the consumer and releases the sink. The text that the consumer
+     * has not read stays in the area. A named area is not removed; see shm_unlink().
+     * Returns 0, or EOF if some text was dropped.
+     */
+    int tinyprintf_shm_close(tinyprintf_sink* sink) USED_FUNC;
+    int tinyprintf_shm_close(tinyprintf_sink* sink)
+    {
+        int ret = tinyprintf_shm_dropped(sink) ? EOF : 0;
+        std::unique_ptr<myprintf::shm_log> log(reinterpret_cast<myprintf::shm_log*>(sink->param));
+        *sink = tinyprintf_sink{};
+        log->publish();
+        log->finish();
+        log->wake();
+        munmap(log->base, log->size);
+        if(close(log->fd) != 0) ret = EOF;
+        return ret;
+    }
+
+    /* Maps the area of fd for reading with tinyprintf_shm_read().
+     * The file descriptor is not needed afterwards.
+     * Returns 0, or -1 with errno set.
+     */
+    int tinyprintf_shm_attach(tinyprintf_shm_reader* reader, int fd) USED_FUNC;
+    int tinyprintf_shm_attach(tinyprintf_shm_reader* reader, int fd)
+    {
+        struct stat st;
+        if(fstat(fd, &st) != 0) return -1;
+        if(std::size_t(st.st_size) < sizeof(myprintf::shm_header)) { errno = EINVAL; return -1; }
+        void* p = mmap(nullptr, st.st_size, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+        if(p == MAP_FAILED) return -1;
+
+        myprintf::shm_area area{static_cast<char*>(p), std::size_t(st.st_size)};
+        auto& h = area.header();
+        if(h.magic.load(std::memory_order_acquire) != myprintf::shm_magic || !h.ring_count
+        || area.size != myprintf::shm_area::area_size(h.ring_count, h.ring_size))
+        {
+            munmap(p, st.st_size);
+            errno = EINVAL;
+            return -1;
+        }
+        *reader = tinyprintf_shm_reader{area.base, area.size};
+        return 0;
+    }
+
+    /* Calls func for the unread text of each ring, in place in the shared memory,
+     * and then releases it to the printers. A ring's text is given in one or two
+     * parts, and one thread's text is in order. If there is none, waits up to
+     * timeout_ms milliseconds (-1: without a limit) for a printer to wake the
+     * consumer. Printers do that after an eighth of a ring, at fflush() and when
+     * their ring is full, so the timeout also bounds how late the text is read.
+     * Only one thread may read an area. Returns the number of bytes read.
+     */
+    std::size_t tinyprintf_shm_read(tinyprintf_shm_reader* reader, int timeout_ms,
+                                    void (*func)(unsigned ring, const char* text, std::size_t length, void* param), void* param) USED_FUNC;
+    std::size_t tinyprintf_shm_read(tinyprintf_shm_reader* reader, int timeout_ms,
+                                    void (*func)(unsigned ring, const char* text, std::size_t length, void* param), void* param)
+    {
+        myprintf::shm_area area{reader->base, reader->size};
+        auto& h = area.header();
+        auto drain = [&]
+        {
+            std::size_t total = 0;
+            for(unsigned n = 0; n < h.ring_count; ++n)
+            {
+                auto& r = area.ring(n);
+                std::uint64_t tail = r.tail.load(std::memory_order_relaxed), head = r.head.load(std::memory_order_acquire);
+                if(head == tail) continue;
+                std::size_t length = head - tail, offset = tail & (h.ring_size-1);
+                std::size_t first = std::min<std::uint64_t>(length, h.ring_size - offset);
+                func(n, area.text(n) + offset, first, param);
+                if(first < length) func(n, area.text(n), length - first, param);
+                r.tail.store(head, std::memory_order_release);
+                total += length;
+            }
+            return total;
+        };
+
+        std::size_t total = drain();
+        if(total || !timeout_ms) return total;
+
+        std::uint32_t sequence = h.sequence.load(std::memory_order_acquire);
+        h.waiting.store(1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if(!(total = drain()))
+        {
+            timespec timeout{timeout_ms / 1000, timeout_ms % 1000 * 1000000L};
+            myprintf::shm_area::futex(h.sequence, FUTEX_WAIT, sequence, timeout_ms < 0 ? nullptr : &timeout);
+            total = drain();
+        }
+        h.waiting.store(0, std::memory_order_relaxed);
+        return total;
+    }
+
+    // Unmaps the area
+    void tinyprintf_shm_detach(tinyprintf_shm_reader* reader) USED_FUNC;
+    void tinyprintf_shm_detach(tinyprintf_shm_reader* reader)
+    {
+        munmap(reader->base, reader->size);
+        *reader = tinyprintf_shm_reader{};
+    }
+#endif
+
+#ifdef SUPPORT_URING_SINK
+    enum
+    {
+        TINYPRINTF_URING_THREAD = 1 // Use the helper thread even if io_uring is available
+    };
+
+    // Write errors are found later, and reported by fflush()
+    static std::size_t uring_put(char* param, const char* source, std::size_t count)
+    {
+        reinterpret_cast<myprintf::uring_log*>(param)->write(source, count);
+        return count;
+    }
+
+    static int uring_flush(char* param)
+    {
+        return reinterpret_cast<myprintf::uring_log*>(param)->flush();
+    }
+
+    /* Sets sink to print into fd asynchronously, using buffers buffers of
+     * buffer_size bytes each. The text is written when a buffer becomes full,
+     * and when fflush() is called; fflush() waits until all of it is written.
+     * Use with tinyprintf_set_output(). The file descriptor is not closed by
+     * tinyprintf_uring_close().
+     * Returns 0, or -1 with errno set.
+     */
+    int tinyprintf_uring_open(tinyprintf_sink* sink, int fd, std::size_t buffer_size, unsigned buffers, unsigned flags) USED_FUNC;
+    int tinyprintf_uring_open(tinyprintf_sink* sink, int fd, std::size_t buffer_size, unsigned buffers, unsigned flags)
+    {
+        if(fd < 0 || !buffer_size || !buffers) { errno = EINVAL; return -1; }
+        std::unique_ptr<myprintf::uring_log> log(new myprintf::uring_log);
+        log->fd     = fd;
+        log->size   = buffer_size;
+        log->count  = buffers;
+        log->memory.reset(new char[buffer_size * buffers]);
+        log->state.reset(new myprintf::uring_log::buffer[buffers]);
+        log->free_list.reset(new unsigned[buffers]);
+        log->queue.reset(new unsigned[buffers]);
+        log->retry.reset(new unsigned[buffers]);
+        for(unsigned n = 0; n < buffers; ++n) log->free_list[log->num_free++] = buffers-1-n;
+
+        // Explicit offsets can be used unless the file is a stream or appends anyway
+        off_t position = lseek(fd, 0, SEEK_CUR);
+        log->stream = position < 0 || (fcntl(fd, F_GETFL) & O_APPEND);
+        log->offset = log->stream ? 0 : position;
+
+        if((flags & TINYPRINTF_URING_THREAD) || !log->setup_ring())
+        {
+            log->close_ring();
+            log->helper = std::thread(&myprintf::uring_log::run_helper, log.get());
+        }
+        *sink = tinyprintf_sink{reinterpret_cast<char*>(log.release()), uring_put, uring_flush};
+        return 0;
+    }
+
+    /* Writes the remaining text and releases the sink.
+     * Returns 0, or EOF if any text could not be written.
+     */
+    int tinyprintf_uring_close(tinyprintf_sink* sink) USED_FUNC;
+    int tinyprintf_uring_close(tinyprintf_sink* sink)
+    {
+        std::unique_ptr<myprintf::uring_log> log(reinterpret_cast<myprintf::uring_log*>(sink->param));
+        *sink = tinyprintf_sink{};
+        int ret = log->flush();
+        if(log->helper.joinable())
+        {
+            { std::lock_guard<std::mutex> guard(log->lock);
+              log->stopping = true; }
+            log->changed.notify_all();
+            log->helper.join();
+        }
+        else
+        {
+            // Leave the file position after the text, as if write() had been used
+            if(!log->stream) lseek(log->fd, log->offset, SEEK_SET);
+        }
+        log->close_ring();
+        return ret;
+    }
+#endif
+
+#ifdef SUPPORT_BUFFERED_OUTPUT
+    static std::size_t fd_put(char* param, const char* text, std::size_t length)
+    {
+        int fd = int(reinterpret_cast<std::intptr_t>(param));
+        std::size_t done = 0;
+        while(done < length)
+        {
+            ssize_t r = write(fd, text + done, length - done);
+            if(r > 0) { done += r; continue; }
+            if(r < 0 && errno == EINTR) continue;
+            if(r < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+            return TINYPRINTF_SINK_ERROR;
+        }
+        return done;
+    }
+
+    /* Sets sink to write into fd with write(). It accepts as much as write() does,
+     * so with a non-blocking fd, it may accept only part of the text.
+     */
+    void tinyprintf_fd_sink(tinyprintf_sink* sink, int fd) USED_FUNC;
+    void tinyprintf_fd_sink(tinyprintf_sink* sink, int fd)
+    {
+        *sink = tinyprintf_sink{reinterpret_cast<char*>(std::intptr_t(fd)), fd_put, nullptr};
+    }
+
+    static std::size_t buffered_put(char* param, const char* text, std::size_t length)
+    {
+        return reinterpret_cast<myprintf::buffered_output*>(param)->put(text, length);
+    }
+
+    static int buffered_flush(char* param)
+    {
+        return reinterpret_cast<myprintf::buffered_output*>(param)->flush();
+    }
+
+    /* Sets sink to buffer up to capacity bytes of text for target.
+     * policy is TINYPRINTF_SPIN, TINYPRINTF_POLL or TINYPRINTF_DROP, optionally
+     * with TINYPRINTF_LINE_BUFFERED. TINYPRINTF_POLL waits for poll_fd to become
+     * writable. With TINYPRINTF_DROP, text that does not fit is discarded and
+     * counted, the printing function returns EOF, and fflush() returns EOF
+     * with errno = EAGAIN if the target does not take the whole buffer.
+     * Use with tinyprintf_set_output(). Returns 0, or -1 with errno set.
+     */
+    int tinyprintf_buffer_open(tinyprintf_sink* sink, const tinyprintf_sink* target, std::size_t capacity, unsigned policy, int poll_fd) USED_FUNC;
+    int tinyprintf_buffer_open(tinyprintf_sink* sink, const tinyprintf_sink* target, std::size_t capacity, unsigned policy, int poll_fd)
+    {
+        if(!target || !target->put || !capacity) { errno = EINVAL; return -1; }
+        std::unique_ptr<myprintf::buffered_output> out(new myprintf::buffered_output);
+        out->target   = *target;
+        out->data.reset(new char[capacity]);
+        out->capacity = capacity;
+        out->policy   = policy;
+        out->poll_fd  = poll_fd;
+        *sink = tinyprintf_sink{reinterpret_cast<char*>(out.release()), buffered_put, buffered_flush};
+        return 0;
+    }
+
+    // Returns the number of bytes that were discarded by TINYPRINTF_DROP
+    std::size_t tinyprintf_buffer_dropped(const tinyprintf_sink* sink) USED_FUNC;
+    std::size_t tinyprintf_buffer_dropped(const tinyprintf_sink* sink)
+    {
+        auto& out = *reinterpret_cast<myprintf::buffered_output*>(sink->param);
+        std::lock_guard<std::mutex> guard(out.lock);
+        return out.dropped;
+    }
+
+    /* Flushes and releases the sink. The target is not closed.
+     * Returns 0, or EOF if some of the text could not be written.
+     */
+    int tinyprintf_buffer_close(tinyprintf_sink* sink) USED_FUNC;
+    int tinyprintf_buffer_close(tinyprintf_sink* sink)
+    {
+        std::unique_ptr<myprintf::buffered_output> out(reinterpret_cast<myprintf::buffered_output*>(sink->param));
+        *sink = tinyprintf_sink{};
+        int ret = out->flush();
+        return (ret == 0 && out->dropped == 0) ? 0 : EOF;
+    }
+#endif
+
+#ifdef SUPPORT_LZ_SINK
+    static std::size_t lz_put(char* param, const char* text, std::size_t length)
+    {
+        return reinterpret_cast<myprintf::lz_stage*>(param)->put(text, length);
+    }
+
+    static int lz_flush(char* param)
+    {
+        auto& lz = *reinterpret_cast<myprintf::lz_stage*>(param);
+        std::lock_guard<std::mutex> guard(lz.lock);
+        if(lz.target.flush && lz.target.flush(lz.target.param) != 0) lz.failed = true;
+        return lz.failed ? EOF : 0;
+    }
+
+    /* Sets sink to compress the text and write it into target. The text is
+     * collected by a buffered output of block_size bytes, and each block is
+     * compressed on its own when it is full and at fflush(). The target gets
+     * whole frames; it is retried until it accepts all of one, unless it
+     * fails or accepts nothing for a second, after which the sink fails.
+     * Decode the output with tinyprintf_lz_decode().
+     * Use with tinyprintf_set_output(). Returns 0, or -1 with errno set.
+     */
+    int tinyprintf_lz_open(tinyprintf_sink* sink, const tinyprintf_sink* target, std::size_t block_size) USED_FUNC;
+    int tinyprintf_lz_open(tinyprintf_sink* sink, const tinyprintf_sink* target, std::size_t block_size)
+    {
+        if(!target || !target->put || !block_size || block_size >= myprintf::lz_stored) { errno = EINVAL; return -1; }
+        std::unique_ptr<myprintf::lz_stage> lz(new myprintf::lz_stage);
+        lz->target     = *target;
+        lz->block_size = block_size;
+        lz->frame.reset(new unsigned char[myprintf::lz_bound(block_size)]);
+        lz->table.reset(new std::uint32_t[1u << myprintf::lz_hash_bits]);
+        tinyprintf_sink stage{reinterpret_cast<char*>(lz.get()), lz_put, lz_flush};
+        if(tinyprintf_buffer_open(sink, &stage, block_size, TINYPRINTF_SPIN, -1) != 0) return -1;
+        lz.release();
+        return 0;
+    }
+
+    /* Compresses the rest of the text, and releases the sink. The target is not closed.
+     * Returns 0, or EOF if some of the text could not be written.
+     */
+    int tinyprintf_lz_close(tinyprintf_sink* sink) USED_FUNC;
+    int tinyprintf_lz_close(tinyprintf_sink* sink)
+    {
+        auto& out = *reinterpret_cast<myprintf::buffered_output*>(sink->param);
+        std::unique_ptr<myprintf::lz_stage> lz(reinterpret_cast<myprintf::lz_stage*>(out.target.param));
+        return tinyprintf_buffer_close(sink);
+    }
+
+    /* Decodes the frames in data, as written by a tinyprintf_lz_open() sink,
+     * and passes the text to target. Stops at the end of the data, or at the
+     * first frame that is incomplete or damaged, such as the last frame of a
+     * file that was being written when the program stopped, or when target
+     * does not accept the text (it is retried as by the sink). Returns the
+     * number of bytes of data whose frames were passed on; the rest can be
+     * given again with more data. A frame that target failed in the middle
+     * of counts as passed on, so that its beginning is not given twice.
+     */
+    std::size_t tinyprintf_lz_decode(const char* data, std::size_t length, const tinyprintf_sink* target) USED_FUNC;
+    std::size_t tinyprintf_lz_decode(const char* data, std::size_t length, const tinyprintf_sink* target)
+    {
+        using namespace myprintf;
+        const unsigned char* begin = reinterpret_cast<const unsigned char*>(data), *pos = begin, *end = begin + length;
+        std::unique_ptr<unsigned char[]> buffer;
+        std::size_t capacity = 0;
+        while(std::size_t(end - pos) >= lz_header && std::memcmp(pos, "tpz1", 4) == 0)
+        {
+            std::uint32_t stored = lz_read32(pos + 4), size = stored & ~lz_stored, text_length = lz_read32(pos + 8);
+            const unsigned char* body = pos + lz_header, *text = body;
+            if(std::size_t(end - body) < size) break;
+            if(stored & lz_stored)
+            {
+                if(text_length != size) break;
+            }
+            else
+            {
+                if(text_length / 256 > size) break; // More than the coder can expand to
+                if(text_length > capacity) buffer.reset(new unsigned char[capacity = text_length]);
+                if(!lz_decompress(body, body + size, &buffer[0], text_length)) break;
+                text = &buffer[0];
+            }
+            if(lz_checksum(text, text_length) != lz_read32(pos + 12)) break;
+
+            std::size_t done = lz_deliver(*target, reinterpret_cast<const char*>(text), text_length);
+            if(done == 0 && text_length > 0) break;
+            pos = body + size;
+            if(done < text_length) break;
+        }
+        return pos - begin;
+    }
+#endif
+
+    /* Registers handler to be called for %<letter> in engines that have
+     * SUPPORT_CUSTOM_CONVERSIONS. argument is TINYPRINTF_ARG_POINTER or
+     * TINYPRINTF_ARG_INTEGER; the engine reads the argument (also when using
+     * positional parameters) and passes it in conv->arg. The handler prints
+     * with tinyprintf_emit() or tinyprintf_emit_raw(). A null handler removes
+     * the registration. Letters from '@' to '~' that are not standard
+     * conversions or length modifiers can be used. Returns 0, or -1 if the
+     * letter cannot be used, or if printf() is built without
+     * SUPPORT_CUSTOM_CONVERSIONS and would not call the handler.
+     * The table has no locking; register conversions before printing from other threads.
+     */
+    int tinyprintf_register_conversion(char letter, tinyprintf_handler handler, int argument) USED_FUNC;
+    int tinyprintf_register_conversion(char letter, tinyprintf_handler handler, int argument)
+    {
+        if(!myprintf::default_config::SUPPORT_CUSTOM_CONVERSIONS) return -1;
+        return myprintf::set_custom_conversion(letter, handler, argument) ? 0 : -1;
+    }
+
+    // Prints text as the field of the conversion, applying its width, precision and '-' flag
+    void tinyprintf_emit(tinyprintf_conversion* conv, const char* text, std::size_t length) USED_FUNC;
+    void tinyprintf_emit(tinyprintf_conversion* conv, const char* text, std::size_t length)
+    {
+        conv->emit(conv, text, length, true);
+    }
+
+    // Prints text as is
+    void tinyprintf_emit_raw(tinyprintf_conversion* conv, const char* text, std::size_t length) USED_FUNC;
+    void tinyprintf_emit_raw(tinyprintf_conversion* conv, const char* text, std::size_t length)
+    {
+        conv->emit(conv, text, length, false);
+    }
+
+    /* Handlers for tinyprintf_register_conversion(), all taking a pointer:
+     *   tinyprintf_ipv4: 4 bytes in network order, e.g. 192.168.0.1
+     *   tinyprintf_ipv6: 16 bytes in network order, e.g. 2001:db8::1 (same text as inet_ntop)
+     *   tinyprintf_mac:  6 bytes, e.g. 00:1a:2b:3c:4d:5e ('#' flag for uppercase)
+     */
+    static unsigned put_dotted_quad(char* target, const unsigned char* bytes)
+    {
+        unsigned length = 0;
+        for(unsigned n=0; n<4; ++n)
+        {
+            if(n) target[length++] = '.';
+            unsigned width = std::max(1u, myprintf::estimate_uinteger_width(bytes[n], 10));
+            myprintf::put_uint_decimal(target + length, bytes[n], width);
+            length += width;
+        }
+        return length;
+    }
+
+    void tinyprintf_ipv4(tinyprintf_conversion* conv) USED_FUNC;
+    void tinyprintf_ipv4(tinyprintf_conversion* conv)
+    {
+        const unsigned char* bytes = static_cast<const unsigned char*>(conv->arg.pointer);
+        if(!bytes) { tinyprintf_emit(conv, "(null)", 6); return; }
+        char text[15];
+        tinyprintf_emit(conv, text, put_dotted_quad(text, bytes));
+    }
+
+    void tinyprintf_ipv6(tinyprintf_conversion* conv) USED_FUNC;
+    void tinyprintf_ipv6(tinyprintf_conversion* conv)
+    {
+        const unsigned char* bytes = static_cast<const unsigned char*>(conv->arg.pointer);
+        if(!bytes) { tinyprintf_emit(conv, "(null)", 6); return; }
+
+        unsigned words[8];
+        for(unsigned n=0; n<8; ++n) words[n] = bytes[n*2]*256u + bytes[n*2+1];
+
+        // Find the first longest run of at least two zero words, to be printed as "::"
+        unsigned best = 8, best_length = 1;
+        for(unsigned n=0, run=0; n<8; ++n)
+        {
+            run = words[n] ? 0 : run+1;
+            if(run > best_length) { best = n+1-run; best_length = run; }
+        }
+
+        char text[45];
+        unsigned length = 0;
+        for(unsigned n=0; n<8; ++n)
+        {
+            if(n == best) { text[length++] = ':'; n += best_length-1; if(n == 7) text[length++] = ':'; continue; }
+            if(n) text[length++] = ':';
+            // IPv4-compatible and IPv4-mapped addresses end in a dotted quad
+            if(n == 6 && best == 0 && (best_length == 6 || (best_length == 5 && words[5] == 0xFFFF)))
+            {
+                length += put_dotted_quad(text + length, bytes + 12);
+                break;
+            }
+            unsigned width = std::max(1u, myprintf::estimate_uinteger_width(words[n], 16));
+            myprintf::put_uinteger(text + length, words[n], width, 16, 'a'-10);
+            length += width;
+        }
+        tinyprintf_emit(conv, text, length);
+    }
+
+    void tinyprintf_mac(tinyprintf_conversion* conv) USED_FUNC;
+    void tinyprintf_mac(tinyprintf_conversion* conv)
+    {
+        const unsigned char* bytes = static_cast<const unsigned char*>(conv->arg.pointer);
+        if(!bytes) { tinyprintf_emit(conv, "(null)", 6); return; }
+        char text[17];
+        for(unsigned n=0; n<6; ++n)
+        {
+            myprintf::put_uinteger(text + n*3, bytes[n], 2, 16, (conv->flags & TINYPRINTF_ALT) ? 'A'-10 : 'a'-10);
+            if(n < 5) text[n*3+2] = ':';
+        }
+        tinyprintf_emit(conv, text, sizeof(text));
+    }
+
+#ifdef SUPPORT_TIMESTAMP
+    /* The local time of the last timestamp of this thread, as "YYYY-MM-DD HH:MM:SS".
+     * Within the same minute only the seconds are rewritten, so localtime_r()
+     * is called about once per minute per thread.
+     */
+    struct timestamp_cache
+    {
+        std::time_t minute = std::numeric_limits<std::time_t>::max(); // The time at HH:MM:00
+        std::time_t second = std::numeric_limits<std::time_t>::min();
+        char        text[19];
+    };
+    static thread_local timestamp_cache timestamp;
+
+    /* Writes the local time of when (the current time if null) into target
+     * as "YYYY-MM-DD HH:MM:SS", followed by a point and digits (0-9) fraction
+     * digits if digits is not 0. A time that localtime_r() cannot convert is
+     * written as zeros. Returns the length (at most 29).
+     */
+    std::size_t tinyprintf_format_timestamp(char* target, const struct timespec* when, unsigned digits) USED_FUNC;
+    std::size_t tinyprintf_format_timestamp(char* target, const struct timespec* when, unsigned digits)
+    {
+        struct timespec now;
+        if(!when) { clock_gettime(CLOCK_REALTIME, &now); when = &now; }
+
+        timestamp_cache& cache = timestamp;
+        if(when->tv_sec != cache.second)
+        {
+            if(when->tv_sec < cache.minute || when->tv_sec - cache.minute >= 60)
+            {
+                std::tm tm;
+                if(localtime_r(&when->tv_sec, &tm))
+                {
+                    static const unsigned char fields[5][2] = { {0,4}, {5,2}, {8,2}, {11,2}, {14,2} };
+                    const int values[5] = { tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday, tm.tm_hour, tm.tm_min };
+                    std::memcpy(cache.text, "0000-00-00 00:00:", 17);
+                    for(unsigned n=0; n<5; ++n) myprintf::put_uint_decimal(cache.text + fields[n][0], values[n], fields[n][1]);
+                    cache.minute = when->tv_sec - std::min(tm.tm_sec, 59);
+                }
+                else
+                {
+                    // Zeros, which are not kept for the next call
+                    cache = timestamp_cache{};
+                    std::memcpy(cache.text, "0000-00-00 00:00:00", sizeof(cache.text));
+                }
+            }
+            if(cache.minute != std::numeric_limits<std::time_t>::max())
+            {
+                myprintf::put_uint_decimal(cache.text + 17, when->tv_sec - cache.minute, 2);
+                cache.second = when->tv_sec;
+            }
+        }
+        std::memcpy(target, cache.text, sizeof(cache.text));
+        if(!digits) return sizeof(cache.text);
+
+        char fraction[9];
+        myprintf::put_uint_decimal(fraction, when->tv_nsec, 9);
+        digits = std::min(digits, 9u);
+        target[sizeof(cache.text)] = '.';
+        std::memcpy(target + sizeof(cache.text) + 1, fraction, digits);
+        return sizeof(cache.text) + 1 + digits;
+    }
+
+    /* Handler for tinyprintf_register_conversion(), taking a pointer to a
+     * struct timespec, or null for the current time. The precision is the
+     * number of fraction digits (default 6, i.e. microseconds).
+     */
+    void tinyprintf_timestamp(tinyprintf_conversion* conv) USED_FUNC;
+    void tinyprintf_timestamp(tinyprintf_conversion* conv)
+    {
+        char text[29];
+        std::size_t length = tinyprintf_format_timestamp(text, static_cast<const struct timespec*>(conv->arg.pointer),
+                                                         conv->precision == ~0u ? 6 : conv->precision);
+        conv->precision = ~0u; // The precision is not a maximum width here
+        tinyprintf_emit(conv, text, length);
+    }
+#endif
+
+#ifdef SUPPORT_STATUS_LINE
+    static std::size_t wfunc_put(char*, const char* text, std::size_t length)
+    {
+        wfunc(nullptr, text, length);
+        return output_result(0) == EOF ? TINYPRINTF_SINK_ERROR : length;
+    }
+
+    static unsigned ansi_move(char* target, unsigned from, unsigned to)
+    {
+        if(to == 0) { *target = '\r'; return 1; }
+        unsigned distance = (to > from) ? to - from : from - to;
+        unsigned width = std::max(1u, myprintf::estimate_uinteger_width(distance, 10));
+        target[0] = '\x1B';
+        target[1] = '[';
+        myprintf::put_uint_decimal(target + 2, distance, width);
+        target[2 + width] = (to > from) ? 'C' : 'D';
+        return 3 + width;
+    }
+
+    static unsigned ansi_clear(char* target)
+    {
+        std::memcpy(target, "\x1B[K", 3);
+        return 3;
+    }
+
+    // Cursor movement with ANSI (VT100) control sequences
+    extern const tinyprintf_status_hooks tinyprintf_ansi_hooks;
+    const tinyprintf_status_hooks tinyprintf_ansi_hooks = { ansi_move, ansi_clear };
+
+    struct tinyprintf_status;
+
+    /* Creates a status line that prints with format into out (where printf prints, if null).
+     * The line is at most capacity bytes, and must not contain newlines.
+     * Without hooks, the cursor is moved with backspaces and by printing
+     * the same text again, and old text is erased by printing spaces.
+     * Returns null if format has positional parameters, %n, or conversions
+     * other than d i u x X o b c p s a A e E f F g G (with h, l, ll, j, z, t, L).
+     */
+    tinyprintf_status* tinyprintf_status_create(const char* format, unsigned capacity,
+                                                const tinyprintf_sink* out, const tinyprintf_status_hooks* hooks) USED_FUNC;
+    tinyprintf_status* tinyprintf_status_create(const char* format, unsigned capacity,
+                                                const tinyprintf_sink* out, const tinyprintf_status_hooks* hooks)
+    {
+        std::unique_ptr<myprintf::status_line> status(new myprintf::status_line);
+        if(!status->parse(format)) return nullptr;
+        status->capacity = capacity;
+        status->line.reset(new char[capacity + 1]);
+        status->next.reset(new char[capacity + 1]);
+        status->out      = out ? *out : tinyprintf_sink{nullptr, wfunc_put, nullptr};
+        status->hooks    = hooks ? *hooks : tinyprintf_status_hooks{nullptr, nullptr};
+        status->format   = __wrap_snprintf;
+        return reinterpret_cast<tinyprintf_status*>(status.release());
+    }
+
+    /* Prints the line with new arguments, as printf(format, ...) would, by
+     * printing only what differs from the previous update. Returns the number
+     * of bytes printed, including the control sequences, or TINYPRINTF_SINK_ERROR
+     * if the output did not accept them; the next update prints the whole line.
+     */
+    std::size_t tinyprintf_status_vupdate(tinyprintf_status* status, std::va_list ap) USED_FUNC;
+    std::size_t tinyprintf_status_vupdate(tinyprintf_status* status, std::va_list ap)
+    {
+        return reinterpret_cast<myprintf::status_line*>(status)->update(ap);
+    }
+
+    std::size_t tinyprintf_status_update(tinyprintf_status* status, ...) USED_FUNC;
+    std::size_t tinyprintf_status_update(tinyprintf_status* status, ...)
+    {
+        std::va_list ap;
+        va_start(ap, status);
+        std::size_t ret = tinyprintf_status_vupdate(status, ap);
         va_end(ap);
         return ret;
     }
 
-  #ifdef SUPPORT_FIPRINTF
-    //int __wrap_fiprintf(std::FILE*, const char* fmt, ...) USED_FUNC;
-    int __wrap_fiprintf(std::FILE*, const char* fmt, ...)
+    void tinyprintf_status_destroy(tinyprintf_status* status) USED_FUNC;
+    void tinyprintf_status_destroy(tinyprintf_status* status)
+    {
+        delete reinterpret_cast<myprintf::status_line*>(status);
+    }
+#endif
+
+#ifdef SUPPORT_RATE_LIMIT
+    static void rate_report_line(const char* format, unsigned long long suppressed, void*)
+    {
+        __wrap_printf("%llu messages suppressed: %.*s\n", suppressed, int(std::strcspn(format, "\r\n")), format);
+    }
+
+    /* Decides whether a message with fmt is printed, before its arguments are
+     * looked at. With sample, one message in every `rate` is printed; otherwise
+     * `rate` messages per second, and bursts of up to `burst` messages.
+     * Prints the number of suppressed messages first, if it is time to.
+     */
+    static bool rate_pass(const char* fmt, bool sample, unsigned rate, unsigned burst)
+    {
+        myprintf::rate_site* site = myprintf::find_rate_site(fmt);
+        if(unlikely(!site)) return true;
+        bool pass = sample ? (rate <= 1 || site->state.fetch_add(1, std::memory_order_relaxed) % rate == 0)
+                           : myprintf::rate_allow(*site, rate, burst, myprintf::rate_clock());
+        if(!pass) { site->suppressed.fetch_add(1, std::memory_order_relaxed); return false; }
+        if(std::uint64_t suppressed = myprintf::rate_take_report(*site))
+            rate_report_line(fmt, suppressed, nullptr);
+        return true;
+    }
+
+    /* Like printf, but prints at most per_second messages per second with the
+     * same format string (by address), after an initial burst of up to burst
+     * messages. Returns 0 if the message was suppressed.
+     */
+    int tinyprintf_ratelimit_printf(unsigned per_second, unsigned burst, const char* fmt, ...) USED_FUNC;
+    int tinyprintf_ratelimit_printf(unsigned per_second, unsigned burst, const char* fmt, ...)
     {
+        if(!rate_pass(fmt, false, per_second, burst)) return 0;
         std::va_list ap;
         va_start(ap, fmt);
         int ret = myprintf::myvprintf(fmt, ap, nullptr, wfunc);
         va_end(ap);
-        return ret;
+        return output_result(ret);
+    }
+
+    // Like printf, but prints only every nth message with the same format string (by address)
+    int tinyprintf_sample_printf(unsigned n, const char* fmt, ...) USED_FUNC;
+    int tinyprintf_sample_printf(unsigned n, const char* fmt, ...)
+    {
+        if(!rate_pass(fmt, true, n, 0)) return 0;
+        std::va_list ap;
+        va_start(ap, fmt);
+        int ret = myprintf::myvprintf(fmt, ap, nullptr, wfunc);
+        va_end(ap);
+        return output_result(ret);
+    }
+
+  #ifdef SUPPORT_FILE_FUNCTIONS
+    int tinyprintf_ratelimit_fprintf(std::FILE*, unsigned per_second, unsigned burst, const char* fmt, ...) USED_FUNC;
+    int tinyprintf_ratelimit_fprintf(std::FILE*, unsigned per_second, unsigned burst, const char* fmt, ...)
+    {
+        if(!rate_pass(fmt, false, per_second, burst)) return 0;
+        std::va_list ap;
+        va_start(ap, fmt);
+        int ret = myprintf::myvprintf(fmt, ap, nullptr, wfunc);
+        va_end(ap);
+        return output_result(ret);
+    }
+
+    int tinyprintf_sample_fprintf(std::FILE*, unsigned n, const char* fmt, ...) USED_FUNC;
+    int tinyprintf_sample_fprintf(std::FILE*, unsigned n, const char* fmt, ...)
+    {
+        if(!rate_pass(fmt, true, n, 0)) return 0;
+        std::va_list ap;
+        va_start(ap, fmt);
+        int ret = myprintf::myvprintf(fmt, ap, nullptr, wfunc);
+        va_end(ap);
+        return output_result(ret);
     }
   #endif
+
+    /* Sets how often the number of suppressed messages is printed, before the
+     * next message with the same format that is printed. 0 disables it.
+     */
+    void tinyprintf_rate_report_interval(unsigned milliseconds) USED_FUNC;
+    void tinyprintf_rate_report_interval(unsigned milliseconds)
+    {
+        myprintf::rate_report_interval.store(milliseconds * 1000000ull, std::memory_order_relaxed);
+    }
+
+    /* Calls func for every format string that has suppressed messages not yet
+     * reported, or prints them if func is null. Returns the total count.
+     */
+    unsigned long long tinyprintf_rate_report(void (*func)(const char* format, unsigned long long suppressed, void* param),
+                                              void* param) USED_FUNC;
+    unsigned long long tinyprintf_rate_report(void (*func)(const char* format, unsigned long long suppressed, void* param),
+                                              void* param)
+    {
+        unsigned long long total = 0;
+        for(myprintf::rate_site& site: myprintf::rate_sites)
+        {
+            const char* format = site.format.load(std::memory_order_acquire);
+            if(!format) continue;
+            if(unsigned long long suppressed = site.suppressed.exchange(0, std::memory_order_relaxed))
+            {
+                site.reported.store(myprintf::rate_clock(), std::memory_order_relaxed);
+                (func ? func : rate_report_line)(format, suppressed, param);
+                total += suppressed;
+            }
+        }
+        return total;
+    }
 #endif
 
-    int __wrap_vsprintf(char* target, const char* fmt, std::va_list ap) USED_FUNC;
-    int __wrap_vsprintf(char* target, const char* fmt, std::va_list ap)
+#ifdef SUPPORT_TEE_SINK
+    static std::size_t tee_put(char* param, const char* text, std::size_t length)
     {
-        typedef void (*afunc)(char*,const char*,std::size_t);
+        auto& tee = *reinterpret_cast<myprintf::tee_output*>(param);
+        std::lock_guard<std::mutex> guard(tee.lock);
+        tee.put(text, length);
+        return length;
+    }
+    // myvprintf() advances param as it prints, so the tee being printed into is kept here
+    static thread_local myprintf::tee_output* tee_printing = nullptr;
+    static void tee_put_locked(char*, const char* text, std::size_t length)
+    {
+        tee_printing->put(text, length);
+    }
+    static int tee_flush(char* param)
+    {
+        auto& tee = *reinterpret_cast<myprintf::tee_output*>(param);
+        std::lock_guard<std::mutex> guard(tee.lock);
+        return tee.flush();
+    }
 
-        int ret = myprintf::myvprintf(fmt, ap, target, (afunc)std::memcpy);
-        target[ret] = '\0';
+    /* Makes sink pass all text to the count targets, which are copied.
+     * Text printed through the sink itself (e.g. with tinyprintf_set_output())
+     * has severity 0; see tinyprintf_tee_printf(). Returns 0, or -1 if
+     * a target has no put function.
+     */
+    int tinyprintf_tee_open(tinyprintf_sink* sink, const tinyprintf_tee_target* targets, unsigned count) USED_FUNC;
+    int tinyprintf_tee_open(tinyprintf_sink* sink, const tinyprintf_tee_target* targets, unsigned count)
+    {
+        std::unique_ptr<myprintf::tee_output> tee(new myprintf::tee_output);
+        tee->targets.reset(new myprintf::tee_output::target[count]);
+        tee->count = count;
+        for(unsigned n = 0; n < count; ++n)
+        {
+            if(!targets[n].sink.put) return -1;
+            std::size_t prefix_length = targets[n].prefix ? std::strlen(targets[n].prefix) : 0;
+            tee->targets[n] = myprintf::tee_output::target{targets[n], prefix_length, 0,
+                prefix_length ? myprintf::tee_output::target::matching : myprintf::tee_output::target::passing, false, false, 0};
+        }
+        *sink = tinyprintf_sink{reinterpret_cast<char*>(tee.release()), tee_put, tee_flush};
+        return 0;
+    }
+
+    /* Like printf, but prints into a tee sink with the given severity. The text
+     * is formatted once, and no other text is passed to the targets meanwhile.
+     */
+    int tinyprintf_tee_vprintf(const tinyprintf_sink* sink, int severity, const char* fmt, std::va_list ap) USED_FUNC;
+    int tinyprintf_tee_vprintf(const tinyprintf_sink* sink, int severity, const char* fmt, std::va_list ap)
+    {
+        auto& tee = *reinterpret_cast<myprintf::tee_output*>(sink->param);
+        std::lock_guard<std::mutex> guard(tee.lock);
+        tee.severity = severity;
+        tee_printing = &tee;
+        int ret = myprintf::myvprintf(fmt, ap, nullptr, tee_put_locked);
+        tee.severity = 0;
         return ret;
     }
 
-    int __wrap_sprintf(char* target, const char* fmt, ...) USED_FUNC;
-    int __wrap_sprintf(char* target, const char* fmt, ...)
+    int tinyprintf_tee_printf(const tinyprintf_sink* sink, int severity, const char* fmt, ...) USED_FUNC;
+    int tinyprintf_tee_printf(const tinyprintf_sink* sink, int severity, const char* fmt, ...)
     {
         std::va_list ap;
         va_start(ap, fmt);
-        int ret = __wrap_vsprintf(target, fmt, ap);
+        int ret = tinyprintf_tee_vprintf(sink, severity, fmt, ap);
         va_end(ap);
         return ret;
     }
 
-#ifdef SUPPORT_SNPRINTF
-    static thread_local char* snprintf_cap = nullptr;
-    static void memcpy_cap(char* target, const char* source, std::size_t count)
+    // Returns the number of bytes that the target with the given index did not accept
+    std::size_t tinyprintf_tee_dropped(const tinyprintf_sink* sink, unsigned target) USED_FUNC;
+    std::size_t tinyprintf_tee_dropped(const tinyprintf_sink* sink, unsigned target)
     {
-        if(target < snprintf_cap)
-            std::memcpy(target, source, std::min(count, std::size_t(snprintf_cap-target)));
+        auto& tee = *reinterpret_cast<myprintf::tee_output*>(sink->param);
+        std::lock_guard<std::mutex> guard(tee.lock);
+        return tee.targets[target].dropped;
     }
 
-    int __wrap_vsnprintf(char* target, std::size_t limit, const char* fmt, std::va_list ap) USED_FUNC;
-    int __wrap_vsnprintf(char* target, std::size_t limit, const char* fmt, std::va_list ap)
+    /* Flushes the targets and releases the sink. The targets are not closed.
+     * Returns 0, or EOF if a flush failed or some text was dropped.
+     */
+    int tinyprintf_tee_close(tinyprintf_sink* sink) USED_FUNC;
+    int tinyprintf_tee_close(tinyprintf_sink* sink)
     {
-        auto oldcap = snprintf_cap; // Backup the global variable to satisfy re-entrancy
-        snprintf_cap = target + limit;
-        int ret = myprintf::myvprintf(fmt, ap, target, memcpy_cap);
-        snprintf_cap = oldcap;      // Restore backup
-        if(limit) target[std::min(limit-1, std::size_t(ret))] = '\0';
+        std::unique_ptr<myprintf::tee_output> tee(reinterpret_cast<myprintf::tee_output*>(sink->param));
+        *sink = tinyprintf_sink{};
+        int ret = tee->flush();
+        for(unsigned n = 0; n < tee->count; ++n)
+            if(tee->targets[n].dropped) ret = EOF;
         return ret;
     }
+#endif
 
-    int __wrap_snprintf(char* target, std::size_t limit, const char* fmt, ...) USED_FUNC;
-    int __wrap_snprintf(char* target, std::size_t limit, const char* fmt, ...)
+#ifdef SUPPORT_ARENA
+    /* Formats the text into the arena, and returns where it is. The text is
+     * valid until tinyprintf_arena_reset() or tinyprintf_arena_free().
+     */
+    tinyprintf_view tinyprintf_arena_vprintf(tinyprintf_arena* arena, const char* fmt, std::va_list ap) USED_FUNC;
+    tinyprintf_view tinyprintf_arena_vprintf(tinyprintf_arena* arena, const char* fmt, std::va_list ap)
+    {
+        char* begin = arena->base + arena->used;
+        auto old = myprintf::arena_printing; // Backup the global variable to satisfy re-entrancy
+        myprintf::arena_printing = {arena, begin, false};
+        std::size_t length = myprintf::myvprintf(fmt, ap, begin, myprintf::arena_put);
+        bool failed = myprintf::arena_printing.failed;
+        myprintf::arena_printing = old;
+
+        // Text that was not put at all (e.g. "") still needs room for the nul terminator
+        if(!failed && arena->size - arena->used <= length)
+            failed = !myprintf::arena_grow(arena, length, length + 1);
+        if(failed) return {nullptr, 0};
+        char* text = arena->base + arena->used;
+        text[length] = '\0';
+        arena->used += length + 1;
+        return {text, length};
+    }
+
+    tinyprintf_view tinyprintf_arena_printf(tinyprintf_arena* arena, const char* fmt, ...) USED_FUNC;
+    tinyprintf_view tinyprintf_arena_printf(tinyprintf_arena* arena, const char* fmt, ...)
     {
         std::va_list ap;
         va_start(ap, fmt);
-        int ret = __wrap_vsnprintf(target, limit, fmt, ap);
+        tinyprintf_view ret = tinyprintf_arena_vprintf(arena, fmt, ap);
         va_end(ap);
         return ret;
     }
+
+    /* Makes an arena that starts with the caller's buffer (which may be null)
+     * and continues in allocated chunks of chunk_size bytes.
+     */
+    void tinyprintf_arena_init(tinyprintf_arena* arena, void* buffer, std::size_t size, std::size_t chunk_size) USED_FUNC;
+    void tinyprintf_arena_init(tinyprintf_arena* arena, void* buffer, std::size_t size, std::size_t chunk_size)
+    {
+        *arena = tinyprintf_arena{static_cast<char*>(buffer), 0, buffer ? size : 0, chunk_size, nullptr};
+    }
+
+    // Releases all texts, but keeps the newest chunk for the next ones
+    void tinyprintf_arena_reset(tinyprintf_arena* arena) USED_FUNC;
+    void tinyprintf_arena_reset(tinyprintf_arena* arena)
+    {
+        if(auto* newest = static_cast<myprintf::arena_chunk*>(arena->chunks))
+        {
+            for(auto* chunk = newest->next; chunk; )
+            {
+                auto* next = chunk->next;
+                std::free(chunk);
+                chunk = next;
+            }
+            newest->next = nullptr;
+        }
+        arena->used = 0;
+    }
+
+    // Releases all texts and chunks. The arena can still be used.
+    void tinyprintf_arena_free(tinyprintf_arena* arena) USED_FUNC;
+    void tinyprintf_arena_free(tinyprintf_arena* arena)
+    {
+        tinyprintf_arena_reset(arena);
+        std::free(arena->chunks);
+        *arena = tinyprintf_arena{nullptr, 0, 0, arena->chunk_size, nullptr};
+    }
 #endif
 
-#ifdef SUPPORT_ASPRINTF
-    static void donothing(char*,const char*,std::size_t){}
+#ifdef SUPPORT_BATCH_FORMAT
+    /* Batch formatting: tinyprintf_format_batch() calls func once for every
+     * record in [0,count) to measure it, and then once more to write it
+     * into its own slice of the result buffer. func must print the record
+     * with tinyprintf_rprintf(), and must print the same text both times.
+     */
+    struct tinyprintf_record
+    {
+        char*       target; // nullptr while measuring
+        char*       end;
+        std::size_t length;
+    };
+    typedef void (*tinyprintf_record_func)(tinyprintf_record* record, std::size_t index, void* context);
 
-    //int __wrap_vasprintf(char** target, const char* fmt, va_list ap1) USED_FUNC;
-    int __wrap_vasprintf(char** target, const char* fmt, va_list ap1)
+    static thread_local char* batch_cap = nullptr;
+    static void batch_measure(char*,const char*,std::size_t){}
+    static void batch_write(char* target, const char* source, std::size_t count)
     {
-        std::va_list ap2;
-        va_copy(ap2, ap1);
-        int ret = myprintf::myvprintf(fmt, ap2, nullptr, donothing);
-        va_end(ap2);
-        *target = (char *) std::malloc(ret + 1);
-        ret = __wrap_vsprintf(*target, fmt, ap1);
+        if(target < batch_cap)
+            std::memcpy(target, source, std::min(count, std::size_t(batch_cap-target)));
+    }
+
+    int tinyprintf_vrprintf(tinyprintf_record* record, const char* fmt, std::va_list ap) USED_FUNC;
+    int tinyprintf_vrprintf(tinyprintf_record* record, const char* fmt, std::va_list ap)
+    {
+        if(!record->target)
+        {
+            int ret = myprintf::myvprintf(fmt, ap, nullptr, batch_measure);
+            record->length += ret;
+            return ret;
+        }
+        auto oldcap = batch_cap; // Backup the global variable to satisfy re-entrancy
+        batch_cap = record->end;
+        int ret = myprintf::myvprintf(fmt, ap, record->target, batch_write);
+        batch_cap = oldcap;      // Restore backup
+        record->target += std::min(std::size_t(ret), std::size_t(record->end - record->target));
+        record->length += ret;
         return ret;
     }
 
-    //int __wrap_asprintf(char** target, const char* fmt, ...) USED_FUNC;
-    int __wrap_asprintf(char** target, const char* fmt, ...)
+    int tinyprintf_rprintf(tinyprintf_record* record, const char* fmt, ...) USED_FUNC;
+    int tinyprintf_rprintf(tinyprintf_record* record, const char* fmt, ...)
     {
         std::va_list ap;
         va_start(ap, fmt);
-        int ret = __wrap_vasprintf(target, fmt, ap);
+        int ret = tinyprintf_vrprintf(record, fmt, ap);
         va_end(ap);
         return ret;
     }
+
+    /* Returns a malloc'd, nul-terminated buffer holding all records back to back,
+     * and stores its length (excluding the nul) in *length.
+     * threads=0 uses one thread per hardware thread.
+     * Returns nullptr if memory could not be allocated.
+     */
+    char* tinyprintf_format_batch(std::size_t* length, std::size_t count,
+                                  tinyprintf_record_func func, void* context, unsigned threads) USED_FUNC;
+    char* tinyprintf_format_batch(std::size_t* length, std::size_t count,
+                                  tinyprintf_record_func func, void* context, unsigned threads)
+    {
+        constexpr std::size_t block_size = 256; // Records per work item
+        std::uint32_t num_blocks = (count + block_size-1) / block_size;
+
+        if(!threads) threads = std::thread::hardware_concurrency();
+        threads = std::max(1u, std::min(threads, unsigned(num_blocks)));
+
+        // offsets[n+1] first receives the length of record n,
+        // and then the prefix sum turns offsets[n] into its position.
+        std::size_t* offsets = (std::size_t*) std::malloc((count+1) * sizeof(std::size_t));
+        if(!offsets) return nullptr;
+
+        myprintf::parallel_for_blocks(num_blocks, threads, [=](std::uint32_t block)
+        {
+            std::size_t end = std::min(count, (block+1) * block_size);
+            for(std::size_t n = block * block_size; n < end; ++n)
+            {
+                tinyprintf_record record{nullptr, nullptr, 0};
+                func(&record, n, context);
+                offsets[n+1] = record.length;
+            }
+        });
+
+        offsets[0] = 0;
+        for(std::size_t n = 0; n < count; ++n)
+            offsets[n+1] += offsets[n];
+
+        char* result = (char*) std::malloc(offsets[count] + 1);
+        if(result)
+        {
+            myprintf::parallel_for_blocks(num_blocks, threads, [=](std::uint32_t block)
+            {
+                std::size_t end = std::min(count, (block+1) * block_size);
+                for(std::size_t n = block * block_size; n < end; ++n)
+                {
+                    tinyprintf_record record{result + offsets[n], result + offsets[n+1], 0};
+                    func(&record, n, context);
+                }
+            });
+            result[offsets[count]] = '\0';
+            *length = offsets[count];
+        }
+        std::free(offsets);
+        return result;
+    }
 #endif
 
     int __wrap_puts(const char* str) USED_FUNC;
@@ -1227,6 +5802,9 @@ extern "C" {
     //int __wrap_fflush(std::FILE*) USED_FUNC;
     int __wrap_fflush(std::FILE*)
     {
+    #ifdef SUPPORT_OUTPUT_REDIRECT
+        if(output_sink.flush) return output_sink.flush(output_sink.param);
+    #endif
         return 0;
     }
 
@@ -1241,7 +5819,7 @@ extern "C" {
     int __wrap_fwrite(void* buffer, std::size_t a, std::size_t b, std::FILE*)
     {
         wfunc(nullptr, (const char*)buffer, a*b);
-        return a*b;
+        return output_result(0) ? 0 : a*b;
     }
 
     //int __wrap_fputc(int c, std::FILE*) USED_FUNC;
@@ -1249,7 +5827,7 @@ extern "C" {
     {
         char ch = c;
         wfunc(nullptr, &ch, 1);
-        return c;
+        return output_result(c);
     }
 #endif
 
@@ -1258,7 +5836,7 @@ extern "C" {
     {
         char ch = c;
         wfunc(nullptr, &ch, 1);
-        return c;
+        return output_result(c);
     }
 
 }/*extern "C"*/
@@ -0,0 +1,29 @@
+#!/bin/sh
+# Builds printf-c.cc with the size profile (the default) and with
+# OPTIMIZE_FOR_SPEED, and prints the code size and the bench.cc results
+# of both side by side.
+#
+#     ./profiles.sh                  # g++ for the host
+#     CXX=arm-none-eabi-g++ CXXFLAGS="-mcpu=cortex-m4 -mthumb" ./profiles.sh   # sizes only
+set -e
+cd "$(dirname "$0")"
+CXX=${CXX:-g++}
+FLAGS="-std=c++14 -O2 -ffunction-sections -fdata-sections $CXXFLAGS"
+out=$(mktemp -d)
+trap 'rm -rf "$out"' EXIT
+
+for profile in size speed; do
+    define=
+    [ $profile = speed ] && define=-DOPTIMIZE_FOR_SPEED
+    $CXX $FLAGS $define -c printf-c.cc -o "$out/$profile.o"
+    size "$out/$profile.o" | awk -v p=$profile 'NR==2 { printf "%-5s profile: %6d bytes of code, %d bytes of data\n", p, $1, $2+$3 }'
+    if $CXX $FLAGS $define -Wno-cast-function-type bench.cc -o "$out/bench-$profile" 2>/dev/null; then
+        "$out/bench-$profile" > "$out/$profile.txt"
+    fi
+done
+
+[ -f "$out/size.txt" ] && [ -f "$out/speed.txt" ] || exit 0
+echo
+awk 'NR==FNR { size[FNR] = $0; next }
+     FNR==1  { print "      " $0; next }
+             { print "size  " size[FNR]; print "speed " $0 }' "$out/size.txt" "$out/speed.txt"
@@ -1,5 +1,10 @@
 #include <string>
+#include <vector>
+#include <arpa/inet.h>
 #include "printf-c.cc"
+#ifdef SUPPORT_USDT_PROBES
+ #include <link.h>
+#endif
 
 static const char flags[][6] = {
     "",
@@ -29,108 +34,1621 @@ template<typename... Params> static void PrintParams(double arg, Params... rest)
 template<typename... Params> static void PrintParams(const void* arg, Params... rest);
 template<typename... Params> static void PrintParams(const char* arg, Params... rest);
 
-template<typename... Params>
-static void PrintParams(int arg, Params... rest)
+template<typename... Params>
+static void PrintParams(int arg, Params... rest)
+{
+    std::printf(", %d", arg);
+    PrintParams(rest...);
+}
+template<typename... Params>
+static void PrintParams(long arg, Params... rest)
+{
+    std::printf(", %ldl", arg);
+    PrintParams(rest...);
+}
+template<typename... Params>
+static void PrintParams(long long arg, Params... rest)
+{
+    std::printf(", %lldll", arg);
+    PrintParams(rest...);
+}
+template<typename... Params>
+static void PrintParams(long double arg, Params... rest)
+{
+    std::printf(", %#.14Lgl", arg);
+    PrintParams(rest...);
+}
+template<typename... Params>
+static void PrintParams(double arg, Params... rest)
+{
+    std::printf(", %#.14g", arg);
+    PrintParams(rest...);
+}
+template<typename... Params>
+static void PrintParams(const void* arg, Params... rest)
+{
+    if(arg) std::printf(", (const void*)0x%llX", (unsigned long long)arg);
+    else    std::printf(", nullptr");
+    PrintParams(rest...);
+}
+template<typename... Params>
+static void PrintParams(const char* arg, Params... rest)
+{
+    if(arg) std::printf(", \"%s\"", arg);
+    else    std::printf(", nullptr");
+    PrintParams(rest...);
+}
+
+static unsigned tests_failed = 0, tests_run = 0;
+
+template<typename... Params>
+void RunTest(const std::string& formatstr, Params... params)
+{
+    char result1[1024]{};
+    char result2[1024]{};
+    int out1 = __wrap_sprintf(result1, formatstr.c_str(), params...);
+    int out2 = std::sprintf(  result2, formatstr.c_str(), params...);
+    if(out1 != out2 || std::strcmp(result1, result2))
+    {
+        #pragma omp critical
+        {
+        std::printf("printf(\"%s\"", formatstr.c_str());
+        PrintParams(params...);
+        std::printf(");\n");
+        std::printf("- tiny: %d [%s]\n", out1, result1);
+        std::printf("- std:  %d [%s]\n", out2, result2);
+        ++tests_failed;
+        }
+        #pragma omp atomic
+        ++tests_run;
+        return;
+    }
+
+    #pragma omp atomic
+    ++tests_run;
+
+#ifdef SUPPORT_SNPRINTF
+    result1[0]='X'; result1[1]='\0';
+    result2[0]='X'; result2[1]='\0';
+    int limit = out2/2;
+    int out3 = __wrap_snprintf(result1, limit, formatstr.c_str(), params...);
+    int out4 = std::snprintf(  result2, limit, formatstr.c_str(), params...);
+    if(out3 != out4 || std::strcmp(result1, result2))
+    {
+        #pragma omp critical
+        {
+        std::printf("snrintf(..., %d, \"%s\"", limit, formatstr.c_str());
+        PrintParams(params...);
+        std::printf(");\n");
+        std::printf("- tiny: %d [%s]\n", out3, result1);
+        std::printf("- std:  %d [%s]\n", out4, result2);
+        ++tests_failed;
+        }
+    }
+    #pragma omp atomic
+    ++tests_run;
+#endif
+}
+extern "C" {
+int _write(int,const unsigned char*,unsigned num,unsigned) { return num; }
+}
+
+static void TortureTest()
+{
+}
+
+struct FullConfig: myprintf::default_config
+{
+    static constexpr bool SUPPORT_BINARY_FORMAT         = true;
+    static constexpr bool SUPPORT_FLOAT_FORMATS         = true;
+    static constexpr bool SUPPORT_A_FORMAT              = true;
+    static constexpr bool SUPPORT_POSITIONAL_PARAMETERS = true;
+    static constexpr bool SUPPORT_V_FORMAT              = true;
+    static constexpr bool SUPPORT_Q_FORMAT              = true;
+    static constexpr bool SUPPORT_W_LENGTH              = true;
+    static constexpr bool SUPPORT_ESCAPE_FORMATS        = true;
+    static constexpr bool SUPPORT_CUSTOM_CONVERSIONS    = true;
+    static constexpr bool SUPPORT_HEXDUMP_FORMAT        = true;
+};
+struct LeanConfig: myprintf::default_config
+{
+    static constexpr bool SUPPORT_N_FORMAT              = false;
+    static constexpr bool SUPPORT_H_LENGTHS             = false;
+    static constexpr bool SUPPORT_FLOAT_FORMATS         = false;
+    static constexpr bool SUPPORT_POSITIONAL_PARAMETERS = false;
+    static constexpr bool SUPPORT_Q_FORMAT              = false;
+    static constexpr bool SUPPORT_W_LENGTH              = false;
+    static constexpr bool SUPPORT_ESCAPE_FORMATS        = false;
+};
+
+struct W128Config: myprintf::default_config
+{
+    static constexpr bool SUPPORT_W_LENGTH              = true;
+};
+
+struct TableConfig: myprintf::default_config
+{
+    static constexpr bool TABLE_DRIVEN_PARSER           = true;
+    static constexpr bool SUPPORT_POSITIONAL_PARAMETERS = true;
+};
+
+static void ConfigPut(char* target, const char* source, std::size_t count)
+{
+    std::memcpy(target, source, count);
+}
+
+template<typename Config>
+static void ConfigTest(const char* expect, const char* format, ...)
+{
+    char result[1024];
+    std::va_list ap;
+    va_start(ap, format);
+    int length = myprintf::myvprintf<Config>(format, ap, result, ConfigPut);
+    va_end(ap);
+    result[length] = '\0';
+    ++tests_run;
+    if(std::strcmp(result, expect))
+    {
+        std::printf("myvprintf(\"%s\")\n", format);
+        std::printf("- tiny: %d [%s]\n", length, result);
+        std::printf("- std:  [%s]\n", expect);
+        ++tests_failed;
+    }
+}
+
+// Specifiers decoded by the table, and shapes that are left to the state machine
+static void TableParserTests()
+{
+    char expect[1024];
+    for(const char* flag: flags)
+    for(const char* width: {"", "7", "12", "*"})
+    for(const char* precision: {"", ".", ".0", ".3", ".*"})
+    for(const char* length: {"", "hh", "h", "l", "ll", "z"})
+    {
+        std::string format = std::string("<%") + flag + width + precision + length + "d|%" + flag + width + precision + "s>";
+        auto check = [&](auto... args)
+        {
+            __wrap_snprintf(expect, sizeof(expect), format.c_str(), args...); // The state machine
+            ConfigTest<TableConfig>(expect, format.c_str(), args...);
+        };
+        long long value = -1234567;
+        bool star_width = *width == '*', star_precision = std::strcmp(precision, ".*") == 0;
+        if(star_width && star_precision) check(-9, 4, value, -9, 4, "string");
+        else if(star_width)              check(-9, value, -9, "string");
+        else if(star_precision)          check(4, value, 4, "string");
+        else                             check(value, "string");
+    }
+    ConfigTest<TableConfig>("  -42|0x002a|x",   "%5jd|%#06tx|%c", std::intmax_t(-42), std::ptrdiff_t(42), 'x');
+    ConfigTest<TableConfig>("b   a|  3|%",      "%2$-4s%1$s|%3$*4$d|%%", "a", "b", 3, 3);
+    ConfigTest<TableConfig>("   0007|",         "%0*.*ld|%.0d", 7, 4, 7L, 0);
+    ConfigTest<myprintf::default_config>("[] [] [ab]", "[%.s] [%.d] [%.*s]", "abc", 0, -1, "ab");
+}
+
+#if __cplusplus >= 202002L
+// Formatted during compilation
+static_assert(std::string_view(tinyprintf::static_format<"%s v%d.%02d">("app", 2, 7).data()) == "app v2.07");
+static_assert(std::string_view(tinyprintf::static_format<"[%-6x|%+5d|%c|%.2s|%s]">(255u, 42, 'Z', "xyz", nullptr).data()) == "[ff    |  +42|Z|xy|(null)]");
+static_assert(std::string_view(tinyprintf::static_format<"%#o %hhd %%%05lld">(8, 300, -42LL).data()) == "010 44 %-0042");
+
+// Conversions and argument types that static_format() rejects
+constexpr bool StaticRejects(const char* format, myprintf::static_arg arg)
+{
+    return myprintf::static_format_bound<myprintf::default_config>(format, &arg, 1) == ~std::size_t(0);
+}
+static_assert(StaticRejects("%p", myprintf::describe_static_arg<int>()));
+static_assert(StaticRejects("%f", myprintf::describe_static_arg<int>()));
+static_assert(StaticRejects("%d", myprintf::describe_static_arg<char[4]>()));
+static_assert(StaticRejects("%c", myprintf::describe_static_arg<std::nullptr_t>()));
+static_assert(StaticRejects("%s", myprintf::describe_static_arg<long>()));
+static_assert(!StaticRejects("%x", myprintf::describe_static_arg<unsigned char>()));
+
+// Formatted at run time with the same code, compared against the engine
+static void StaticFormatTests()
+{
+    char expect[1024], result[1024];
+    for(const char* flag: flags)
+    for(const char* width: {"", "1", "7", "25"})
+    for(const char* precision: {"", ".", ".0", ".3", ".22"})
+    for(const char* length: {"", "hh", "h", "l", "ll", "z"})
+    for(const char* conversion: {"d", "u", "x", "X", "o"})
+    {
+        std::string format = std::string("<%") + flag + width + precision + length + conversion
+                           + "|%" + flag + width + precision + "s|%" + flag + width + "c>";
+        for(long long value: {0LL, 1LL, -1234567LL, 0x7FFFFFFFFFFFFFFFLL})
+        {
+            __wrap_snprintf(expect, sizeof(expect), format.c_str(), value, "string", 'q');
+            result[myprintf::static_format_to<myprintf::default_config>(result, 0, format.c_str(), value, "string", 'q')] = '\0';
+            ++tests_run;
+            if(std::strcmp(result, expect))
+            {
+                std::printf("static_format(\"%s\", %lld)\n- static: [%s]\n- tiny:   [%s]\n", format.c_str(), value, result, expect);
+                ++tests_failed;
+            }
+        }
+    }
+    std::string text = "0123456789abcdef";
+    auto runtime = tinyprintf::static_format<"%d:%.16s">(std::atoi("-17"), text.c_str() + 4);
+    ++tests_run;
+    if(std::strcmp(runtime.data(), "-17:456789abcdef"))
+    {
+        std::printf("static_format with run-time values: [%s]\n", runtime.data());
+        ++tests_failed;
+    }
+}
+#endif
+
+static void DurationHandler(tinyprintf_conversion* conv)
+{
+    char text[32];
+    long long t = conv->arg.integer;
+    int length = std::sprintf(text, "%lldh%02lldm%02llds", t / 3600, t / 60 % 60, t % 60);
+    tinyprintf_emit(conv, text, length);
+}
+
+static void CustomConversionTests()
+{
+    // The engines under test have custom conversions, whether printf() has them or not
+    ++tests_run;
+    if(!myprintf::set_custom_conversion('I', tinyprintf_ipv4, TINYPRINTF_ARG_POINTER)
+    || !myprintf::set_custom_conversion('K', tinyprintf_ipv6, TINYPRINTF_ARG_POINTER)
+    || !myprintf::set_custom_conversion('M', tinyprintf_mac,  TINYPRINTF_ARG_POINTER)
+    || myprintf::set_custom_conversion('d', DurationHandler, TINYPRINTF_ARG_INTEGER)
+    || myprintf::set_custom_conversion('9', DurationHandler, TINYPRINTF_ARG_INTEGER)
+    || tinyprintf_register_conversion('D', DurationHandler, TINYPRINTF_ARG_INTEGER) != (SUPPORT_CUSTOM_CONVERSIONS ? 0 : -1)
+    || !myprintf::set_custom_conversion('D', DurationHandler, TINYPRINTF_ARG_INTEGER))
+    {
+        std::printf("tinyprintf_register_conversion failed\n");
+        ++tests_failed;
+    }
+
+    static const unsigned char ip[4] = {192,168,1,20}, mac[6] = {0x00,0x1a,0x2b,0xfc,0x4d,0x5e};
+    ConfigTest<FullConfig>("192.168.1.20|  10.0.0.255|1.2.3.4  |192.1", "%I|%12I|%-9I|%.5I", ip, "\x0a\x00\x00\xff", "\x01\x02\x03\x04", ip);
+    ConfigTest<FullConfig>("00:1a:2b:fc:4d:5e 00:1A:2B:FC:4D:5E (null)", "%M %#M %I", mac, mac, (const void*)nullptr);
+    ConfigTest<FullConfig>("[1h01m01s] [    0h00m59s] 4h00m00s 192.168.1.20", "[%D] [%12D] %lD %I", 3661, 59, 14400L, ip);
+    ConfigTest<FullConfig>("192.168.1.20 0h00m05s", "%2$I %1$D", 5, ip);
+    ConfigTest<FullConfig>("Y%",          "%Y%%");
+    if(!SUPPORT_CUSTOM_CONVERSIONS) ConfigTest<myprintf::default_config>("I", "%I", ip);
+
+    static const char* const addresses[] = {
+        "::", "::1", "1::", "2001:db8::1", "2001:db8:0:0:1:0:0:1", "2001:0:0:1::1", "fe80::1:2:3:4",
+        "::ffff:192.0.2.128", "::192.0.2.128", "::ffff:0:1.2.3.4", "1:2:3:4:5:6:7:8", "1:0:3:4:5:6:7:0",
+        "0:0:1:0:0:0:1:0", "ffff:ffff:ffff:ffff:ffff:ffff:ffff:ffff", "::ffff:ffff", "0:1::",
+    };
+    for(const char* address: addresses)
+    {
+        unsigned char bytes[16];
+        char expect[64];
+        inet_pton(AF_INET6, address, bytes);
+        inet_ntop(AF_INET6, bytes, expect, sizeof(expect));
+        ConfigTest<FullConfig>(expect, "%K", bytes);
+    }
+}
+
+static void HexdumpTests()
+{
+    static const unsigned char packet[] = { 0x45,0x00,0x00,0x3c,0x1c,0x46,0x40,0x00 };
+    ConfigTest<FullConfig>("4500003c1c464000|45 00 00 3c|4500:003C", "%*H|%*.1H|%+#*.2H", 8, packet, 4, packet, 4, packet);
+    ConfigTest<FullConfig>("450000 3c1c46 4000|45|(null)|", "%8.3H|%1H|%3H|%H", packet, packet, (const void*)nullptr, packet);
+    ConfigTest<FullConfig>("3c1c 4640 00",        "%2$*1$.2H", 5, packet+3);
+    ConfigTest<LeanConfig>("H",                   "%4H", packet);
+
+    // Long runs in all groupings, against one byte at a time
+    unsigned char data[300];
+    for(unsigned n = 0; n < sizeof(data); ++n) data[n] = (unsigned char)(n * 2654435761u >> 13);
+    for(unsigned length: {15u, 16u, 17u, 31u, 32u, 48u, 63u, 64u, 65u, 300u})
+    for(unsigned group: {0u, 1u, 2u, 3u, 4u, 5u, 8u, 16u, 32u})
+    for(const char* flag: {"", "#", "+"})
+    {
+        char expect[1024], *p = expect;
+        for(unsigned n = 0; n < length; ++n)
+        {
+            p += std::sprintf(p, *flag == '#' ? "%02X" : "%02x", data[n]);
+            if(group && (n+1) % group == 0 && n+1 < length) *p++ = *flag == '+' ? ':' : ' ';
+        }
+        *p = '\0';
+        std::string format = std::string("%") + flag + "*." + std::to_string(group) + "H";
+        ConfigTest<FullConfig>(expect, format.c_str(), length, data);
+    }
+}
+
+static void FixedPointTests()
+{
+    ConfigTest<FullConfig>("12.345|12.3|12.35|12.34500|12345", "%Q|%.1Q|%.2Q|%.5Q|%Q", 12345, 3, 12345, 3, 12345, 3, 12345, 3, 12345, 0);
+    ConfigTest<FullConfig>("-0.005|-0.0|0.0|1234500.0|12.",    "%Q|%.1Q|%.1Q|%.1Q|%#.0Q", -5, 3, -4, 2, 0, 7, 12345, -2, 1234, 2);
+    ConfigTest<FullConfig>("[  -1.50][-001.50][+1.50 ][ 1.50]", "[%7Q][%07Q][%-+6Q][% Q]", -150, 2, -150, 2, 150, 2, 150, 2);
+    ConfigTest<FullConfig>("-9223372036854775.808|0.0|44.0", "%llQ|%.1Q|%.1hhQ", (long long)INT64_MIN, 3, 5, 30, 300, 0);
+    ConfigTest<FullConfig>("3.14 2.7",                    "%2$.*1$Q %4$.1Q", 2, 31416, 4, 27183, 4);
+    ConfigTest<LeanConfig>("Q",                           "%Q", 1, 2);
+
+    // Against a reference that moves the decimal point in the text of the value, and rounds the text
+    char expect[128];
+    for(long long value: {0LL, 1LL, -1LL, 5LL, -49LL, 50LL, 12345LL, -99999LL, 1000000007LL, (long long)INT64_MAX, (long long)INT64_MIN})
+    for(int scale = -3; scale <= 21; ++scale)
+    for(int precision = 0; precision <= 19; precision += 3)
+    {
+        std::string digits = std::to_string(value < 0 ? 0 - (unsigned long long)value : value);
+        if(scale < 0) digits.append(-scale, '0');
+        // At least one digit before the point, and one more than precision after it
+        std::size_t fraction = std::max(scale, 0);
+        if(digits.size() <= fraction) digits.insert(0, fraction + 1 - digits.size(), '0');
+        if(fraction <= unsigned(precision)) { digits.append(precision + 1 - fraction, '0'); fraction = precision + 1; }
+        digits.resize(digits.size() - (fraction - precision - 1));
+        bool up = digits.back() >= '5';
+        digits.pop_back();
+        for(std::size_t n = digits.size(); up; )
+        {
+            if(n == 0) { digits.insert(0, "1"); break; }
+            up = digits[--n] == '9';
+            digits[n] = up ? '0' : digits[n] + 1;
+        }
+        while(digits.size() > unsigned(precision) + 1 && digits[0] == '0') digits.erase(0, 1);
+        if(precision) digits.insert(digits.size() - precision, ".");
+        std::snprintf(expect, sizeof(expect), "%s%s", value < 0 ? "-" : "", digits.c_str());
+        ConfigTest<FullConfig>(expect, "%.*llQ", precision, value, scale);
+    }
+}
+
+#ifdef __SIZEOF_INT128__
+static std::string Int128Digits(unsigned __int128 value, unsigned base, bool upper)
+{
+    const char* digit = upper ? "0123456789ABCDEF" : "0123456789abcdef";
+    std::string digits;
+    do digits.insert(digits.begin(), digit[value % base]);
+    while(value /= base);
+    return digits;
+}
+
+static void Int128Tests()
+{
+    const unsigned __int128 one = 1;
+    for(unsigned __int128 value: { one << 64, (one << 64) - 1, one << 127, ~(one << 127), ~(unsigned __int128)0, one << 100,
+                                   (unsigned __int128)10000000000000000000u, (unsigned __int128)10000000000000000000u * 10000000000000000000u,
+                                   (unsigned __int128)10000000000000000000u * 10000000000000000000u - 1, (unsigned __int128)12345678901234567 * 98765432109876543 })
+    {
+        bool negative = value >> 127;
+        std::string dec = Int128Digits(value, 10, false), sdec = negative ? "-" + Int128Digits(0-value, 10, false) : dec;
+        std::string hex = Int128Digits(value, 16, false), HEX = Int128Digits(value, 16, true), oct = Int128Digits(value, 8, false);
+        ConfigTest<FullConfig>((sdec + "|" + dec).c_str(), "%w128d|%w128u", value, value);
+        ConfigTest<FullConfig>((hex + "|0X" + HEX + "|0" + oct).c_str(), "%w128x|%#w128X|%#w128o", value, value, value);
+        ConfigTest<FullConfig>(Int128Digits(value, 2, false).c_str(), "%w128b", value);
+        ConfigTest<W128Config>(((negative ? "-" : "+") + std::string(45 - sdec.size() + negative, '0') + sdec.substr(negative)).c_str(), "%+.45w128i", value);
+        ConfigTest<W128Config>((std::string(50 - hex.size(), ' ') + hex + "|" + hex + std::string(44 - hex.size(), ' ') + "|").c_str(), "%50w128x|%-44w128x|", value, value);
+        ConfigTest<W128Config>((std::string(negative ? "-" : " ") + std::string(59 - sdec.size() + negative, '0') + sdec.substr(negative)).c_str(), "% 060w128d", value);
+    }
+    ConfigTest<FullConfig>("7 -1 340282366920938463463374607431768211455", "%2$d %1$w128d %1$w128u", ~(unsigned __int128)0, 7);
+    ConfigTest<FullConfig>("-42 12 ff 2a", "%w8d %w16d %w32x %w64x", 214, 65548, 255, (long long)42);
+    ConfigTest<LeanConfig>("w128d", "%w128d", one);
+
+    // Fixed-point decimals, up to the longest text: 39 digits, 19 zeros, '.' and 19 decimals
+    const unsigned __int128 min = one << 127;
+    ConfigTest<FullConfig>("126765060022.8229401496703205376|1.7|0.1701411834604692317|-0.01", "%w128Q|%.1w128Q|%w128Q|%.2w128Q",
+                           one << 100, 19, ~min, 38, ~min, 39, 0 - (unsigned __int128)5, 3);
+    ConfigTest<FullConfig>(("-" + Int128Digits(min, 10, false) + std::string(19, '0') + "." + std::string(19, '0')).c_str(), "%.19w128Q", min, -19);
+    ConfigTest<FullConfig>("7 1.7", "%3$d %1$.1w128Q", ~min, 38, 7);
+
+    unsigned __int128 count = ~(unsigned __int128)0;
+    ConfigTest<FullConfig>("abc", "abc%w128n", &count);
+    ++tests_run;
+    if(count != 3) { std::printf("%%w128n stored the wrong value\n"); ++tests_failed; }
+}
+#endif
+
+static void EscapeTests()
+{
+    ConfigTest<FullConfig>("say \\\"hi\\\"\\n\\\\ \\u0001\\t|(null)|ab", "%Js|%Js|%.2Js", "say \"hi\"\n\\ \x01\t", (const char*)nullptr, "abc");
+    ConfigTest<FullConfig>("plain,\"a,b\",\"say \"\"hi\"\"\",\"x\ny\"", "%Cs,%Cs,%Cs,%Cs", "plain", "a,b", "say \"hi\"", "x\ny");
+    ConfigTest<FullConfig>("[  \\\"q][\"a,\"  ][\\u001f]", "[%5Js][%-6Cs][%Jv]", "\"q", "a,", "\x1f?", std::size_t(1));
+    ConfigTest<FullConfig>("1 [\\\\]", "%2$d [%1$Js]", "\\", 1);
+    ConfigTest<LeanConfig>("Js", "%Js", "x");
+
+    // Escapes at every position around the vector blocks, against one character at a time
+    std::string text, json, csv;
+    for(unsigned n = 0; n < 300; ++n)
+    {
+        static const char specials[] = "\"\\,\r\n\t\b\x01\x1f\x7f\xc3";
+        unsigned r = n * 2654435761u >> 24;
+        text += r % 7 ? char('a' + r % 26) : specials[r % 11];
+    }
+    for(std::size_t length: {0u, 1u, 15u, 16u, 17u, 31u, 32u, 33u, 63u, 64u, 65u, 300u})
+    for(std::size_t begin: {0u, 1u, 7u})
+    {
+        std::string part = text.substr(std::min(begin, text.size()), length);
+        json.clear();
+        csv.clear();
+        bool quote = false;
+        for(unsigned char c: part)
+        {
+            static const char* const controls[] = { "\\b", "\\t", "\\n", "", "\\f", "\\r" };
+            if(c == '"' || c == '\\')           json += std::string("\\") + char(c);
+            else if(c >= 8 && c <= 13 && c != 11) json += controls[c - 8];
+            else if(c < 0x20)                    { char u[8]; std::sprintf(u, "\\u%04x", c); json += u; }
+            else                                 json += char(c);
+            quote |= c == '"' || c == ',' || c == '\r' || c == '\n';
+            csv += char(c);
+            if(c == '"') csv += char(c);
+        }
+        if(quote) csv = '"' + csv + '"';
+        ConfigTest<FullConfig>(json.c_str(), "%Js", part.c_str());
+        ConfigTest<FullConfig>(csv.c_str(), "%Cs", part.c_str());
+    }
+}
+
+static void ConfigTests()
+{
+    // Several engines with different features in the same program
+    ConfigTest<FullConfig>("test 0005",           "%2$s %1$0*3$ld", 5L, "test", 4);
+    ConfigTest<FullConfig>("3.142 1e+100 -0x1p+0", "%.3f %g %a", 3.14159, 1e100, -1.);
+    ConfigTest<FullConfig>("101 -0 +7",           "%b %.0f %+d", 5, -0.25, 7);
+    ConfigTest<FullConfig>("hello|  wor|(nu",     "%v|%5.3v|%.3v", "hello world", std::size_t(5), "world", std::size_t(5), (const char*)nullptr, std::size_t(9));
+    ConfigTest<FullConfig>("abc  |a 7",           "%2$-5v|%2$.1v %1$d", 7, "abcdef", std::size_t(3));
+    ConfigTest<LeanConfig>("f 42 ff",             "%f %d %x", 42, 255);
+    ConfigTest<LeanConfig>("hd $d",               "%hd %1$d");
+    ConfigTest<myprintf::default_config>("-0042", "%05d", -42);
+
+    CustomConversionTests();
+    HexdumpTests();
+    FixedPointTests();
+    EscapeTests();
+#ifdef __SIZEOF_INT128__
+    Int128Tests();
+#endif
+    TableParserTests();
+#if __cplusplus >= 202002L
+    StaticFormatTests();
+#endif
+}
+
+#ifdef SUPPORT_PRINT_ARRAY
+static std::size_t ArrayPut(char* target, const char* source, std::size_t count)
+{
+    std::memcpy(target, source, count);
+    return count;
+}
+
+template<typename T>
+static void ArrayTest(const long long* values, std::size_t count)
+{
+    static const char* const widths[]     = { "", "1", "7", "12", "70" };
+    static const char* const precisions[] = { "", ".0", ".3", ".12" };
+    static const char* const lengths[]    = { "", "hh", "h", "l" };
+    static const char* const separators[] = { "", ",", ", ", "----------------------------------------------------------------------" };
+    static const std::size_t length_sizes[] = { sizeof(T), 1, 2, sizeof(long) };
+    static char result[65536], expect[65536];
+
+    T data[64];
+    for(std::size_t n = 0; n < count; ++n) data[n] = T(values[n]);
+
+    unsigned sepno = 0;
+    for(auto flag: flags)
+    for(auto width: widths)
+    for(auto precision: precisions)
+    for(unsigned l = 0; l < 4; ++l)
+    for(char conv: {'d','u','x','X','o'})
+    {
+        if(l && !SUPPORT_H_LENGTHS && length_sizes[l] < sizeof(int)) continue;
+        std::string spec = std::string(flag) + width + precision;
+        std::string format = "%" + spec + lengths[l] + conv;
+        std::string reference = "%" + spec + "ll" + conv;
+        const char* separator = separators[sepno++ % 4];
+
+        unsigned bits = 8 * std::min(sizeof(T), length_sizes[l]);
+        std::size_t pos = 0;
+        for(std::size_t n = 0; n < count; ++n)
+        {
+            unsigned long long u = (unsigned long long)(long long)data[n];
+            if(bits < 64)
+            {
+                u &= (1ull << bits) - 1;
+                if(conv == 'd') u = (u ^ (1ull << (bits-1))) - (1ull << (bits-1));
+            }
+            pos += std::sprintf(expect + pos, reference.c_str(), u);
+            if(n + 1 < count) pos += std::sprintf(expect + pos, "%s", separator);
+        }
+
+        tinyprintf_sink sink{result, ArrayPut, nullptr};
+        int length = tinyprintf_print_array(&sink, format.c_str(), separator, data, count, sizeof(T));
+        ++tests_run;
+        if(length != int(pos) || sink.param != result + pos || std::memcmp(result, expect, pos))
+        {
+            std::printf("tinyprintf_print_array(\"%s\", \"%s\", %zu x %zu bytes)\n", format.c_str(), separator, count, sizeof(T));
+            std::printf("- tiny: %d [%.*s]\n", length, std::max(length, 0), result);
+            std::printf("- std:  %d [%s]\n", int(pos), expect);
+            ++tests_failed;
+        }
+    }
+}
+
+static void ArrayTests()
+{
+    static const long long values[] = {
+        0, 1, -1, 9, 10, -10, 99, 100, 127, -128, 255, 32767, -32768, 65535,
+        999999, 1000000, -123456789, 2147483647, -2147483647-1, 4294967295ll,
+        1000000000, 999999999, 4294967296ll, -4294967296ll, 1234567890123ll,
+        0x7FFFFFFFFFFFFFFFll, -0x7FFFFFFFFFFFFFFFll-1, 42, -42, 7, 31415926, -271828, 5
+    };
+    const std::size_t count = sizeof(values) / sizeof(*values);
+    for(std::size_t n: {std::size_t(0), std::size_t(1), std::size_t(8), count})
+    {
+        ArrayTest<signed char>(values, n);
+        ArrayTest<short>(values, n);
+        ArrayTest<int>(values, n);
+        ArrayTest<long long>(values, n);
+    }
+
+    int data[3] = {1,2,3};
+    for(const char* bad: {"%s", "%d%d", "x%d", "%*d", "%d ", "d", "%"})
+    {
+        ++tests_run;
+        if(tinyprintf_print_array(nullptr, bad, ",", data, 3, sizeof(int)) != -1)
+        {
+            std::printf("tinyprintf_print_array accepted \"%s\"\n", bad);
+            ++tests_failed;
+        }
+    }
+}
+#endif
+
+#ifdef SUPPORT_BATCH_FORMAT
+static void BatchRecord(tinyprintf_record* record, std::size_t index, void*)
+{
+    tinyprintf_rprintf(record, "%zu,%-*s", index, int(index % 13), "abc");
+    if(index % 7) tinyprintf_rprintf(record, ",%08x", unsigned(index * 2654435761u));
+    tinyprintf_rprintf(record, "\n");
+}
+
+static void BatchTest()
+{
+    for(std::size_t count: {0, 1, 255, 256, 257, 100000})
+    for(unsigned threads: {0, 1, 3})
+    {
+        std::string expect;
+        char line[64];
+        for(std::size_t n = 0; n < count; ++n)
+        {
+            tinyprintf_record record{nullptr, nullptr, 0};
+            BatchRecord(&record, n, nullptr);
+            record = tinyprintf_record{line, line + record.length, 0};
+            BatchRecord(&record, n, nullptr);
+            expect.append(line, record.target);
+        }
+
+        std::size_t length = ~std::size_t();
+        char* result = tinyprintf_format_batch(&length, count, BatchRecord, nullptr, threads);
+        ++tests_run;
+        if(!result || length != expect.size() || expect != result)
+        {
+            std::printf("tinyprintf_format_batch(%zu records, %u threads) differs from sequential formatting\n", count, threads);
+            ++tests_failed;
+        }
+        std::free(result);
+    }
+}
+#endif
+
+#if defined(SUPPORT_MMAP_SINK) || defined(SUPPORT_URING_SINK) || defined(SUPPORT_USDT_PROBES)
+static std::string ReadFile(const char* path)
+{
+    std::string text;
+    if(std::FILE* fp = std::fopen(path, "rb"))
+    {
+        char buffer[4096];
+        for(std::size_t n; (n = std::fread(buffer, 1, sizeof(buffer), fp)) > 0; ) text.append(buffer, n);
+        std::fclose(fp);
+    }
+    return text;
+}
+#endif
+
+#ifdef SUPPORT_USDT_PROBES
+// Finds the probes in the notes of the test program, as a tracer does
+static void UsdtTest()
+{
+    std::string exe = ReadFile("/proc/self/exe"), found;
+    const char* image = exe.data();
+    auto& header = *reinterpret_cast<const ElfW(Ehdr)*>(image);
+    auto sections = reinterpret_cast<const ElfW(Shdr)*>(image + header.e_shoff);
+    const char* names = image + sections[header.e_shstrndx].sh_offset;
+    for(unsigned n = 0; n < header.e_shnum; ++n)
+    {
+        if(std::strcmp(names + sections[n].sh_name, ".note.stapsdt") != 0) continue;
+        for(std::size_t pos = sections[n].sh_offset, end = pos + sections[n].sh_size; pos < end; )
+        {
+            auto& note = *reinterpret_cast<const ElfW(Nhdr)*>(image + pos);
+            const char* desc = image + pos + sizeof(note) + ((note.n_namesz + 3) & ~3u);
+            const char* provider = desc + 3 * sizeof(ElfW(Addr)), *name = provider + std::strlen(provider) + 1;
+            const char* args = name + std::strlen(name) + 1;
+            found += std::string(provider) + ":" + name + "(" + args + ")\n";
+            pos += sizeof(note) + ((note.n_namesz + 3) & ~3u) + ((note.n_descsz + 3) & ~3u);
+        }
+    }
+    for(const char* probe: {"printf_entry", "printf_return", "flush", "sink_entry", "sink_return"})
+    {
+        char expect[64];
+        std::sprintf(expect, "tinyprintf:%s(%zu@", probe, sizeof(void*));
+        ++tests_run;
+        if(found.find(expect) == std::string::npos)
+        {
+            std::printf("usdt: probe %s was not found\n", probe);
+            ++tests_failed;
+        }
+    }
+}
+#endif
+
+#ifdef SUPPORT_MMAP_SINK
+static void MmapTest()
+{
+    char path[] = "/tmp/tinyprintf-mmap-XXXXXX";
+    close(mkstemp(path));
+
+    std::string expect;
+    for(std::size_t sync_interval: {0, 10000})
+    {
+        // Small extents, so the file is grown and remapped many times
+        tinyprintf_sink log;
+        ++tests_run;
+        if(tinyprintf_mmap_open(&log, path, 4096, sync_interval) != 0)
+        {
+            std::printf("tinyprintf_mmap_open(%s) failed\n", path);
+            ++tests_failed;
+            break;
+        }
+        tinyprintf_set_output(&log);
+        for(unsigned n = 0; n < 5000; ++n)
+        {
+            char line[64];
+            std::snprintf(line, sizeof(line), "%u %08x %-*s|\n", n, n * 2654435761u, int(n % 17), "log");
+            expect += line;
+            __wrap_printf("%u %08x %-*s|\n", n, n * 2654435761u, int(n % 17), "log");
+        }
+        __wrap_putchar('+');
+        __wrap_fputs(stdout, "end");
+        __wrap_fflush(stdout);
+        tinyprintf_set_output(nullptr);
+        expect += "+end\r\n";
+
+        ++tests_run;
+        if(tinyprintf_mmap_close(&log) != 0 || ReadFile(path) != expect)
+        {
+            std::printf("mmap log (sync interval %zu) does not contain the printed text\n", sync_interval);
+            ++tests_failed;
+        }
+    }
+
+    // A copy of the file while it is open is what a crash leaves behind: the text,
+    // the preallocated space and the trailer. Text that ends in nul bytes is kept.
+    tinyprintf_sink log;
+    std::string crashed = path + std::string(".crash");
+    tinyprintf_mmap_open(&log, path, 4096, 0);
+    tinyprintf_set_output(&log);
+    __wrap_fwrite((void*)"nul\0\0", 1, 5, stdout);
+    tinyprintf_set_output(nullptr);
+    expect.append("nul\0\0", 5);
+    if(std::FILE* fp = std::fopen(crashed.c_str(), "wb"))
+    {
+        std::string image = ReadFile(path);
+        std::fwrite(image.data(), 1, image.size(), fp);
+        std::fclose(fp);
+    }
+    tinyprintf_mmap_close(&log);
+
+    ++tests_run;
+    if(tinyprintf_mmap_open(&log, crashed.c_str(), 1, 0) != 0 || tinyprintf_mmap_close(&log) != 0
+    || ReadFile(crashed.c_str()) != expect || ReadFile(path) != expect)
+    {
+        std::printf("mmap log was not recovered after an unclean close\n");
+        ++tests_failed;
+    }
+    unlink(crashed.c_str());
+    unlink(path);
+}
+#endif
+
+#ifdef SUPPORT_SHM_SINK
+static void ShmCollect(unsigned ring, const char* text, std::size_t length, void* param)
+{
+    (*static_cast<std::vector<std::string>*>(param))[ring].append(text, length);
+}
+
+static void ShmTest()
+{
+    // Small rings, so that the printers wrap around and wait for the consumer
+    tinyprintf_sink log;
+    tinyprintf_shm_reader reader;
+    ++tests_run;
+    if(tinyprintf_shm_open(&log, nullptr, 4096, 3, TINYPRINTF_SPIN) != 0
+    || tinyprintf_shm_attach(&reader, tinyprintf_shm_fd(&log)) != 0)
+    {
+        std::printf("tinyprintf_shm_open() failed\n");
+        ++tests_failed;
+        return;
+    }
+    tinyprintf_set_output(&log);
+
+    // The threads of the second round take over the rings of the first
+    for(unsigned round = 0; round < 2; ++round)
+    {
+        std::vector<std::string> rings(3), expect(2);
+        std::atomic<bool> finished{false};
+        std::thread consumer([&]
+        {
+            while(tinyprintf_shm_read(&reader, 10, ShmCollect, &rings) || !finished) {}
+        });
+        std::vector<std::thread> printers;
+        for(unsigned t = 0; t < 2; ++t)
+            printers.emplace_back([&expect, round, t]
+            {
+                for(unsigned n = 0; n < 3000; ++n)
+                {
+                    char line[64];
+                    std::snprintf(line, sizeof(line), "%u.%u %u %08x %-*s|\n", round, t, n, n * 2654435761u, int(n % 17), "log");
+                    expect[t] += line;
+                    __wrap_printf("%u.%u %u %08x %-*s|\n", round, t, n, n * 2654435761u, int(n % 17), "log");
+                }
+                __wrap_fflush(stdout);
+            });
+        for(auto& p: printers) p.join();
+        finished = true;
+        consumer.join();
+
+        ++tests_run;
+        std::sort(rings.begin(), rings.end());
+        if(rings[0] != "" || rings[1] != expect[0] || rings[2] != expect[1])
+        {
+            std::printf("shm ring round %u did not deliver each thread's text in order\n", round);
+            ++tests_failed;
+        }
+    }
+    tinyprintf_set_output(nullptr);
+    ++tests_run;
+    if(tinyprintf_shm_close(&log) != 0)
+    {
+        std::printf("tinyprintf_shm_close() failed\n");
+        ++tests_failed;
+    }
+    tinyprintf_shm_detach(&reader);
+
+    // Three of four threads share the last ring; their lines, printed in several segments, are not mixed
+    ++tests_run;
+    if(tinyprintf_shm_open(&log, nullptr, 4096, 2, TINYPRINTF_SPIN) != 0
+    || tinyprintf_shm_attach(&reader, tinyprintf_shm_fd(&log)) != 0)
+    {
+        std::printf("tinyprintf_shm_open() failed\n");
+        ++tests_failed;
+        return;
+    }
+    tinyprintf_set_output(&log);
+    {
+        std::vector<std::string> rings(2), expect(4), got(4);
+        std::atomic<bool> finished{false};
+        std::thread consumer([&]
+        {
+            while(tinyprintf_shm_read(&reader, 10, ShmCollect, &rings) || !finished) {}
+        });
+        std::vector<std::thread> printers;
+        for(unsigned t = 0; t < 4; ++t)
+            printers.emplace_back([&expect, t]
+            {
+                for(unsigned n = 0; n < 2000; ++n)
+                {
+                    char line[64];
+                    std::snprintf(line, sizeof(line), "%u %u %08x %-*s|\n", t, n, n * 2654435761u, int(n % 17), "log");
+                    expect[t] += line;
+                    __wrap_printf("%u %u %08x %-*s|\n", t, n, n * 2654435761u, int(n % 17), "log");
+                }
+                __wrap_fflush(stdout);
+            });
+        for(auto& p: printers) p.join();
+        finished = true;
+        consumer.join();
+
+        for(const std::string& text: rings)
+            for(std::size_t begin = 0, end; (end = text.find('\n', begin)) != std::string::npos; begin = end + 1)
+                got[std::min<std::size_t>(text[begin] - '0', 3)] += text.substr(begin, end + 1 - begin);
+        ++tests_run;
+        if(got != expect)
+        {
+            std::printf("shm ring shared by threads mixed their lines\n");
+            ++tests_failed;
+        }
+    }
+    tinyprintf_set_output(nullptr);
+    tinyprintf_shm_close(&log);
+    tinyprintf_shm_detach(&reader);
+
+    // A thread that prints into two logs in turn keeps one ring in each
+    tinyprintf_sink logs[2];
+    tinyprintf_shm_reader readers[2];
+    ++tests_run;
+    if(tinyprintf_shm_open(&logs[0], nullptr, 4096, 3, TINYPRINTF_SPIN) != 0
+    || tinyprintf_shm_open(&logs[1], nullptr, 4096, 3, TINYPRINTF_SPIN) != 0
+    || tinyprintf_shm_attach(&readers[0], tinyprintf_shm_fd(&logs[0])) != 0
+    || tinyprintf_shm_attach(&readers[1], tinyprintf_shm_fd(&logs[1])) != 0)
+    {
+        std::printf("tinyprintf_shm_open() failed\n");
+        ++tests_failed;
+        return;
+    }
+    std::thread([&]
+    {
+        for(unsigned n = 0; n < 10; ++n)
+            for(auto& l: logs)
+            {
+                tinyprintf_set_output(&l);
+                __wrap_printf("%u\n", n);
+            }
+        tinyprintf_set_output(nullptr);
+    }).join();
+    for(unsigned n = 0; n < 2; ++n)
+    {
+        std::vector<std::string> rings(3);
+        tinyprintf_shm_read(&readers[n], 0, ShmCollect, &rings);
+        ++tests_run;
+        if(rings[0] != "0\n1\n2\n3\n4\n5\n6\n7\n8\n9\n" || rings[1] != "" || rings[2] != "")
+        {
+            std::printf("shm log %u: a thread that printed into another log in between claimed another ring\n", n);
+            ++tests_failed;
+        }
+        tinyprintf_shm_close(&logs[n]);
+        tinyprintf_shm_detach(&readers[n]);
+    }
+
+    // On the shared ring, a thread that leaves a line unfinished and exits does not hold up the others
+    ++tests_run;
+    if(tinyprintf_shm_open(&log, nullptr, 4096, 1, TINYPRINTF_SPIN) != 0
+    || tinyprintf_shm_attach(&reader, tinyprintf_shm_fd(&log)) != 0)
+    {
+        std::printf("tinyprintf_shm_open() failed\n");
+        ++tests_failed;
+        return;
+    }
+    tinyprintf_set_output(&log);
+    {
+        std::vector<std::string> rings(1), closed(1);
+        std::thread([] { __wrap_printf("%s: ", "prompt"); __wrap_fflush(stdout); }).join();
+        std::thread([] { __wrap_printf("%s\n", "line"); }).join();
+        __wrap_printf("%s", "main ");
+        __wrap_printf("%s\n", "line");
+        tinyprintf_set_output(nullptr);
+        tinyprintf_shm_read(&reader, 0, ShmCollect, &rings);
+        tinyprintf_shm_close(&log);
+        tinyprintf_shm_read(&reader, 0, ShmCollect, &closed);
+        ++tests_run;
+        if(rings[0] != "line\nmain line\n" || closed[0] != "prompt: ")
+        {
+            std::printf("shm ring with an unfinished line: [%s] [%s]\n", rings[0].c_str(), closed[0].c_str());
+            ++tests_failed;
+        }
+    }
+    tinyprintf_shm_detach(&reader);
+
+    // Without a consumer, TINYPRINTF_DROP keeps what fits and counts the rest
+    ++tests_run;
+    std::vector<std::string> rings(1);
+    if(tinyprintf_shm_open(&log, nullptr, 4096, 1, TINYPRINTF_DROP) != 0
+    || tinyprintf_shm_attach(&reader, tinyprintf_shm_fd(&log)) != 0)
+    {
+        std::printf("tinyprintf_shm_open() failed\n");
+        ++tests_failed;
+        return;
+    }
+    tinyprintf_set_output(&log);
+    int failed = 0;
+    for(unsigned n = 0; n < 1000; ++n)
+        if(__wrap_printf("%04u\n", n) != 5) ++failed;
+    tinyprintf_set_output(nullptr);
+    std::size_t dropped = tinyprintf_shm_dropped(&log);
+    tinyprintf_shm_read(&reader, 0, ShmCollect, &rings);
+    std::string expect;
+    for(unsigned n = 0; n < 4096/5; ++n)
+    {
+        char line[8];
+        std::snprintf(line, sizeof(line), "%04u\n", n);
+        expect += line;
+    }
+    if(tinyprintf_shm_close(&log) != EOF || rings[0] != expect || dropped != 5000 - expect.size() || failed != int(1000 - 4096/5))
+    {
+        std::printf("shm ring with TINYPRINTF_DROP: kept %zu bytes, dropped %zu, %d prints failed\n", rings[0].size(), dropped, failed);
+        ++tests_failed;
+    }
+    tinyprintf_shm_detach(&reader);
+}
+#endif
+
+#ifdef SUPPORT_URING_SINK
+static void UringTest()
+{
+    char path[] = "/tmp/tinyprintf-uring-XXXXXX";
+    close(mkstemp(path));
+
+    for(unsigned flags: {0u, unsigned(TINYPRINTF_URING_THREAD)})
+    for(int mode: {O_TRUNC, O_APPEND})
+    for(std::size_t buffer_size: {1, 100, 4096})
+    {
+        std::string expect = "head\n";
+        int fd = open(path, O_WRONLY | O_TRUNC | mode);
+        write(fd, expect.data(), expect.size());
+
+        tinyprintf_sink sink;
+        ++tests_run;
+        if(tinyprintf_uring_open(&sink, fd, buffer_size, 4, flags) != 0)
+        {
+            std::printf("tinyprintf_uring_open() failed\n");
+            ++tests_failed;
+            close(fd);
+            continue;
+        }
+        tinyprintf_set_output(&sink);
+        for(unsigned n = 0; n < 3000; ++n)
+        {
+            char line[64];
+            std::snprintf(line, sizeof(line), "%u %08x %-*s|\n", n, n * 2654435761u, int(n % 17), "log");
+            expect += line;
+            __wrap_printf("%u %08x %-*s|\n", n, n * 2654435761u, int(n % 17), "log");
+            if(n % 1000 == 999 && __wrap_fflush(stdout) != 0)
+            {
+                std::printf("fflush() with io_uring sink failed\n");
+                ++tests_failed;
+            }
+        }
+        tinyprintf_set_output(nullptr);
+        ++tests_run;
+        if(tinyprintf_uring_close(&sink) != 0)
+        {
+            std::printf("tinyprintf_uring_close() failed\n");
+            ++tests_failed;
+        }
+        write(fd, "tail\n", 5);
+        expect += "tail\n";
+        close(fd);
+
+        ++tests_run;
+        if(ReadFile(path) != expect)
+        {
+            std::printf("io_uring sink (flags %u, mode %d, buffer %zu) does not write the printed text\n", flags, mode, buffer_size);
+            ++tests_failed;
+        }
+    }
+    unlink(path);
+
+    // A non-blocking pipe that is read slowly: short writes and EAGAIN must not reorder the text
+    for(unsigned flags: {0u, unsigned(TINYPRINTF_URING_THREAD)})
+    {
+        int fds[2];
+        if(pipe(fds) != 0) break;
+        fcntl(fds[1], F_SETFL, fcntl(fds[1], F_GETFL) | O_NONBLOCK);
+        std::string expect, got;
+        std::thread reader([&]
+        {
+            char buffer[3000];
+            for(ssize_t r; (r = read(fds[0], buffer, sizeof(buffer))) > 0; )
+            {
+                got.append(buffer, r);
+                std::this_thread::sleep_for(std::chrono::microseconds(200));
+            }
+        });
+        tinyprintf_sink sink;
+        tinyprintf_uring_open(&sink, fds[1], 16384, 4, flags);
+        tinyprintf_set_output(&sink);
+        for(unsigned n = 0; n < 20000; ++n)
+        {
+            char line[64];
+            std::snprintf(line, sizeof(line), "%u %08x|\n", n, n * 2654435761u);
+            expect += line;
+            __wrap_printf("%u %08x|\n", n, n * 2654435761u);
+        }
+        tinyprintf_set_output(nullptr);
+        ++tests_run;
+        int ret = tinyprintf_uring_close(&sink);
+        close(fds[1]);
+        reader.join();
+        close(fds[0]);
+        if(ret != 0 || got != expect)
+        {
+            std::printf("io_uring sink (flags %u) into a non-blocking pipe: %zu of %zu bytes%s\n",
+                        flags, got.size(), expect.size(), got == expect.substr(0, got.size()) ? "" : ", out of order");
+            ++tests_failed;
+        }
+    }
+}
+#endif
+
+#ifdef SUPPORT_BUFFERED_OUTPUT
+static void BufferedOutputTest()
+{
+    // A full non-blocking pipe: text that does not fit in the buffer is dropped and counted
+    int pipes[2];
+    pipe(pipes);
+    fcntl(pipes[1], F_SETFL, O_NONBLOCK);
+    fcntl(pipes[1], F_SETPIPE_SZ, 4096);
+
+    tinyprintf_sink target, out;
+    tinyprintf_fd_sink(&target, pipes[1]);
+    tinyprintf_buffer_open(&out, &target, 1000, TINYPRINTF_DROP, -1);
+    tinyprintf_set_output(&out);
+    std::size_t attempted = 0;
+    unsigned failures = 0;
+    for(unsigned n = 0; n < 1000; ++n)
+    {
+        int r = __wrap_printf("%u %08x\n", n, n * 2654435761u);
+        attempted += std::snprintf(nullptr, 0, "%u %08x\n", n, n * 2654435761u);
+        if(r == EOF) ++failures;
+    }
+    bool flushed = __wrap_fflush(stdout) == 0;
+    tinyprintf_set_output(nullptr);
+    std::size_t dropped = tinyprintf_buffer_dropped(&out);
+
+    std::size_t received = 0;
+    fcntl(pipes[0], F_SETFL, O_NONBLOCK);
+    char chunk[4096];
+    for(ssize_t r; (r = read(pipes[0], chunk, sizeof(chunk))) > 0; ) received += r;
+    // Now there is room in the pipe for what remained in the buffer
+    bool closed = tinyprintf_buffer_close(&out) == EOF;
+    for(ssize_t r; (r = read(pipes[0], chunk, sizeof(chunk))) > 0; ) received += r;
+    ++tests_run;
+    if(!failures || !dropped || flushed || !closed || received + dropped != attempted)
+    {
+        std::printf("TINYPRINTF_DROP: %u failed prints, %zu+%zu of %zu bytes, fflush %d, close %d\n",
+                    failures, received, dropped, attempted, flushed, closed);
+        ++tests_failed;
+    }
+
+    // Waiting policies lose nothing, while a slow reader empties the pipe
+    for(unsigned policy: {unsigned(TINYPRINTF_SPIN), unsigned(TINYPRINTF_POLL), unsigned(TINYPRINTF_POLL | TINYPRINTF_LINE_BUFFERED)})
+    {
+        std::string expect, result;
+        std::thread reader([&]{
+            for(;;)
+            {
+                pollfd p{pipes[0], POLLIN, 0};
+                if(poll(&p, 1, 1000) <= 0) break;
+                ssize_t r = read(pipes[0], chunk, sizeof(chunk));
+                if(r > 0) result.append(chunk, r);
+            }
+        });
+        tinyprintf_buffer_open(&out, &target, 1000, policy, pipes[1]);
+        tinyprintf_set_output(&out);
+        failures = 0;
+        for(unsigned n = 0; n < 20000; ++n)
+        {
+            char line[64];
+            std::snprintf(line, sizeof(line), "%u %08x %-*s|\n", n, n * 2654435761u, int(n % 17), "log");
+            expect += line;
+            if(__wrap_printf("%u %08x %-*s|\n", n, n * 2654435761u, int(n % 17), "log") == EOF) ++failures;
+        }
+        tinyprintf_set_output(nullptr);
+        if(tinyprintf_buffer_close(&out) != 0) ++failures;
+        reader.join();
+        ++tests_run;
+        if(failures || result != expect)
+        {
+            std::printf("buffered output with policy %u: %u failures, %zu of %zu bytes\n", policy, failures, result.size(), expect.size());
+            ++tests_failed;
+        }
+    }
+    close(pipes[0]);
+    close(pipes[1]);
+
+    // Write errors are reported by the printing functions and by fflush
+    int fd = open("/dev/full", O_WRONLY);
+    tinyprintf_fd_sink(&target, fd);
+    tinyprintf_buffer_open(&out, &target, 16, TINYPRINTF_SPIN, -1);
+    tinyprintf_set_output(&out);
+    int r1 = __wrap_printf("%s", "0123456789abcdefghij");
+    int r2 = __wrap_putchar('x');
+    int r3 = __wrap_fflush(stdout);
+    tinyprintf_set_output(nullptr);
+    int r4 = tinyprintf_buffer_close(&out);
+    close(fd);
+    ++tests_run;
+    if(r1 != EOF || r2 != EOF || r3 != EOF || r4 != EOF)
+    {
+        std::printf("errors from /dev/full were not reported: %d %d %d %d\n", r1, r2, r3, r4);
+        ++tests_failed;
+    }
+}
+#endif
+
+#ifdef SUPPORT_TIMESTAMP
+static void TimestampTest()
 {
-    std::printf(", %d", arg);
-    PrintParams(rest...);
+    // A time zone with daylight saving time, so that the cached minute is crossed by jumps
+    setenv("TZ", "EET-2EEST,M3.5.0/3,M10.5.0/4", 1);
+    tzset();
+    ++tests_run;
+    if(!myprintf::set_custom_conversion('T', tinyprintf_timestamp, TINYPRINTF_ARG_POINTER))
+    {
+        std::printf("%%T could not be registered\n");
+        ++tests_failed;
+    }
+
+    // Minute, hour, day, year and daylight saving time boundaries, and going backwards
+    for(long long start: {1700000000LL, 1704059995LL, 1711846795LL, 1729990795LL, 1699999990LL, 1000000000LL, 1711846795LL})
+    for(unsigned step = 0; step < 200; step += 3)
+    {
+        struct timespec ts{std::time_t(start + step), long(step * 7654321u % 1000000000u)};
+        std::tm tm;
+        localtime_r(&ts.tv_sec, &tm);
+        char date[32], fraction[16], expect[128], result[64];
+        std::strftime(date, sizeof(date), "%Y-%m-%d %H:%M:%S", &tm);
+        std::sprintf(fraction, "%09ld", ts.tv_nsec);
+        for(unsigned digits: {0u, 3u, 6u, 9u})
+        {
+            int length = std::sprintf(expect, "%s%s%.*s", date, digits ? "." : "", int(digits), fraction);
+            std::size_t got = tinyprintf_format_timestamp(result, &ts, digits);
+            result[got] = '\0';
+            ++tests_run;
+            if(got != std::size_t(length) || std::strcmp(result, expect))
+            {
+                std::printf("tinyprintf_format_timestamp(%lld.%09ld, %u)\n- tiny: [%s]\n- std:  [%s]\n", (long long)ts.tv_sec, ts.tv_nsec, digits, result, expect);
+                ++tests_failed;
+            }
+        }
+        std::sprintf(expect, "%s.%.6s [INFO] |%s.%.3s   |", date, fraction, date, fraction);
+        ConfigTest<FullConfig>(expect, "%T [%s] |%-26.3T|", &ts, "INFO", &ts);
+    }
+
+    // A time that localtime_r() cannot convert is written as zeros, and is not cached
+    char result[64];
+    struct timespec far{std::numeric_limits<std::time_t>::max(), 0}, near{1700000000, 0};
+    std::size_t length = tinyprintf_format_timestamp(result, &far, 0);
+    std::string zeros(result, length);
+    length = tinyprintf_format_timestamp(result, &near, 0);
+    ++tests_run;
+    if(zeros != "0000-00-00 00:00:00" || std::string(result, length) != "2023-11-15 00:13:20")
+    {
+        std::printf("tinyprintf_format_timestamp out of range: [%s] then [%.*s]\n", zeros.c_str(), int(length), result);
+        ++tests_failed;
+    }
+    unsetenv("TZ");
+    tzset();
 }
-template<typename... Params>
-static void PrintParams(long arg, Params... rest)
+#endif
+
+#ifdef SUPPORT_STATUS_LINE
+// A one-line terminal that understands backspace, carriage return, and ESC [ n C, ESC [ n D and ESC [ K
+static std::string screen;
+static unsigned screen_cursor = 0;
+static std::size_t ScreenPut(char*, const char* text, std::size_t length)
 {
-    std::printf(", %ldl", arg);
-    PrintParams(rest...);
+    for(std::size_t n = 0; n < length; ++n)
+    {
+        char c = text[n];
+        if(c == '\b') { if(screen_cursor) --screen_cursor; }
+        else if(c == '\r') screen_cursor = 0;
+        else if(c == '\x1B' && n+2 < length && text[n+1] == '[')
+        {
+            unsigned count = 0;
+            for(n += 2; text[n] >= '0' && text[n] <= '9'; ++n) count = count*10 + text[n]-'0';
+            if(text[n] == 'C') screen_cursor += count;
+            if(text[n] == 'D') screen_cursor -= std::min(count, screen_cursor);
+            if(text[n] == 'K') screen.resize(std::min(std::size_t(screen_cursor), screen.size()));
+        }
+        else
+        {
+            if(screen.size() <= screen_cursor) screen.resize(screen_cursor + 1, ' ');
+            screen[screen_cursor++] = c;
+        }
+    }
+    return length;
 }
-template<typename... Params>
-static void PrintParams(long long arg, Params... rest)
+
+// The same terminal behind an output that takes at most 3 bytes at a time, and fails once when screen_fail is set
+static bool screen_fail = false;
+static std::size_t ChoppyScreenPut(char* param, const char* text, std::size_t length)
 {
-    std::printf(", %lldll", arg);
-    PrintParams(rest...);
+    if(screen_fail) { screen_fail = false; return TINYPRINTF_SINK_ERROR; }
+    return ScreenPut(param, text, std::min<std::size_t>(length, 3));
 }
-template<typename... Params>
-static void PrintParams(long double arg, Params... rest)
+
+static void StatusLineTest()
 {
-    std::printf(", %#.14Lgl", arg);
-    PrintParams(rest...);
+    const tinyprintf_sink out{nullptr, ScreenPut, nullptr};
+    ++tests_run;
+    if(tinyprintf_status_create("%2$d", 80, &out, nullptr) || tinyprintf_status_create("%d%n", 80, &out, nullptr))
+    {
+        std::printf("tinyprintf_status_create() accepted positional parameters or %%n\n");
+        ++tests_failed;
+    }
+    for(const char* format: {"%v %d", "%d %H", "%Q", "%Js", "%Cs", "%w128d", "%D", "%y"})
+    {
+        ++tests_run;
+        if(tinyprintf_status_create(format, 80, &out, nullptr))
+        {
+            std::printf("tinyprintf_status_create() accepted \"%s\", whose arguments it cannot store\n", format);
+            ++tests_failed;
+        }
+    }
+
+    const char* format = "%3u%% [%-*s] %s %5lu items, %c %p|%%";
+    static const char* const names[] = { "idle", "downloading", "ok", "" };
+    for(const tinyprintf_status_hooks* hooks: {(const tinyprintf_status_hooks*)nullptr, &tinyprintf_ansi_hooks})
+    for(unsigned capacity: {80u, 30u})
+    {
+        screen.clear();
+        screen_cursor = 0;
+        tinyprintf_status* status = tinyprintf_status_create(format, capacity, &out, hooks);
+        std::size_t total = 0, full = 0;
+        char bar[32];
+        for(unsigned n = 0; n < 400; ++n)
+        {
+            unsigned percent = n / 4, width = 10 + (n / 50) % 3;
+            std::memset(bar, '#', percent / 10);
+            bar[percent / 10] = '\0';
+            const char* name = names[(n / 37) % 4];
+            unsigned long items = n * n / 7;
+            char spinner = "|/-\\"[n % 4];
+            void* pointer = (void*)std::uintptr_t(n / 100);
+
+            char expect[128];
+            full += std::min(unsigned(std::snprintf(expect, sizeof(expect), format, percent, width, bar, name, items, spinner, pointer)), capacity);
+            expect[capacity] = '\0';
+            total += tinyprintf_status_update(status, percent, width, bar, name, items, spinner, pointer);
+
+            std::string shown = screen;
+            while(!shown.empty() && shown.back() == ' ') shown.pop_back();
+            std::string wanted = expect;
+            while(!wanted.empty() && wanted.back() == ' ') wanted.pop_back();
+            ++tests_run;
+            if(shown != wanted)
+            {
+                std::printf("status line update %u (capacity %u, %s)\n- got:  [%s]\n- want: [%s]\n",
+                            n, capacity, hooks ? "ansi" : "no hooks", shown.c_str(), wanted.c_str());
+                ++tests_failed;
+                break;
+            }
+        }
+        // Dumb terminals need the text to be printed again to move the cursor right
+        ++tests_run;
+        if(total > (hooks ? full / 2 : full * 3 / 4))
+        {
+            std::printf("status line printed %zu bytes of %zu\n", total, full);
+            ++tests_failed;
+        }
+        tinyprintf_status_destroy(status);
+    }
+
+    // A field that was cut short at the end of the line is formatted again when it gets more room
+    screen.clear();
+    screen_cursor = 0;
+    tinyprintf_status* status = tinyprintf_status_create("%s|%d", 10, &out, nullptr);
+    tinyprintf_status_update(status, "abcdefgh", 12345);
+    std::string first = screen;
+    tinyprintf_status_update(status, "a", 12345);
+    while(!screen.empty() && screen.back() == ' ') screen.pop_back();
+    ++tests_run;
+    if(first != "abcdefgh|1" || screen != "a|12345")
+    {
+        std::printf("status line with a truncated field: [%s] then [%s]\n", first.c_str(), screen.c_str());
+        ++tests_failed;
+    }
+    tinyprintf_status_destroy(status);
+
+    // Partial writes are continued, and after a failure the whole line is printed again
+    const tinyprintf_sink choppy{nullptr, ChoppyScreenPut, nullptr};
+    for(const tinyprintf_status_hooks* hooks: {(const tinyprintf_status_hooks*)nullptr, &tinyprintf_ansi_hooks})
+    {
+        screen.clear();
+        screen_cursor = 0;
+        status = tinyprintf_status_create("%s: %5u", 40, &choppy, hooks);
+        tinyprintf_status_update(status, "copying files", 100u);
+        screen_fail = true;
+        std::size_t failed = tinyprintf_status_update(status, "copy", 200u);
+        screen = "garbage garbage gar"; // Not longer than the line before
+        screen_cursor = 7;
+        std::size_t printed = tinyprintf_status_update(status, "copy", 300u);
+        while(!screen.empty() && screen.back() == ' ') screen.pop_back();
+        ++tests_run;
+        if(failed != TINYPRINTF_SINK_ERROR || printed == TINYPRINTF_SINK_ERROR || screen != "copy:   300")
+        {
+            std::printf("status line over a choppy output (%s): [%s]\n", hooks ? "ansi" : "no hooks", screen.c_str());
+            ++tests_failed;
+        }
+        tinyprintf_status_destroy(status);
+    }
+
+#ifdef SUPPORT_OUTPUT_REDIRECT
+    // Where printf prints: a failure is reported by the update, not by the next printf
+    status = tinyprintf_status_create("%d", 10, nullptr, nullptr);
+    const tinyprintf_sink broken{nullptr, [](char*, const char*, std::size_t) { return TINYPRINTF_SINK_ERROR; }, nullptr};
+    std::string text;
+    const tinyprintf_sink string_out{reinterpret_cast<char*>(&text), [](char* param, const char* t, std::size_t length)
+                                     { reinterpret_cast<std::string*>(param)->append(t, length); return length; }, nullptr};
+    tinyprintf_set_output(&broken);
+    std::size_t failed = tinyprintf_status_update(status, 5);
+    tinyprintf_set_output(&string_out);
+    int ret = __wrap_printf("%s", "ok");
+    tinyprintf_set_output(nullptr);
+    ++tests_run;
+    if(failed != TINYPRINTF_SINK_ERROR || ret != 2 || text != "ok")
+    {
+        std::printf("status line into a failed printf output: %zu, then printf returned %d\n", failed, ret);
+        ++tests_failed;
+    }
+    tinyprintf_status_destroy(status);
+#endif
 }
-template<typename... Params>
-static void PrintParams(double arg, Params... rest)
+#endif
+
+#ifdef SUPPORT_RATE_LIMIT
+static void RateReport(const char* format, unsigned long long suppressed, void* param)
 {
-    std::printf(", %#.14g", arg);
-    PrintParams(rest...);
+    auto& counts = *static_cast<std::vector<std::pair<const char*, unsigned long long>>*>(param);
+    counts.emplace_back(format, suppressed);
 }
-template<typename... Params>
-static void PrintParams(const void* arg, Params... rest)
+
+static void RateLimitTest()
 {
-    if(arg) std::printf(", (const void*)0x%llX", (unsigned long long)arg);
-    else    std::printf(", nullptr");
-    PrintParams(rest...);
+    // Two arrays with the same text are different call sites
+    static const char sampled[] = "sampled %d\n", limited[] = "limited %d\n", other[] = "limited %d\n";
+    tinyprintf_rate_report_interval(0);
+
+    unsigned printed[3] = {0, 0, 0};
+    for(int n = 0; n < 100; ++n)
+    {
+        printed[0] += tinyprintf_sample_printf(10, sampled, n) > 0;
+        printed[1] += tinyprintf_ratelimit_printf(1, 5, limited, n) > 0;
+        printed[2] += tinyprintf_ratelimit_fprintf(stderr, 1, 20, other, n) > 0;
+    }
+    std::vector<std::pair<const char*, unsigned long long>> counts;
+    unsigned long long total = tinyprintf_rate_report(RateReport, &counts);
+    std::sort(counts.begin(), counts.end());
+    decltype(counts) expect{{sampled, 90}, {limited, 95}, {other, 80}};
+    std::sort(expect.begin(), expect.end());
+
+    ++tests_run;
+    if(printed[0] != 10 || printed[1] != 5 || printed[2] != 20 || total != 265 || counts != expect)
+    {
+        std::printf("rate limit: printed %u %u %u, suppressed %llu in %zu formats\n",
+                    printed[0], printed[1], printed[2], total, counts.size());
+        ++tests_failed;
+    }
+
+    // The count is reported before the next printed message, and then only once
+    tinyprintf_rate_report_interval(1);
+    for(int n = 0; n < 10; ++n) tinyprintf_sample_printf(10, sampled, n);
+    struct timespec pause{0, 20000000}; // Longer than a tick of the coarse clock
+    nanosleep(&pause, nullptr);
+    tinyprintf_sample_printf(10, sampled, 10);
+    counts.clear();
+    ++tests_run;
+    if(tinyprintf_rate_report(RateReport, &counts) != 0)
+    {
+        std::printf("rate limit: suppressed count was not reported with the message\n");
+        ++tests_failed;
+    }
 }
-template<typename... Params>
-static void PrintParams(const char* arg, Params... rest)
+#endif
+
+#if defined(SUPPORT_TEE_SINK) || defined(SUPPORT_LZ_SINK)
+static std::size_t StringPut(char* param, const char* text, std::size_t length)
 {
-    if(arg) std::printf(", \"%s\"", arg);
-    else    std::printf(", nullptr");
-    PrintParams(rest...);
+    reinterpret_cast<std::string*>(param)->append(text, length);
+    return length;
 }
 
-static unsigned tests_failed = 0, tests_run = 0;
+static std::size_t StuckPut(char*, const char*, std::size_t)
+{
+    return 0;
+}
+#endif
 
-template<typename... Params>
-void RunTest(const std::string& formatstr, Params... params)
+#ifdef SUPPORT_TEE_SINK
+static void TeeTest()
 {
-    char result1[1024]{};
-    char result2[1024]{};
-    int out1 = __wrap_sprintf(result1, formatstr.c_str(), params...);
-    int out2 = std::sprintf(  result2, formatstr.c_str(), params...);
-    if(out1 != out2 || std::strcmp(result1, result2))
+    std::string all, errors, warnings;
+    const tinyprintf_tee_target targets[] =
     {
-        #pragma omp critical
-        {
-        std::printf("printf(\"%s\"", formatstr.c_str());
-        PrintParams(params...);
-        std::printf(");\n");
-        std::printf("- tiny: %d [%s]\n", out1, result1);
-        std::printf("- std:  %d [%s]\n", out2, result2);
+        { {reinterpret_cast<char*>(&all),      StringPut, nullptr}, 0, nullptr, 0 },
+        { {reinterpret_cast<char*>(&errors),   StringPut, nullptr}, 0, "ERR",   0 },
+        { {reinterpret_cast<char*>(&warnings), StringPut, nullptr}, 2, nullptr, 0 },
+        { {nullptr,                            StuckPut,  nullptr}, 0, nullptr, 1000 }
+    };
+    tinyprintf_sink tee;
+    tinyprintf_tee_open(&tee, targets, 4);
+
+    auto begin = std::chrono::steady_clock::now();
+    tinyprintf_tee_printf(&tee, 1, "%s%s: disk %d\n", "E", "RR", 1);    // The prefix is split between segments
+    tinyprintf_tee_printf(&tee, 3, "%s: disk %d\nERR", "WARN", 2);     // The prefix continues on the next line
+    tinyprintf_tee_printf(&tee, 1, "OR: %s\nER\n", "x");                // Ends the line "ERR" for the warnings
+    tinyprintf_tee_printf(&tee, 0, "ERR: partial");
+    tinyprintf_tee_printf(&tee, 2, " line\nERR: %u\n", 5u);            // The warnings do not get the rest of the line
+    for(int n = 0; n < 1000; ++n) tinyprintf_tee_printf(&tee, 0, "%d\n", n);
+    double waited = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+
+    std::string numbers;
+    for(int n = 0; n < 1000; ++n) numbers += std::to_string(n) + "\n";
+    ++tests_run;
+    if(all != "ERR: disk 1\nWARN: disk 2\nERROR: x\nER\nERR: partial line\nERR: 5\n" + numbers
+    || errors != "ERR: disk 1\nERROR: x\nERR: partial line\nERR: 5\n"
+    || warnings != "WARN: disk 2\nERR\nERR: 5\n")
+    {
+        std::printf("tee: got\n- all: [%s]\n- errors: [%s]\n- warnings: [%s]\n",
+                    all.substr(0, 80).c_str(), errors.c_str(), warnings.c_str());
+        ++tests_failed;
+    }
+    // The stuck target was waited for only once
+    ++tests_run;
+    if(tinyprintf_tee_dropped(&tee, 3) != all.size() || tinyprintf_tee_dropped(&tee, 0) != 0 || waited > 0.5)
+    {
+        std::printf("tee: dropped %zu of %zu, took %.3f s\n", tinyprintf_tee_dropped(&tee, 3), all.size(), waited);
         ++tests_failed;
-        }
-        #pragma omp atomic
-        ++tests_run;
-        return;
     }
 
-    #pragma omp atomic
+    // Text printed through the tee sink as output has severity 0
+    tinyprintf_set_output(&tee);
+    __wrap_printf("ERR%d\n", 6);
+    tinyprintf_set_output(nullptr);
     ++tests_run;
+    if(errors.substr(errors.size() - 5) != "ERR6\n" || warnings.back() != '\n' || tinyprintf_tee_close(&tee) != EOF)
+    {
+        std::printf("tee: output redirect\n");
+        ++tests_failed;
+    }
+}
+#endif
 
-#ifdef SUPPORT_SNPRINTF
-    result1[0]='X'; result1[1]='\0';
-    result2[0]='X'; result2[1]='\0';
-    int limit = out2/2;
-    int out3 = __wrap_snprintf(result1, limit, formatstr.c_str(), params...);
-    int out4 = std::snprintf(  result2, limit, formatstr.c_str(), params...);
-    if(out3 != out4 || std::strcmp(result1, result2))
+#ifdef SUPPORT_ARENA
+static void ArenaTest()
+{
+    char stack[64];
+    tinyprintf_arena arena;
+    tinyprintf_arena_init(&arena, stack, sizeof(stack), 256);
+
+    // Texts that fit, one that is moved to a new chunk in the middle, one longer than a chunk, and ""
+    std::vector<tinyprintf_view> views;
+    std::vector<std::string> expect;
+    std::string long_text(1000, 'x');
+    for(int n = 0; n < 40; ++n)
     {
-        #pragma omp critical
-        {
-        std::printf("snrintf(..., %d, \"%s\"", limit, formatstr.c_str());
-        PrintParams(params...);
-        std::printf(");\n");
-        std::printf("- tiny: %d [%s]\n", out3, result1);
-        std::printf("- std:  %d [%s]\n", out4, result2);
+        char text[1100];
+        int length = std::sprintf(text, "%d:%s:%s", n, n == 7 ? long_text.c_str() : "message", n == 3 ? "" : "end");
+        views.push_back(n == 9 ? tinyprintf_arena_printf(&arena, "%s", "")
+                               : tinyprintf_arena_printf(&arena, "%d:%s:%s", n, n == 7 ? long_text.c_str() : "message", n == 3 ? "" : "end"));
+        expect.push_back(n == 9 ? std::string() : std::string(text, length));
+    }
+    ++tests_run;
+    bool ok = views[0].data == stack;
+    for(std::size_t n = 0; n < views.size(); ++n)
+        ok = ok && views[n].data && views[n].length == expect[n].size() && std::strcmp(views[n].data, expect[n].c_str()) == 0;
+    if(!ok || arena.chunks == nullptr)
+    {
+        std::printf("arena: texts were not kept\n");
         ++tests_failed;
-        }
     }
-    #pragma omp atomic
+
+    // Reset keeps the newest chunk
+    void* newest = arena.chunks;
+    tinyprintf_arena_reset(&arena);
+    tinyprintf_view view = tinyprintf_arena_printf(&arena, "%05d", 42);
     ++tests_run;
-#endif
+    if(arena.chunks != newest || view.data != arena.base || std::strcmp(view.data, "00042") != 0)
+    {
+        std::printf("arena: reset\n");
+        ++tests_failed;
+    }
+    tinyprintf_arena_free(&arena);
+
+    // A zero-initialized arena allocates on first use
+    tinyprintf_arena empty{};
+    view = tinyprintf_arena_printf(&empty, "%s-%d", "x", 1);
+    ++tests_run;
+    if(!view.data || std::strcmp(view.data, "x-1") != 0 || empty.size != 4096)
+    {
+        std::printf("arena: zero-initialized\n");
+        ++tests_failed;
+    }
+    tinyprintf_arena_free(&empty);
 }
-extern "C" {
-int _write(int,const unsigned char*,unsigned,unsigned) { return 0; }
+#endif
+
+#ifdef SUPPORT_LZ_SINK
+// Accepts *param bytes, and then fails
+static std::size_t LimitedPut(char* param, const char*, std::size_t length)
+{
+    std::size_t& limit = *reinterpret_cast<std::size_t*>(param);
+    if(limit == 0) return TINYPRINTF_SINK_ERROR;
+    length = std::min(length, limit);
+    limit -= length;
+    return length;
 }
 
-static void TortureTest()
+static void LzTest()
 {
+    // Repetitive log lines, text that does not repeat, and long runs of one byte
+    std::string expect, output;
+    tinyprintf_sink target{reinterpret_cast<char*>(&output), StringPut, nullptr}, lz;
+    tinyprintf_lz_open(&lz, &target, 4096);
+    tinyprintf_set_output(&lz);
+    unsigned seed = 1;
+    for(unsigned n = 0; n < 3000; ++n)
+    {
+        char line[300];
+        int length;
+        if(n % 500 == 7)
+        {
+            length = 0;
+            for(unsigned k = 0; k < 200; ++k) length += std::sprintf(line + length, "%c", 33 + (seed = seed * 1103515245u + 12345u) / 65536 % 94);
+            __wrap_printf("%s", line);
+        }
+        else if(n % 500 == 9)
+        {
+            length = std::sprintf(line, "%0*d\n", int(n % 290), 0);
+            __wrap_printf("%0*d\n", int(n % 290), 0);
+        }
+        else
+        {
+            length = std::sprintf(line, "%u request %08x served in %u us from cache node %u\n", n, n * 2654435761u, n % 97, n % 4);
+            __wrap_printf("%u request %08x served in %u us from cache node %u\n", n, n * 2654435761u, n % 97, n % 4);
+        }
+        expect.append(line, length);
+        if(n == 1000) __wrap_fflush(stdout); // A short block
+    }
+    tinyprintf_set_output(nullptr);
+    ++tests_run;
+    std::string decoded;
+    tinyprintf_sink decode{reinterpret_cast<char*>(&decoded), StringPut, nullptr};
+    if(tinyprintf_lz_close(&lz) != 0 || tinyprintf_lz_decode(output.data(), output.size(), &decode) != output.size()
+    || decoded != expect || output.size() * 2 > expect.size())
+    {
+        std::printf("lz: %zu bytes of text became %zu bytes, decoded to %zu bytes%s\n",
+                    expect.size(), output.size(), decoded.size(), decoded == expect ? "" : " that differ");
+        ++tests_failed;
+    }
+
+    // A file that ends in a partial or damaged frame is decoded up to that frame
+    std::size_t last = output.rfind("tpz1");
+    for(std::size_t cut: {last, last + 1, last + 15, last + 16, output.size() - 1})
+    {
+        decoded.clear();
+        std::size_t used = tinyprintf_lz_decode(output.data(), cut, &decode);
+        ++tests_run;
+        if(used != last || expect.compare(0, decoded.size(), decoded) != 0 || decoded.size() + 4096 < expect.size())
+        {
+            std::printf("lz: a file cut at %zu of %zu decoded %zu bytes\n", cut, output.size(), used);
+            ++tests_failed;
+        }
+    }
+    std::string damaged = output;
+    damaged[last + 20] ^= 1;
+    decoded.clear();
+    ++tests_run;
+    if(tinyprintf_lz_decode(damaged.data(), damaged.size(), &decode) != last)
+    {
+        std::printf("lz: a damaged frame was decoded\n");
+        ++tests_failed;
+    }
+
+    // A target that fails within a frame: the frame is not given again
+    std::size_t first = output.find("tpz1", 4), limit = 100;
+    tinyprintf_sink failing{reinterpret_cast<char*>(&limit), LimitedPut, nullptr};
+    ++tests_run;
+    if(tinyprintf_lz_decode(output.data(), output.size(), &failing) != first || limit != 0)
+    {
+        std::printf("lz: decoding into a target that failed within the first frame\n");
+        ++tests_failed;
+    }
+    ++tests_run;
+    if(tinyprintf_lz_decode(output.data(), output.size(), &failing) != 0)
+    {
+        std::printf("lz: decoding into a target that accepted nothing passed on a frame\n");
+        ++tests_failed;
+    }
+
+    // A target that never accepts anything makes the sink fail instead of waiting forever
+    tinyprintf_sink stuck{nullptr, StuckPut, nullptr};
+    tinyprintf_lz_open(&lz, &stuck, 4096);
+    tinyprintf_set_output(&lz);
+    __wrap_printf("%s\n", "lost");
+    tinyprintf_set_output(nullptr);
+    ++tests_run;
+    if(tinyprintf_lz_close(&lz) != EOF)
+    {
+        std::printf("lz: a stuck target did not make the sink fail\n");
+        ++tests_failed;
+    }
 }
+#endif
 
 int main()
 {
@@ -144,6 +1662,10 @@ int main()
     RunTest("%.2s%.2s", "test","more");
     RunTest("%4.02d", 3);
     RunTest("%4.02s", "test");
+    { static const char unterminated[4] = {'q','u','i','x'};
+    RunTest("%.4s", unterminated);
+    RunTest("%-6.2s", unterminated);
+    }
     { char a = 'A', b = 'B', c = 'C';
     RunTest("%c%c%c", a,b,c);
     RunTest("%d%d%d", a,b,c);
@@ -190,11 +1712,6 @@ int main()
                     //        Libc prints "(null)", we print "(nu"
                     return;
                 }
-                if((format_char=='e' || format_char=='f' || format_char=='g' || format_char=='a'
-                 || format_char=='E' || format_char=='F' || format_char=='G' || format_char=='A') && wid2>=16)
-                {
-                    return;
-                }
 
                 std::string start("%");
                 std::string w1p = wid1mode ?     std::to_string(wid1) : std::string{};
@@ -374,10 +1891,113 @@ int main()
                 test("f", 9.9999);
                 test("f", 0.);
                 test("f", 1./0.);
+                test("f", -0.);
+                test("f", 0.125);
+                test("f", 2.5);
+                test("f", 1e300);
+                test("f", 5e-324);
+                test("e", 5e-324);
+                test("e", 1.7976931348623157e308);
+                test("e", -0.);
+                test("g", 0.);
+                test("g", 0.0001);
+                test("g", 123456.);
+                test("g", 1234567.);
+                test("g", 1.5e-42);
+                test("g", 99.995);
+                test("E", 1.5e42);
+                test("F", 0./0.);
+                test("G", 1e-5);
+                if(SUPPORT_A_FORMAT)
+                {
+                    test("a", 0.);
+                    test("a", 1.5);
+                    test("a", 0.1);
+                    test("a", 5e-324);
+                    test("a", 0x1.fffp0);
+                    test("A", 1.7976931348623157e308);
+                    test("A", -1./0.);
+                }
+                if(SUPPORT_LONG_DOUBLE)
+                {
+                    if(SUPPORT_A_FORMAT)
+                    {
+                        test("La", 0xF.8p0L);
+                        test("LA", 0.1L);
+                    }
+                    test("Le", 1.5e4000L);
+                    test("Lf", 0.1L);
+                    test("Lf", 1e-4940L);
+                    test("Lg", 1.18973149535723176502e4932L);
+                }
             }
         }
     }
 
+    std::printf("Running configuration test...\n");
+    ConfigTests();
+
+#ifdef SUPPORT_PRINT_ARRAY
+    std::printf("Running array test...\n");
+    ArrayTests();
+#endif
+#ifdef SUPPORT_BATCH_FORMAT
+    std::printf("Running batch test...\n");
+    BatchTest();
+#endif
+
+#ifdef SUPPORT_USDT_PROBES
+    std::printf("Running static tracepoint test...\n");
+    UsdtTest();
+#endif
+#ifdef SUPPORT_MMAP_SINK
+    std::printf("Running mmap log test...\n");
+    MmapTest();
+#endif
+
+#ifdef SUPPORT_SHM_SINK
+    std::printf("Running shared memory ring test...\n");
+    ShmTest();
+#endif
+#ifdef SUPPORT_URING_SINK
+    std::printf("Running io_uring sink test...\n");
+    UringTest();
+#endif
+
+#ifdef SUPPORT_BUFFERED_OUTPUT
+    std::printf("Running buffered output test...\n");
+    BufferedOutputTest();
+#endif
+
+#ifdef SUPPORT_TIMESTAMP
+    std::printf("Running timestamp test...\n");
+    TimestampTest();
+#endif
+
+#ifdef SUPPORT_STATUS_LINE
+    std::printf("Running status line test...\n");
+    StatusLineTest();
+#endif
+
+#ifdef SUPPORT_RATE_LIMIT
+    std::printf("Running rate limit test...\n");
+    RateLimitTest();
+#endif
+
+#ifdef SUPPORT_TEE_SINK
+    std::printf("Running tee sink test...\n");
+    TeeTest();
+#endif
+
+#ifdef SUPPORT_ARENA
+    std::printf("Running arena test...\n");
+    ArenaTest();
+#endif
+#ifdef SUPPORT_LZ_SINK
+    std::printf("Running compression sink test...\n");
+    LzTest();
+#endif
+
     std::printf("Running torture test...\n");
     TortureTest();
 